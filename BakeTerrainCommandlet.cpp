@@ -0,0 +1,169 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BakeTerrainCommandlet.h"
+#include "WorldGenerator.h"
+#include "TerrainTileStore.h"
+#include "MyTerrainSaveGame.h"
+#include "Kismet/GameplayStatics.h"
+#include "Async/ParallelFor.h"
+#include "HAL/PlatformTime.h"
+
+DEFINE_LOG_CATEGORY_STATIC(LogBakeTerrain, Log, All);
+
+namespace
+{
+	bool ParseIntList(const FString& Value, TArray<int32>& OutValues)
+	{
+		TArray<FString> Parts;
+		Value.ParseIntoArray(Parts, TEXT(","));
+		for (const FString& Part : Parts)
+		{
+			if (!Part.TrimStartAndEnd().IsNumeric())
+			{
+				return false;
+			}
+			OutValues.Add(FCString::Atoi(*Part.TrimStartAndEnd()));
+		}
+		return OutValues.Num() > 0;
+	}
+}
+
+UBakeTerrainCommandlet::UBakeTerrainCommandlet()
+{
+	IsClient = false;
+	IsServer = false;
+	IsEditor = false;
+	LogToConsole = true;
+}
+
+int32 UBakeTerrainCommandlet::Main(const FString& Params)
+{
+	// Region rectangle, inclusive, in tile coordinates
+	FString RegionValue;
+	TArray<int32> Rect;
+	if (!FParse::Value(*Params, TEXT("Region="), RegionValue, false) || !ParseIntList(RegionValue, Rect) || Rect.Num() != 4)
+	{
+		UE_LOG(LogBakeTerrain, Error, TEXT("Expected -Region=MinX,MinY,MaxX,MaxY"));
+		return 1;
+	}
+	const FIntPoint Min(FMath::Min(Rect[0], Rect[2]), FMath::Min(Rect[1], Rect[3]));
+	const FIntPoint Max(FMath::Max(Rect[0], Rect[2]), FMath::Max(Rect[1], Rect[3]));
+
+	FString LODValue = TEXT("1");
+	FParse::Value(*Params, TEXT("LODs="), LODValue, false);
+	TArray<int32> LODLevels;
+	if (!ParseIntList(LODValue, LODLevels) || LODLevels.ContainsByPredicate([](int32 LODLevel) { return LODLevel < 1; }))
+	{
+		UE_LOG(LogBakeTerrain, Error, TEXT("Expected -LODs=1,2,... with every level at least 1"));
+		return 1;
+	}
+
+	// Vertex layout and default heights come from the generator class the game uses
+	TSubclassOf<AWorldGenerator> GeneratorClass = AWorldGenerator::StaticClass();
+	FString GeneratorPath;
+	if (FParse::Value(*Params, TEXT("Generator="), GeneratorPath))
+	{
+		GeneratorClass = LoadClass<AWorldGenerator>(nullptr, *GeneratorPath);
+		if (!GeneratorClass)
+		{
+			UE_LOG(LogBakeTerrain, Error, TEXT("Could not load world generator class %s"), *GeneratorPath);
+			return 1;
+		}
+	}
+	FTerrainTileParams TileParams = GeneratorClass->GetDefaultObject<AWorldGenerator>()->GetTileParams();
+	FTerrainNoiseParams& Noise = TileParams.Noise;
+
+	FString SlotName;
+	if (FParse::Value(*Params, TEXT("Slot="), SlotName))
+	{
+		UMyTerrainSaveGame* Layout = Cast<UMyTerrainSaveGame>(UGameplayStatics::LoadGameFromSlot(SlotName, 0));
+		if (!Layout)
+		{
+			UE_LOG(LogBakeTerrain, Error, TEXT("Could not load terrain layout from slot %s"), *SlotName);
+			return 1;
+		}
+		Noise.PBalance = Layout->PBalance;
+		Noise.MountainHeight = Layout->MountainHeight;
+		Noise.LandHeight = Layout->LandHeight;
+		Noise.MountainScale = Layout->MountainScale;
+		Noise.LandScale = Layout->LandScale;
+	}
+	else
+	{
+		FString PBalanceValue;
+		if (FParse::Value(*Params, TEXT("PBalance="), PBalanceValue, false))
+		{
+			FString X, Y;
+			if (!PBalanceValue.Split(TEXT(","), &X, &Y))
+			{
+				UE_LOG(LogBakeTerrain, Error, TEXT("Expected -PBalance=X,Y"));
+				return 1;
+			}
+			Noise.PBalance = FVector2D(FCString::Atod(*X), FCString::Atod(*Y));
+		}
+		FParse::Value(*Params, TEXT("MountainHeight="), Noise.MountainHeight);
+		FParse::Value(*Params, TEXT("LandHeight="), Noise.LandHeight);
+		FParse::Value(*Params, TEXT("MountainScale="), Noise.MountainScale);
+		FParse::Value(*Params, TEXT("LandScale="), Noise.LandScale);
+	}
+
+	FString OutputDirectory = FTerrainTileStore::GetBakedDirectory();
+	FParse::Value(*Params, TEXT("Output="), OutputDirectory);
+
+	const uint32 ParamsHash = TileParams.GetHash();
+	UE_LOG(LogBakeTerrain, Display, TEXT("Baking tiles (%d, %d) to (%d, %d), layout %08x, height kernel %s, into %s"),
+		Min.X, Min.Y, Max.X, Max.Y, ParamsHash, FTerrainHeightKernel::Get().GetPathName(), *OutputDirectory);
+
+	FTerrainTileStore Store(OutputDirectory);
+	const double StartTime = FPlatformTime::Seconds();
+	int64 NumTiles = 0;
+
+	// One region file at a time keeps memory bounded and writes every file in a single pass
+	const FIntPoint MinRegion = FTerrainTileStore::GetRegion(Min);
+	const FIntPoint MaxRegion = FTerrainTileStore::GetRegion(Max);
+	for (int32 LODLevel : LODLevels)
+	{
+		for (int32 RegionY = MinRegion.Y; RegionY <= MaxRegion.Y; RegionY++)
+		{
+			for (int32 RegionX = MinRegion.X; RegionX <= MaxRegion.X; RegionX++)
+			{
+				const FIntPoint RegionMin(FMath::Max(Min.X, RegionX * FTerrainTileStore::RegionSize), FMath::Max(Min.Y, RegionY * FTerrainTileStore::RegionSize));
+				const FIntPoint RegionMax(FMath::Min(Max.X, (RegionX + 1) * FTerrainTileStore::RegionSize - 1), FMath::Min(Max.Y, (RegionY + 1) * FTerrainTileStore::RegionSize - 1));
+				const int32 RegionWidth = RegionMax.X - RegionMin.X + 1;
+				const int32 RegionTiles = RegionWidth * (RegionMax.Y - RegionMin.Y + 1);
+
+				TArray<FCompressedTerrainTilePtr> Tiles;
+				Tiles.SetNum(RegionTiles);
+				ParallelFor(RegionTiles, [&](int32 Index)
+					{
+						FTerrainTileData Tile;
+						Tile.Tile = RegionMin + FIntPoint(Index % RegionWidth, Index / RegionWidth);
+						Tile.LODLevel = LODLevel;
+						Tile.ParamsHash = ParamsHash;
+						AWorldGenerator::GenerateTerrainTile(TileParams, Tile);
+
+						TSharedRef<FCompressedTerrainTile, ESPMode::ThreadSafe> CompressedTile = MakeShared<FCompressedTerrainTile, ESPMode::ThreadSafe>();
+						FCompressedTerrainTile::Compress(Tile, *CompressedTile);
+						Tiles[Index] = CompressedTile;
+					}
+				);
+
+				for (const FCompressedTerrainTilePtr& Tile : Tiles)
+				{
+					Store.Save(ParamsHash, Tile.ToSharedRef());
+				}
+				if (!Store.Flush())
+				{
+					UE_LOG(LogBakeTerrain, Error, TEXT("Could not write region (%d, %d) LOD %d"), RegionX, RegionY, LODLevel);
+					return 1;
+				}
+				NumTiles += RegionTiles;
+			}
+		}
+		UE_LOG(LogBakeTerrain, Display, TEXT("LOD %d done, %lld tiles so far"), LODLevel, NumTiles);
+	}
+
+	UE_LOG(LogBakeTerrain, Display, TEXT("Baked %lld tiles in %.1f s"), NumTiles, FPlatformTime::Seconds() - StartTime);
+	return 0;
+}
@@ -0,0 +1,30 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "BakeTerrainCommandlet.generated.h"
+
+/**
+ * Generates a rectangle of terrain tiles offline and writes them to a tile store the game reads at runtime.
+ * Needs no rendering, so it runs under -nullrhi.
+ *
+ * Usage:
+ *   UnrealEditor-Cmd TG.uproject -run=BakeTerrain -Region=MinX,MinY,MaxX,MaxY [-LODs=1,2,4] -nullrhi
+ *     [-Slot=TerrainLayoutSaveSlot] | [-PBalance=X,Y -MountainHeight= -LandHeight= -MountainScale= -LandScale=]
+ *     [-Generator=/Game/Path/BP_WorldGenerator.BP_WorldGenerator_C] [-Output=Dir]
+ *
+ * The layout comes from a saved terrain layout slot, explicit values, or the generator's defaults, in that order.
+ * Tiles are written to FTerrainTileStore::GetBakedDirectory unless -Output is given.
+ */
+UCLASS()
+class TG_API UBakeTerrainCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UBakeTerrainCommandlet();
+
+	virtual int32 Main(const FString& Params) override;
+};
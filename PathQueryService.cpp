@@ -0,0 +1,262 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PathQueryService.h"
+#include "Engine/World.h"
+#include "NavigationSystem.h"
+
+FPathQueryService::FPathQueryService(UWorld* InWorld)
+	: World(InWorld)
+{
+}
+
+FPathQueryService::~FPathQueryService()
+{
+	CancelAll();
+}
+
+uint32 FPathQueryService::Submit(TArray<FPathQueryCandidate> Candidates, int32 MaxValid, FOnPathQueryBatchComplete OnComplete)
+{
+	const uint32 BatchId = NextBatchId++;
+	FBatch& Batch = Batches.Add(BatchId);
+	Batch.Candidates = MoveTemp(Candidates);
+	Batch.MaxValid = MaxValid;
+	Batch.OnComplete = MoveTemp(OnComplete);
+	Batch.SubmitTime = FPlatformTime::Seconds();
+	return BatchId;
+}
+
+void FPathQueryService::Cancel(uint32 BatchId)
+{
+	if (FBatch* Batch = Batches.Find(BatchId))
+	{
+		AbortSearches(*Batch);
+		Batches.Remove(BatchId);
+	}
+}
+
+void FPathQueryService::CancelAll()
+{
+	for (TPair<uint32, FBatch>& Pair : Batches)
+	{
+		AbortSearches(Pair.Value);
+	}
+	Batches.Empty();
+}
+
+void FPathQueryService::Tick()
+{
+	if (Batches.Num() == 0)
+	{
+		return;
+	}
+
+	UNavigationSystemV1* NavSys = World.IsValid() ? FNavigationSystem::GetCurrent<UNavigationSystemV1>(World.Get()) : nullptr;
+	const bool bBuilding = NavSys && NavSys->IsNavigationBuildInProgress();
+	const double Now = FPlatformTime::Seconds();
+
+	// Ids only grow, so sorting them dispatches the oldest batch first
+	TArray<uint32> BatchIds;
+	Batches.GetKeys(BatchIds);
+	BatchIds.Sort();
+
+	// A completion delegate can end play, which destroys this service, or cancel batches still in BatchIds
+	const TWeakPtr<FPathQueryService> WeakThis = AsShared();
+
+	int32 Dispatches = 0;
+	for (const uint32 BatchId : BatchIds)
+	{
+		FBatch* Batch = Batches.Find(BatchId);
+		if (!Batch)
+		{
+			continue;
+		}
+
+		// Candidates around a pawn that just spawned would all fail before its navigation is built
+		if (bBuilding && Now - Batch->SubmitTime < MaxBuildWait)
+		{
+			continue;
+		}
+
+		while (!IsDone(*Batch) && Batch->NextCandidate < Batch->Candidates.Num() && Dispatches < MaxDispatchesPerTick)
+		{
+			if (!Dispatch(BatchId, *Batch))
+			{
+				break;
+			}
+			Dispatches++;
+		}
+
+		if (IsDone(*Batch))
+		{
+			Complete(BatchId);
+			if (!WeakThis.IsValid() || !World.IsValid())
+			{
+				return;
+			}
+		}
+	}
+}
+
+bool FPathQueryService::Dispatch(uint32 BatchId, FBatch& Batch)
+{
+	const int32 Candidate = Batch.NextCandidate;
+	const FPathQueryCandidate& Query = Batch.Candidates[Candidate];
+
+	UNavigationSystemV1* NavSys = World.IsValid() ? FNavigationSystem::GetCurrent<UNavigationSystemV1>(World.Get()) : nullptr;
+	ANavigationData* NavData = NavSys ? NavSys->GetDefaultNavDataInstance() : nullptr;
+	FNavLocation NavStart;
+	FNavLocation NavGoal;
+	if (!NavData || !NavSys->ProjectPointToNavigation(Query.Start, NavStart) || !NavSys->ProjectPointToNavigation(Query.Goal, NavGoal))
+	{
+		Batch.NextCandidate++;
+		SetResult(Batch, Candidate, false);
+		return true;
+	}
+
+	FCacheKey Key;
+	Key.StartPoly = NavStart.NodeRef;
+	Key.GoalPoly = NavGoal.NodeRef;
+	if (const FCacheEntry* Entry = Cache.Find(Key))
+	{
+		if (FPlatformTime::Seconds() - Entry->Time < CacheLifetime)
+		{
+			Stats.CacheHits++;
+			Batch.NextCandidate++;
+			SetResult(Batch, Candidate, Entry->bReachable);
+			return true;
+		}
+		Cache.Remove(Key);
+	}
+
+	if (NumSearches >= MaxSearchesInFlight)
+	{
+		return false;
+	}
+
+	// Partial paths end short of the goal, which is not reachable
+	FPathFindingQuery PathQuery(nullptr, *NavData, NavStart.Location, NavGoal.Location);
+	PathQuery.SetAllowPartialPaths(false);
+
+	const uint32 QueryId = NavSys->FindPathAsync(FNavAgentProperties(), PathQuery,
+		FNavPathQueryDelegate::CreateSP(this, &FPathQueryService::OnPathFound, BatchId, Key));
+	Batch.NextCandidate++;
+	if (QueryId == INVALID_NAVQUERYID)
+	{
+		SetResult(Batch, Candidate, false);
+		return true;
+	}
+
+	Batch.Searches.Add(QueryId, Candidate);
+	NumSearches++;
+	Stats.Searches++;
+	return true;
+}
+
+void FPathQueryService::OnPathFound(uint32 QueryId, ENavigationQueryResult::Type Result, FNavPathSharedPtr Path, uint32 BatchId, FCacheKey Key)
+{
+	const bool bReachable = Result == ENavigationQueryResult::Success && Path.IsValid() && !Path->IsPartial();
+
+	FCacheEntry& Entry = Cache.FindOrAdd(Key);
+	Entry.bReachable = bReachable;
+	Entry.Time = FPlatformTime::Seconds();
+	TrimCache();
+
+	// Aborted searches may still report, their batch no longer tracks them
+	FBatch* Batch = Batches.Find(BatchId);
+	int32 Candidate = INDEX_NONE;
+	if (!Batch || !Batch->Searches.RemoveAndCopyValue(QueryId, Candidate))
+	{
+		return;
+	}
+	NumSearches--;
+
+	SetResult(*Batch, Candidate, bReachable);
+	if (IsDone(*Batch))
+	{
+		Complete(BatchId);
+	}
+}
+
+void FPathQueryService::SetResult(FBatch& Batch, int32 Candidate, bool bValid)
+{
+	Stats.Tested++;
+	if (bValid && !IsDone(Batch))
+	{
+		Batch.ValidIndices.Add(Candidate);
+	}
+}
+
+bool FPathQueryService::IsDone(const FBatch& Batch) const
+{
+	if (Batch.MaxValid > 0 && Batch.ValidIndices.Num() >= Batch.MaxValid)
+	{
+		return true;
+	}
+	return Batch.NextCandidate >= Batch.Candidates.Num() && Batch.Searches.Num() == 0;
+}
+
+void FPathQueryService::Complete(uint32 BatchId)
+{
+	FBatch Batch;
+	if (!Batches.RemoveAndCopyValue(BatchId, Batch))
+	{
+		return;
+	}
+
+	Stats.CutOff += Batch.Candidates.Num() - Batch.NextCandidate + Batch.Searches.Num();
+	AbortSearches(Batch);
+
+	// Removed first, so the delegate can submit or cancel batches
+	Batch.OnComplete.ExecuteIfBound(Batch.ValidIndices);
+}
+
+void FPathQueryService::AbortSearches(FBatch& Batch)
+{
+	UNavigationSystemV1* NavSys = World.IsValid() ? FNavigationSystem::GetCurrent<UNavigationSystemV1>(World.Get()) : nullptr;
+	for (const TPair<uint32, int32>& Search : Batch.Searches)
+	{
+		if (NavSys)
+		{
+			NavSys->AbortAsyncFindPathRequest(Search.Key);
+		}
+	}
+	NumSearches -= Batch.Searches.Num();
+	Batch.Searches.Empty();
+}
+
+void FPathQueryService::TrimCache()
+{
+	if (Cache.Num() <= MaxCacheEntries)
+	{
+		return;
+	}
+
+	const double Now = FPlatformTime::Seconds();
+	for (auto It = Cache.CreateIterator(); It; ++It)
+	{
+		if (Now - It.Value().Time >= CacheLifetime)
+		{
+			It.RemoveCurrent();
+		}
+	}
+
+	// Everything still fresh, start over rather than track use order
+	if (Cache.Num() > MaxCacheEntries)
+	{
+		Cache.Empty();
+	}
+}
+
+void FPathQueryService::ClearCache()
+{
+	Cache.Empty();
+}
+
+FPathQueryStats FPathQueryService::GetStats() const
+{
+	FPathQueryStats Result = Stats;
+	Result.PendingBatches = Batches.Num();
+	Result.CacheEntries = Cache.Num();
+	return Result;
+}
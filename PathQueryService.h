@@ -0,0 +1,161 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "NavigationData.h"
+#include "PathQueryService.generated.h"
+
+class UWorld;
+
+USTRUCT(BlueprintType)
+struct FPathQueryCandidate
+{
+	GENERATED_BODY()
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Navigation")
+	FVector Start = FVector::ZeroVector;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Navigation")
+	FVector Goal = FVector::ZeroVector;
+};
+
+USTRUCT(BlueprintType)
+struct FPathQueryStats
+{
+	GENERATED_BODY()
+
+	// Candidates answered, from the cache or a path search
+	UPROPERTY(BlueprintReadOnly, Category = "Navigation")
+	int64 Tested = 0;
+
+	UPROPERTY(BlueprintReadOnly, Category = "Navigation")
+	int64 CacheHits = 0;
+
+	// Async path searches started
+	UPROPERTY(BlueprintReadOnly, Category = "Navigation")
+	int64 Searches = 0;
+
+	// Candidates never tested, or aborted mid search, because their batch already had enough valid goals
+	UPROPERTY(BlueprintReadOnly, Category = "Navigation")
+	int64 CutOff = 0;
+
+	UPROPERTY(BlueprintReadOnly, Category = "Navigation")
+	int32 PendingBatches = 0;
+
+	UPROPERTY(BlueprintReadOnly, Category = "Navigation")
+	int32 CacheEntries = 0;
+};
+
+// Indices of the valid candidates of a batch, in the order they were found
+DECLARE_DELEGATE_OneParam(FOnPathQueryBatchComplete, const TArray<int32>& /* ValidIndices */);
+
+/**
+ * Checks batches of (start, goal) candidates for a full path on the default navmesh without blocking the
+ * game thread. Candidates are projected onto the navmesh as they are dispatched and searched with the
+ * navigation system's async path finding, a few at a time, in candidate order. A batch stops once it has
+ * MaxValid valid goals, aborting its searches still in flight.
+ *
+ * Results are cached by the pair of navmesh polygons the start and goal land on. Polygon refs include
+ * their nav tile's salt, so entries stop matching as soon as either end's nav tile is rebuilt; entries
+ * also expire after CacheLifetime, for tiles rebuilt somewhere along the path.
+ *
+ * Completion delegates only ever run from Tick or from a path search result, never from Submit.
+ * Game thread only.
+ */
+class TG_API FPathQueryService : public TSharedFromThis<FPathQueryService>
+{
+public:
+	explicit FPathQueryService(UWorld* InWorld);
+	~FPathQueryService();
+
+	// Async path searches in flight at once, over every batch
+	int32 MaxSearchesInFlight = 8;
+
+	// Candidates projected and looked up per Tick, over every batch
+	int32 MaxDispatchesPerTick = 64;
+
+	// Seconds a batch waits for a navmesh build in progress before it is tested anyway
+	float MaxBuildWait = 2.f;
+
+	float CacheLifetime = 30.f;
+	int32 MaxCacheEntries = 4096;
+
+	// Queues a batch, returns its id. MaxValid <= 0 tests every candidate.
+	uint32 Submit(TArray<FPathQueryCandidate> Candidates, int32 MaxValid, FOnPathQueryBatchComplete OnComplete);
+
+	// Drops a batch without calling its delegate
+	void Cancel(uint32 BatchId);
+	void CancelAll();
+
+	// Dispatches queued candidates and completes finished batches
+	void Tick();
+
+	void ClearCache();
+
+	FPathQueryStats GetStats() const;
+
+private:
+	struct FCacheKey
+	{
+		NavNodeRef StartPoly = INVALID_NAVNODEREF;
+		NavNodeRef GoalPoly = INVALID_NAVNODEREF;
+
+		bool operator==(const FCacheKey& Other) const
+		{
+			return StartPoly == Other.StartPoly && GoalPoly == Other.GoalPoly;
+		}
+
+		friend uint32 GetTypeHash(const FCacheKey& Key)
+		{
+			return HashCombine(GetTypeHash(Key.StartPoly), GetTypeHash(Key.GoalPoly));
+		}
+	};
+
+	struct FCacheEntry
+	{
+		bool bReachable = false;
+		double Time = 0.0;
+	};
+
+	struct FBatch
+	{
+		TArray<FPathQueryCandidate> Candidates;
+		int32 MaxValid = 0;
+		FOnPathQueryBatchComplete OnComplete;
+		double SubmitTime = 0.0;
+
+		// Next candidate to dispatch
+		int32 NextCandidate = 0;
+
+		// Async query id to candidate index
+		TMap<uint32, int32> Searches;
+
+		TArray<int32> ValidIndices;
+	};
+
+	// Resolves one candidate from the cache or starts its search. False if the search cap is reached.
+	bool Dispatch(uint32 BatchId, FBatch& Batch);
+
+	void OnPathFound(uint32 QueryId, ENavigationQueryResult::Type Result, FNavPathSharedPtr Path, uint32 BatchId, FCacheKey Key);
+
+	void SetResult(FBatch& Batch, int32 Candidate, bool bValid);
+	bool IsDone(const FBatch& Batch) const;
+
+	// Aborts the batch's searches and calls its delegate
+	void Complete(uint32 BatchId);
+
+	void AbortSearches(FBatch& Batch);
+	void TrimCache();
+
+	TWeakObjectPtr<UWorld> World;
+
+	// Batches by id, dispatched oldest first
+	TMap<uint32, FBatch> Batches;
+	uint32 NextBatchId = 1;
+	int32 NumSearches = 0;
+
+	TMap<FCacheKey, FCacheEntry> Cache;
+
+	FPathQueryStats Stats;
+};
@@ -1,11 +1,13 @@
 #include "Spawner.h"
+#include "WorldGenerator.h"
+#include "EngineUtils.h"
+#include "PhysicalMaterials/PhysicalMaterial.h"
 
 // Sets default values
 ASpawner::ASpawner()
 {
 	// Set this actor to call Tick() every frame.  You can turn this off to improve performance if you don't need it.
 	PrimaryActorTick.bCanEverTick = true;
-	PrimaryActorTick.TickInterval = 3;
 
 }
 
@@ -14,14 +16,28 @@ void ASpawner::BeginPlay()
 {
 	Super::BeginPlay();
 
+	for (TActorIterator<AWorldGenerator> It(GetWorld()); It; ++It)
+	{
+		WorldGenerator = *It;
+		break;
+	}
 
+	GroundTraceDelegate.BindUObject(this, &ASpawner::OnGroundTraced);
 }
 
 // Called every frame
 void ASpawner::Tick(float DeltaTime)
 {
 	Super::Tick(DeltaTime);
-	UpdateTiles();
+
+	const double Now = GetWorld()->GetTimeSeconds();
+	if (LastUpdateTime < 0.0 || Now - LastUpdateTime >= UpdateInterval)
+	{
+		LastUpdateTime = Now;
+		UpdateTiles();
+	}
+
+	TraceQueuedGround();
 }
 
 FVector ASpawner::GetPlayerCell()
@@ -48,31 +64,12 @@ void ASpawner::UpdateTiles()
 	{
 		for (int X = CellCount * (-.5f); X <= CellCount * (0.5f); X++)
 		{
+			// Cells already filled or still waiting for their ground are skipped
 			FVector TileCenter = Origin + FVector(X, Y, 0) * CellSize;
-
-			FHitResult Hit;
-			FCollisionQueryParams CollisionParams;
-			APlayerController* PlayerController = GetWorld()->GetFirstPlayerController();
-			AActor* Player = PlayerController->GetPawn();
-			CollisionParams.AddIgnoredActor(Player);
-
-			bool bHit = GetWorld()->LineTraceSingleByChannel(
-				Hit,
-				TileCenter + FVector::UpVector * TraceDistance,
-				TileCenter - FVector::UpVector * TraceDistance,
-				ECC_Visibility,
-				CollisionParams
-			);
-
-			if (bHit)
+			if (!Tiles.Contains(FVector2D(TileCenter.X, TileCenter.Y)))
 			{
-				if (!SpawnedTiles.Contains(FVector2D(TileCenter.X, TileCenter.Y)))
-				{
-					//DrawDebugBox(GetWorld(), Hit.Location, FVector(1, 1, 1) * CellSize * .5f, FColor::Red, false, 5);
-					SpawnedTiles.Add(FVector2D(TileCenter.X, TileCenter.Y));
-					UpdateTile(Hit.Location);
-				}
-
+				Tiles.Add(FVector2D(TileCenter.X, TileCenter.Y)).Serial = NextTileSerial++;
+				QueueGround(TileCenter, TileCenter, true);
 			}
 		}
 	}
@@ -81,28 +78,12 @@ void ASpawner::UpdateTiles()
 
 void ASpawner::UpdateTile(const FVector TileCenter)
 {
-	FHitResult Hit;
-	FCollisionQueryParams CollisionParams;
-	CollisionParams.bReturnPhysicalMaterial = true;
-	bool bHit;
-
+	// The whole cell is queued at once, SpawnObject is called as the hits come back
 	for (int Y = CellSize * (-.5f); Y <= CellSize * (.5f); Y += SubCellSize)
 	{
 		for (int X = CellSize * (-.5f); X < CellSize * (.5f); X += SubCellSize)
 		{
-			FVector SubCellLocation = TileCenter + FVector(X + FMath::RandRange(-SubCellRandomOffset, SubCellRandomOffset), Y + FMath::RandRange(-SubCellRandomOffset, SubCellRandomOffset), 0);
-			bHit = GetWorld()->LineTraceSingleByChannel(
-				Hit,
-				SubCellLocation + FVector::UpVector * TraceDistance,
-				SubCellLocation - FVector::UpVector * TraceDistance,
-				ECC_Visibility,
-				CollisionParams
-			);
-			if (bHit)
-			{
-				//DrawDebugLine(GetWorld(), Hit.Location + FVector::UpVector * 100, Hit.Location, FColor::Green, false, 5);
-				SpawnObject(Hit, TileCenter);
-			}
+			QueueGround(TileCenter + FVector(X + FMath::RandRange(-SubCellRandomOffset, SubCellRandomOffset), Y + FMath::RandRange(-SubCellRandomOffset, SubCellRandomOffset), 0), TileCenter, false);
 		}
 	}
 }
@@ -115,8 +96,6 @@ void ASpawner::SpawnObject(const FHitResult Hit, const FVector ParentTileCenter)
 void ASpawner::RemoveFarTiles()
 {
 	FVector PlayerCell = GetPlayerCell();
-	TArray<FVector2D> SpawnedTilesCopy;
-	SpawnedTilesCopy.Append(SpawnedTiles);
 
 	APlayerController* PlayerController = GetWorld()->GetFirstPlayerController();
 	if (!PlayerController)
@@ -130,23 +109,23 @@ void ASpawner::RemoveFarTiles()
 		return;
 	}
 
-	for (int TileIndex = 0; TileIndex < SpawnedTilesCopy.Num(); TileIndex++)
+	// Cells still waiting for ground are dropped too, their queued and in flight lookups are then ignored
+	for (auto It = Tiles.CreateIterator(); It; ++It)
 	{
-		FVector2D RelativeTileLocation = SpawnedTilesCopy[TileIndex] - FVector2D(PlayerCell);
+		FVector2D RelativeTileLocation = It.Key() - FVector2D(PlayerCell);
 		if (
 			FMath::Abs(RelativeTileLocation.X) > CellCount * .5f * CellSize ||
 			FMath::Abs(RelativeTileLocation.Y) > CellCount * .5f * CellSize
 			)
 		{
-			FVector TileCenter = FVector(SpawnedTilesCopy[TileIndex], PlayerCell.Z);
-			FHitResult Hit;
-
-			if (PerformLineTrace(TileCenter + FVector::UpVector * TraceDistance, TileCenter - FVector::UpVector * TraceDistance, Hit))
+			// The ground under the centre was kept when the cell was filled, no need to trace it again
+			if (It.Value().bSpawned)
 			{
-				//DrawDebugBox(GetWorld(), Hit.Location, FVector(1, 1, 1) * CellSize * .5f, FColor::Blue, false, 5);
-				RemoveTile(Hit.Location);
-				SpawnedTiles.Remove(SpawnedTilesCopy[TileIndex]);
+				//DrawDebugBox(GetWorld(), It.Value().Center, FVector(1, 1, 1) * CellSize * .5f, FColor::Blue, false, 5);
+				RemoveTile(It.Value().Center);
+				SpawnedTiles.Remove(It.Key());
 			}
+			It.RemoveCurrent();
 		}
 	}
 }
@@ -165,10 +144,183 @@ bool ASpawner::PerformLineTrace(const FVector& Start, const FVector& End, FHitRe
 	);
 }
 
+void ASpawner::FindGround(TConstArrayView<FVector> Locations, const FCollisionQueryParams& Params, TArray<FHitResult>& OutHits) const
+{
+	OutHits.SetNum(Locations.Num());
+
+	if (!UseTerrainQuery || !WorldGenerator)
+	{
+		for (int Index = 0; Index < Locations.Num(); Index++)
+		{
+			GetWorld()->LineTraceSingleByChannel(OutHits[Index], Locations[Index] + FVector::UpVector * TraceDistance,
+				Locations[Index] - FVector::UpVector * TraceDistance, ECC_Visibility, Params);
+		}
+		return;
+	}
 
+	TArray<FVector2D> Locations2D;
+	for (const FVector& Location : Locations)
+	{
+		Locations2D.Add(FVector2D(Location));
+	}
 
+	TArray<FTerrainSurfaceSample> Samples;
+	WorldGenerator->QueryTerrain(Locations2D, Samples);
+	UPhysicalMaterial* PhysMaterial = WorldGenerator->GetTerrainPhysicalMaterial();
+
+	// Hits as a trace over the same span would have returned them
+	for (int Index = 0; Index < Locations.Num(); Index++)
+	{
+		const FVector Start = Locations[Index] + FVector::UpVector * TraceDistance;
+		const FVector End = Locations[Index] - FVector::UpVector * TraceDistance;
+		FHitResult& Hit = OutHits[Index];
+		Hit = FHitResult(Start, End);
+		if (Samples[Index].Height > Start.Z || Samples[Index].Height < End.Z)
+		{
+			continue;
+		}
+
+		Hit.bBlockingHit = true;
+		Hit.Location = Hit.ImpactPoint = FVector(Locations2D[Index], Samples[Index].Height);
+		Hit.Normal = Hit.ImpactNormal = Samples[Index].Normal;
+		Hit.Distance = Start.Z - Samples[Index].Height;
+		Hit.Time = Hit.Distance / (2.f * TraceDistance);
+		Hit.Component = WorldGenerator->TerrainMesh;
+		Hit.PhysMaterial = PhysMaterial;
+	}
+}
 
 void ASpawner::RemoveTile(const FVector TileCenter)
 {
 
+}
+
+void ASpawner::QueueGround(const FVector& Location, const FVector& TileCenter, bool bTileCenter)
+{
+	const FSpawnedTile* Tile = Tiles.Find(FVector2D(TileCenter.X, TileCenter.Y));
+
+	FGroundRequest& Request = QueuedGround.AddDefaulted_GetRef();
+	Request.Location = Location;
+	Request.TileCenter = TileCenter;
+	Request.Serial = Tile ? Tile->Serial : INDEX_NONE;
+	Request.bTileCenter = bTileCenter;
+}
+
+bool ASpawner::IsCurrent(const FGroundRequest& Request) const
+{
+	if (Request.Serial == INDEX_NONE)
+	{
+		return true;
+	}
+
+	const FSpawnedTile* Tile = Tiles.Find(FVector2D(Request.TileCenter.X, Request.TileCenter.Y));
+	return Tile && Tile->Serial == Request.Serial;
+}
+
+void ASpawner::TraceQueuedGround()
+{
+	// Lookups of dropped cells are discarded without counting against the budget
+	TArray<FGroundRequest> Batch;
+	int32 NumTaken = 0;
+	for (; NumTaken < QueuedGround.Num() && Batch.Num() < MaxGroundTracesPerFrame; NumTaken++)
+	{
+		if (IsCurrent(QueuedGround[NumTaken]))
+		{
+			Batch.Add(QueuedGround[NumTaken]);
+		}
+	}
+	QueuedGround.RemoveAt(0, NumTaken);
+
+	if (Batch.Num() == 0)
+	{
+		return;
+	}
+
+	// Cell centres skip the player, spawn points need the surface type
+	FCollisionQueryParams CenterParams;
+	APlayerController* PlayerController = GetWorld()->GetFirstPlayerController();
+	CenterParams.AddIgnoredActor(PlayerController ? PlayerController->GetPawn() : nullptr);
+
+	FCollisionQueryParams SpawnParams;
+	SpawnParams.bReturnPhysicalMaterial = true;
+
+	if (UseTerrainQuery && WorldGenerator)
+	{
+		// One lookup per kind of request, so each gets its own params should FindGround trace
+		for (const bool bTileCenter : { true, false })
+		{
+			TArray<FGroundRequest> Requests = Batch.FilterByPredicate([bTileCenter](const FGroundRequest& Request) { return Request.bTileCenter == bTileCenter; });
+			TArray<FVector> Locations;
+			for (const FGroundRequest& Request : Requests)
+			{
+				Locations.Add(Request.Location);
+			}
+
+			TArray<FHitResult> Hits;
+			FindGround(Locations, bTileCenter ? CenterParams : SpawnParams, Hits);
+			for (int Index = 0; Index < Requests.Num(); Index++)
+			{
+				OnGroundFound(Requests[Index], Hits[Index]);
+			}
+		}
+		return;
+	}
+
+	for (const FGroundRequest& Request : Batch)
+	{
+		const uint32 TraceId = NextGroundTraceId++;
+		GroundInFlight.Add(TraceId, Request);
+		GetWorld()->AsyncLineTraceByChannel(EAsyncTraceType::Single, Request.Location + FVector::UpVector * TraceDistance,
+			Request.Location - FVector::UpVector * TraceDistance, ECC_Visibility, Request.bTileCenter ? CenterParams : SpawnParams,
+			FCollisionResponseParams::DefaultResponseParam, &GroundTraceDelegate, TraceId);
+	}
+}
+
+void ASpawner::OnGroundTraced(const FTraceHandle& Handle, FTraceDatum& Datum)
+{
+	FGroundRequest Request;
+	if (!GroundInFlight.RemoveAndCopyValue(Datum.UserData, Request))
+	{
+		return;
+	}
+
+	FHitResult Hit(Datum.Start, Datum.End);
+	if (Datum.OutHits.Num() > 0)
+	{
+		Hit = Datum.OutHits[0];
+	}
+	OnGroundFound(Request, Hit);
+}
+
+void ASpawner::OnGroundFound(const FGroundRequest& Request, const FHitResult& Hit)
+{
+	if (!IsCurrent(Request))
+	{
+		return;
+	}
+
+	if (!Request.bTileCenter)
+	{
+		if (Hit.bBlockingHit)
+		{
+			//DrawDebugLine(GetWorld(), Hit.Location + FVector::UpVector * 100, Hit.Location, FColor::Green, false, 5);
+			SpawnObject(Hit, Request.TileCenter);
+		}
+		return;
+	}
+
+	// No ground under the centre, the cell is looked for again on the next update
+	const FVector2D TileKey(Request.TileCenter.X, Request.TileCenter.Y);
+	if (!Hit.bBlockingHit)
+	{
+		Tiles.Remove(TileKey);
+		return;
+	}
+
+	//DrawDebugBox(GetWorld(), Hit.Location, FVector(1, 1, 1) * CellSize * .5f, FColor::Red, false, 5);
+	FSpawnedTile& Tile = Tiles[TileKey];
+	Tile.bSpawned = true;
+	Tile.Center = Hit.Location;
+	SpawnedTiles.Add(TileKey);
+	UpdateTile(Hit.Location);
 }
\ No newline at end of file
@@ -6,8 +6,11 @@
 #include "GameFramework/Actor.h"
 #include "FoliageType_InstancedStaticMesh.h"
 #include "ProceduralMeshComponent.h"
+#include "WorldCollision.h"
 #include "Spawner.generated.h"
 
+class AWorldGenerator;
+
 UCLASS()
 class TG_API ASpawner : public AActor
 {
@@ -35,6 +38,20 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadwrite, Category = "SpawnGrid")
 	int HeightMin = 300;
 
+	// Read the ground from the world generator's terrain query instead of tracing, when there is a world generator.
+	// Only for spawners that place on bare terrain: every hit is the terrain, buildings, water and other geometry
+	// are ignored, and tiles not drawn yet are answered at LOD 1.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "SpawnGrid")
+	bool UseTerrainQuery = false;
+
+	// Ground locations looked up per frame. Traces are asynchronous, their hits are spawned on the next frame.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "SpawnGrid")
+	int MaxGroundTracesPerFrame = 256;
+
+	// Seconds between looking for cells to fill or clear, queued ground keeps being traced every frame
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "SpawnGrid")
+	float UpdateInterval = 3.f;
+
 	TArray<FVector2D> SpawnedTiles;
 
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Foliage")
@@ -50,6 +67,14 @@ protected:
 
 	bool PerformLineTrace(const FVector& Start, const FVector& End, FHitResult& OutHit) const;
 
+	// Ground within TraceDistance above or below each location, OutHits[i].bBlockingHit is false where there is none.
+	// Uses the terrain query when UseTerrainQuery is on, Params only apply to traces.
+	void FindGround(TConstArrayView<FVector> Locations, const FCollisionQueryParams& Params, TArray<FHitResult>& OutHits) const;
+
+	// Terrain the spawner sits on, found at BeginPlay
+	UPROPERTY()
+	AWorldGenerator* WorldGenerator = nullptr;
+
 
 public:
 	// Called every frame
@@ -73,4 +98,40 @@ public:
 	UFUNCTION(BlueprintCallable)
 	virtual void RemoveTile(const FVector TileCenter);
 
+private:
+		// A location to find the ground under, either a cell centre or a point of the cell to spawn at
+		struct FGroundRequest
+		{
+			FVector Location = FVector::ZeroVector;
+			FVector TileCenter = FVector::ZeroVector;
+			// Serial of the cell when queued, INDEX_NONE for cells the spawner does not track
+			int32 Serial = INDEX_NONE;
+			bool bTileCenter = false;
+		};
+
+		// A cell waiting for its ground or already filled. Each lookup of a cell gets a new serial, so results for a dropped cell are ignored.
+		struct FSpawnedTile
+		{
+			int32 Serial = 0;
+			bool bSpawned = false;
+			// Ground under the cell centre, once found
+			FVector Center = FVector::ZeroVector;
+		};
+
+		void QueueGround(const FVector& Location, const FVector& TileCenter, bool bTileCenter);
+		bool IsCurrent(const FGroundRequest& Request) const;
+
+		// Starts up to MaxGroundTracesPerFrame of the queued lookups, answered right away from the terrain query
+		void TraceQueuedGround();
+		void OnGroundTraced(const FTraceHandle& Handle, FTraceDatum& Datum);
+		void OnGroundFound(const FGroundRequest& Request, const FHitResult& Hit);
+
+		TMap<FVector2D, FSpawnedTile> Tiles;
+		TArray<FGroundRequest> QueuedGround;
+		TMap<uint32, FGroundRequest> GroundInFlight;
+		FTraceDelegate GroundTraceDelegate;
+		uint32 NextGroundTraceId = 0;
+		int32 NextTileSerial = 0;
+		double LastUpdateTime = -1.0;
+
 };
\ No newline at end of file
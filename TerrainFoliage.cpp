@@ -0,0 +1,364 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "TerrainFoliage.h"
+#include "TerrainQuery.h"
+#include "FoliageType_InstancedStaticMesh.h"
+
+namespace
+{
+	// Height and slope of a tile's drawn mesh, interpolated over its triangles the way FTerrainQuery does
+	struct FTileSurface
+	{
+		TConstArrayView<FVector> Vertices;
+		FVector2D Origin;
+		float Step;
+		FIntPoint NumVertices;
+
+		bool Sample(const FVector2D& Location, float& OutHeight, float& OutSlopeDegrees) const
+		{
+			const FVector2D Local = (Location - Origin) / Step;
+			if (Local.X < 0.0 || Local.Y < 0.0 || Local.X > NumVertices.X - 1 || Local.Y > NumVertices.Y - 1)
+			{
+				return false;
+			}
+
+			const int32 CellX = FMath::Min(FMath::FloorToInt(Local.X), NumVertices.X - 2);
+			const int32 CellY = FMath::Min(FMath::FloorToInt(Local.Y), NumVertices.Y - 2);
+			const float FX = (float)(Local.X - CellX);
+			const float FY = (float)(Local.Y - CellY);
+
+			const float H00 = Vertices[CellY * NumVertices.X + CellX].Z;
+			const float H10 = Vertices[CellY * NumVertices.X + CellX + 1].Z;
+			const float H01 = Vertices[(CellY + 1) * NumVertices.X + CellX].Z;
+			const float H11 = Vertices[(CellY + 1) * NumVertices.X + CellX + 1].Z;
+
+			// Quads are split along the (1, 0) - (0, 1) diagonal
+			float SlopeX;
+			float SlopeY;
+			if (FX + FY <= 1.f)
+			{
+				OutHeight = H00 + FX * (H10 - H00) + FY * (H01 - H00);
+				SlopeX = H10 - H00;
+				SlopeY = H01 - H00;
+			}
+			else
+			{
+				OutHeight = H11 + (1.f - FX) * (H01 - H11) + (1.f - FY) * (H10 - H11);
+				SlopeX = H11 - H01;
+				SlopeY = H11 - H10;
+			}
+
+			OutSlopeDegrees = FTerrainQuery::GetSlopeDegrees(FVector(-SlopeX, -SlopeY, Step).GetSafeNormal());
+			return true;
+		}
+	};
+
+	// Smallest spacing between instances of one foliage type, for types with a tiny collision radius
+	constexpr float MinPoissonDistance = 50.f;
+
+	// Caps the candidate grid of a tile, cells grow past MinDistance / sqrt(2) above it
+	constexpr double MaxPoissonCellsPerSide = 1024.0;
+
+	// Murmur3 finaliser, every input bit affects every output bit
+	uint32 MixHash(uint32 Hash)
+	{
+		Hash ^= Hash >> 16;
+		Hash *= 0x85ebca6b;
+		Hash ^= Hash >> 13;
+		Hash *= 0xc2b2ae35;
+		Hash ^= Hash >> 16;
+		return Hash;
+	}
+
+	// Counter-based, so any thread can find any cell's candidate without a stream to advance
+	uint32 HashCell(int32 Seed, const FIntPoint& Cell, int32 TypeIndex)
+	{
+		uint32 Hash = MixHash((uint32)Seed ^ 0x9e3779b9);
+		Hash = MixHash(Hash ^ (uint32)Cell.X);
+		Hash = MixHash(Hash + (uint32)Cell.Y * 0x27d4eb2d);
+		return MixHash(Hash ^ (uint32)TypeIndex * 0x165667b1);
+	}
+
+	void AddInstance(FTerrainFoliageInstances& OutInstances, const FTerrainFoliageParams& Params, int32 TypeIndex, const FVector2D& Location, float Height, bool bRandomYaw, FRandomStream& Stream)
+	{
+		const FTerrainFoliageTypeParams& Type = Params.Types[TypeIndex];
+		const FVector InstanceLocation = Params.Offset + FVector(Location, Height + Stream.FRandRange(Type.ZOffset.Min, Type.ZOffset.Max));
+		const FVector Scale = FVector::One() * Stream.FRandRange(Type.ProceduralScale.Min, Type.ProceduralScale.Max);
+		const FRotator Rotation = bRandomYaw ? FRotator(0, Stream.FRandRange(0, 360), 0) : FRotator::ZeroRotator;
+
+		// Hashed from the location rather than drawn from Stream, so the split leaves every later instance where it was
+		const uint32 TierHash = HashCell(Params.Seed, FIntPoint(FMath::FloorToInt(Location.X), FMath::FloorToInt(Location.Y)), TypeIndex);
+		const bool bNearOnly = MixHash(TierHash ^ 6) / 4294967296.0 >= Type.MiddleDensity;
+		(bNearOnly ? OutInstances.NearTransforms : OutInstances.Transforms)[TypeIndex].Add(FTransform(Rotation, InstanceLocation, Scale));
+		OutInstances.NumInstances++;
+		OutInstances.Bounds += InstanceLocation;
+	}
+
+	void PlaceClusters(const FTerrainFoliageParams& Params, const FIntPoint& Tile, TConstArrayView<FVector> Vertices, const FTileSurface& Surface, FTerrainFoliageInstances& OutInstances)
+	{
+		FRandomStream Stream(HashCombine(GetTypeHash(Params.Seed), GetTypeHash(Tile)));
+
+		float Height;
+		float SlopeDegrees;
+		for (const FVector& Vertex : Vertices)
+		{
+			const FVector2D VertexLocation(Vertex);
+			const float Altitude = Params.Offset.Z + Vertex.Z;
+
+			// Clusters, a short random walk from the vertex with a few seeds around every step
+			for (int32 TypeIndex = 0; TypeIndex < Params.Types.Num(); TypeIndex++)
+			{
+				const FTerrainFoliageTypeParams& Type = Params.Types[TypeIndex];
+				if (!Type.bValid || Altitude < Type.Height.Min || Altitude > Type.Height.Max)
+				{
+					continue;
+				}
+
+				if (Type.InitialSeedDensity < Stream.FRandRange(0.f, 10.f))
+				{
+					continue;
+				}
+
+				const int32 MaxSteps = Stream.RandRange(0, Type.NumSteps);
+				FVector2D ClusterBase = VertexLocation;
+				for (int32 Step = 0; Step < MaxSteps; Step++)
+				{
+					ClusterBase += FVector2D(Stream.GetUnitVector()) * Type.AverageSpreadDistance;
+
+					const int32 MaxSeeds = Stream.RandRange(0, Type.SeedsPerStep);
+					for (int32 SeedIndex = 0; SeedIndex < MaxSeeds; SeedIndex++)
+					{
+						const FVector2D SeedLocation = ClusterBase + FVector2D(Stream.GetUnitVector()) * Type.SpreadVariance;
+						if (Surface.Sample(SeedLocation, Height, SlopeDegrees) && SlopeDegrees >= Type.GroundSlopeAngle.Min && SlopeDegrees <= Type.GroundSlopeAngle.Max)
+						{
+							AddInstance(OutInstances, Params, TypeIndex, SeedLocation, Height, Type.bRandomYaw, Stream);
+						}
+					}
+				}
+			}
+
+			// Single instances a set distance from the vertex
+			for (int32 TypeIndex = 0; TypeIndex < Params.Types.Num(); TypeIndex++)
+			{
+				const FTerrainFoliageTypeParams& Type = Params.Types[TypeIndex];
+				if (!Type.bValid || Altitude < Type.Height.Min || Altitude > Type.Height.Max)
+				{
+					continue;
+				}
+
+				if (Stream.FRandRange(0.f, 100.f) >= Params.GrowthProbabilityPercentage)
+				{
+					continue;
+				}
+
+				const FVector2D Offset(
+					Params.InstanceOffset + Stream.FRandRange(-Params.InstanceOffsetVariation, Params.InstanceOffsetVariation),
+					Params.InstanceOffset + Stream.FRandRange(-Params.InstanceOffsetVariation, Params.InstanceOffsetVariation));
+				const FVector2D InstanceLocation = VertexLocation + Offset;
+				if (Surface.Sample(InstanceLocation, Height, SlopeDegrees) && SlopeDegrees >= Params.GroundSlopeAngle.Min && SlopeDegrees <= Params.GroundSlopeAngle.Max)
+				{
+					AddInstance(OutInstances, Params, TypeIndex, InstanceLocation, Height, false, Stream);
+				}
+			}
+		}
+	}
+
+	void PlacePoissonDisk(const FTerrainTileParams& TileParams, const FTerrainFoliageParams& Params, const FIntPoint& Tile, int32 TypeIndex, const FTileSurface& Surface, FTerrainFoliageInstances& OutInstances)
+	{
+		const FTerrainFoliageTypeParams& Type = Params.Types[TypeIndex];
+		const FVector2D TileMin = TileParams.GetTileOrigin(Tile);
+		const FVector2D TileMax = TileParams.GetTileOrigin(Tile + FIntPoint(1, 1));
+
+		// One candidate per cell, cells small enough that a full disk set fits, but never so many that a tile gets out of hand
+		const float MinDistance = FMath::Max(2.f * Type.CollisionRadius, MinPoissonDistance);
+		const double CellSize = FMath::Max((double)MinDistance / UE_SQRT_2, FMath::Max(TileMax.X - TileMin.X, TileMax.Y - TileMin.Y) / MaxPoissonCellsPerSide);
+		const int32 Reach = FMath::CeilToInt(MinDistance / CellSize);
+
+		// InitialSeedDensity is per 10 m square, thins candidates before they compete for space
+		const double KeepProbability = FMath::Min(1.0, Type.InitialSeedDensity * CellSize * CellSize / (1000.0 * 1000.0));
+		const uint32 KeepThreshold = (uint32)(KeepProbability * (double)MAX_uint32);
+
+		// Cells of the tile, and around it as far as a candidate can reach into it
+		const FIntPoint FirstCell(FMath::FloorToInt(TileMin.X / CellSize), FMath::FloorToInt(TileMin.Y / CellSize));
+		const FIntPoint LastCell(FMath::FloorToInt(TileMax.X / CellSize), FMath::FloorToInt(TileMax.Y / CellSize));
+		const FIntPoint GridMin = FirstCell - FIntPoint(Reach, Reach);
+		const FIntPoint GridSize = LastCell - FirstCell + FIntPoint(2 * Reach + 1, 2 * Reach + 1);
+
+		struct FCandidate
+		{
+			FVector2D Location;
+			uint32 Hash = 0;
+			uint32 Priority = 0;
+			bool bValid = false;
+		};
+		TArray<FCandidate> Candidates;
+		Candidates.SetNum(GridSize.X * GridSize.Y);
+		for (int32 Y = 0; Y < GridSize.Y; Y++)
+		{
+			for (int32 X = 0; X < GridSize.X; X++)
+			{
+				const FIntPoint Cell = GridMin + FIntPoint(X, Y);
+				FCandidate& Candidate = Candidates[Y * GridSize.X + X];
+				Candidate.Hash = HashCell(Params.Seed, Cell, TypeIndex);
+				Candidate.bValid = MixHash(Candidate.Hash ^ 1) < KeepThreshold;
+				Candidate.Location = FVector2D(
+					(Cell.X + MixHash(Candidate.Hash ^ 2) / 4294967296.0) * CellSize,
+					(Cell.Y + MixHash(Candidate.Hash ^ 3) / 4294967296.0) * CellSize);
+				Candidate.Priority = MixHash(Candidate.Hash ^ 4);
+			}
+		}
+
+		// A candidate survives if it outranks every candidate closer than MinDistance. The outcome only depends on
+		// the cells around it, so neighbouring tiles agree on the points near their shared edge.
+		const double MinDistanceSquared = (double)MinDistance * MinDistance;
+		TArray<const FCandidate*> Accepted;
+		for (int32 Y = Reach; Y < GridSize.Y - Reach; Y++)
+		{
+			for (int32 X = Reach; X < GridSize.X - Reach; X++)
+			{
+				const FCandidate& Candidate = Candidates[Y * GridSize.X + X];
+				if (!Candidate.bValid
+					|| Candidate.Location.X < TileMin.X || Candidate.Location.X >= TileMax.X
+					|| Candidate.Location.Y < TileMin.Y || Candidate.Location.Y >= TileMax.Y)
+				{
+					continue;
+				}
+
+				bool bOutranked = false;
+				for (int32 NY = Y - Reach; NY <= Y + Reach && !bOutranked; NY++)
+				{
+					for (int32 NX = X - Reach; NX <= X + Reach; NX++)
+					{
+						const FCandidate& Other = Candidates[NY * GridSize.X + NX];
+						if (&Other == &Candidate || !Other.bValid || FVector2D::DistSquared(Other.Location, Candidate.Location) >= MinDistanceSquared)
+						{
+							continue;
+						}
+						// Ties fall back to the hash, then to the cell order, so exactly one of two candidates wins
+						if (Other.Priority > Candidate.Priority || (Other.Priority == Candidate.Priority && (Other.Hash > Candidate.Hash || (Other.Hash == Candidate.Hash && &Other < &Candidate))))
+						{
+							bOutranked = true;
+							break;
+						}
+					}
+				}
+
+				if (!bOutranked)
+				{
+					Accepted.Add(&Candidate);
+				}
+			}
+		}
+
+		if (Accepted.Num() == 0)
+		{
+			return;
+		}
+
+		// Altitude and slope from the height function itself, not the drawn mesh, so every LOD keeps the same points
+		const int32 NumSamples = Accepted.Num() * 5;
+		const double SlopeStep = TileParams.CellSize;
+		TArray<double> SampleX;
+		TArray<double> SampleY;
+		TArray<float> SampleHeights;
+		SampleX.SetNumUninitialized(NumSamples);
+		SampleY.SetNumUninitialized(NumSamples);
+		SampleHeights.SetNumUninitialized(NumSamples);
+		static const double SampleOffsets[5][2] = { { 0, 0 }, { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+		for (int32 Index = 0; Index < Accepted.Num(); Index++)
+		{
+			for (int32 Sample = 0; Sample < 5; Sample++)
+			{
+				SampleX[Index * 5 + Sample] = Accepted[Index]->Location.X + SampleOffsets[Sample][0] * SlopeStep;
+				SampleY[Index * 5 + Sample] = Accepted[Index]->Location.Y + SampleOffsets[Sample][1] * SlopeStep;
+			}
+		}
+		FTerrainHeightKernel::Get().GetHeights(TileParams.Noise, SampleX.GetData(), SampleY.GetData(), SampleHeights.GetData(), NumSamples);
+
+		for (int32 Index = 0; Index < Accepted.Num(); Index++)
+		{
+			const float* Heights = &SampleHeights[Index * 5];
+			const float Altitude = Params.Offset.Z + Heights[0];
+			if (Altitude < Type.Height.Min || Altitude > Type.Height.Max)
+			{
+				continue;
+			}
+
+			const FVector Normal = FVector(Heights[1] - Heights[2], Heights[3] - Heights[4], 2.0 * SlopeStep).GetSafeNormal();
+			const float SlopeDegrees = FTerrainQuery::GetSlopeDegrees(Normal);
+			if (SlopeDegrees < Type.GroundSlopeAngle.Min || SlopeDegrees > Type.GroundSlopeAngle.Max)
+			{
+				continue;
+			}
+
+			// Sits on the drawn mesh, whatever its LOD
+			float Height;
+			float MeshSlopeDegrees;
+			if (!Surface.Sample(Accepted[Index]->Location, Height, MeshSlopeDegrees))
+			{
+				continue;
+			}
+
+			// Scale, yaw and offset come from the point's own hash, not from the order points are visited in
+			FRandomStream Stream((int32)MixHash(Accepted[Index]->Hash ^ 5));
+			AddInstance(OutInstances, Params, TypeIndex, Accepted[Index]->Location, Height, Type.bRandomYaw, Stream);
+		}
+	}
+}
+
+FTerrainFoliageTypeParams FTerrainFoliageTypeParams::Make(const UFoliageType_InstancedStaticMesh* FoliageType)
+{
+	FTerrainFoliageTypeParams Result;
+	if (!FoliageType || !FoliageType->GetStaticMesh())
+	{
+		return Result;
+	}
+
+	Result.bValid = true;
+	Result.Height = FoliageType->Height;
+	Result.GroundSlopeAngle = FoliageType->GroundSlopeAngle;
+	Result.ZOffset = FoliageType->ZOffset;
+	Result.ProceduralScale = FoliageType->ProceduralScale;
+	Result.bRandomYaw = FoliageType->RandomYaw;
+	Result.InitialSeedDensity = FoliageType->InitialSeedDensity;
+	Result.NumSteps = FoliageType->NumSteps;
+	Result.SeedsPerStep = FoliageType->SeedsPerStep;
+	Result.AverageSpreadDistance = FoliageType->AverageSpreadDistance;
+	Result.SpreadVariance = FoliageType->SpreadVariance;
+	Result.CollisionRadius = FoliageType->CollisionRadius;
+	return Result;
+}
+
+void FTerrainFoliageInstances::Build(const FTerrainTileParams& TileParams, const FTerrainFoliageParams& Params, const FIntPoint& Tile, int32 LODLevel, TConstArrayView<FVector> Vertices, FTerrainFoliageInstances& OutInstances)
+{
+	OutInstances.Transforms.Reset();
+	OutInstances.Transforms.SetNum(Params.Types.Num());
+	OutInstances.NearTransforms.Reset();
+	OutInstances.NearTransforms.SetNum(Params.Types.Num());
+	OutInstances.NumInstances = 0;
+	OutInstances.Bounds = FBox(ForceInit);
+
+	const FIntPoint NumVertices = TileParams.GetLODVertexCount(LODLevel);
+	if (Vertices.Num() != NumVertices.X * NumVertices.Y || NumVertices.X < 2 || NumVertices.Y < 2)
+	{
+		return;
+	}
+
+	const FTileSurface Surface{ Vertices, TileParams.GetTileOrigin(Tile), TileParams.CellSize * LODLevel, NumVertices };
+	if (Params.bPoissonDisk)
+	{
+		for (int32 TypeIndex = 0; TypeIndex < Params.Types.Num(); TypeIndex++)
+		{
+			if (Params.Types[TypeIndex].bValid)
+			{
+				PlacePoissonDisk(TileParams, Params, Tile, TypeIndex, Surface, OutInstances);
+			}
+		}
+	}
+	else
+	{
+		PlaceClusters(Params, Tile, Vertices, Surface, OutInstances);
+	}
+}
+
@@ -0,0 +1,92 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "TerrainTile.h"
+
+class UFoliageType_InstancedStaticMesh;
+
+/** Placement settings of one foliage type, copied off the asset so jobs never read UObjects. */
+struct TG_API FTerrainFoliageTypeParams
+{
+	// Null or meshless foliage types keep their slot, so results line up with FoliageTypes
+	bool bValid = false;
+
+	FFloatInterval Height = FFloatInterval(0.f, 0.f);
+	FFloatInterval GroundSlopeAngle = FFloatInterval(0.f, 0.f);
+	FFloatInterval ZOffset = FFloatInterval(0.f, 0.f);
+	FFloatInterval ProceduralScale = FFloatInterval(1.f, 1.f);
+	bool bRandomYaw = false;
+
+	// Cluster random walk
+	float InitialSeedDensity = 0.f;
+	int32 NumSteps = 0;
+	int32 SeedsPerStep = 0;
+	float AverageSpreadDistance = 0.f;
+	float SpreadVariance = 0.f;
+
+	// Poisson-disk placement keeps instances of the type at least twice this apart
+	float CollisionRadius = 100.f;
+
+	// Fraction of the instances in Transforms rather than NearTransforms, the subset a tile in the middle ring keeps
+	float MiddleDensity = 1.f;
+
+	static FTerrainFoliageTypeParams Make(const UFoliageType_InstancedStaticMesh* FoliageType);
+};
+
+/** Everything foliage placement reads from the world generator, taken when a tile is queued. */
+struct TG_API FTerrainFoliageParams
+{
+	TArray<FTerrainFoliageTypeParams> Types;
+	int32 Seed = 0;
+
+	// World space Poisson-disk points per foliage type instead of clusters around the tile's vertices
+	bool bPoissonDisk = true;
+
+	// Single instances scattered next to vertices, on top of the clusters
+	float GrowthProbabilityPercentage = 20.f;
+	float InstanceOffset = 1000.f;
+	float InstanceOffsetVariation = 200.f;
+	FFloatInterval GroundSlopeAngle = FFloatInterval(0.f, 45.f);
+
+	// Added to every instance, foliage has always been placed at the actor's location plus the vertex
+	FVector Offset = FVector::ZeroVector;
+};
+
+/**
+ * Foliage instance transforms for one tile, one array per foliage type, placed one of two ways.
+ *
+ * Poisson-disk: the world is divided into cells per foliage type, each holding at most one candidate at a
+ * position hashed from the foliage seed, the cell and the type. Candidates are thinned to the type's density,
+ * and a candidate is kept only if it outranks, by another hash, every candidate closer than twice the type's
+ * collision radius. Height and slope limits are checked against the height function. Nothing depends on the
+ * tile's LOD, on other tiles or on the order tiles are built in, so a tile always gets the same trees and
+ * neighbouring tiles agree along their edges. Only the instance heights follow the drawn mesh.
+ *
+ * Clusters: seeds walk out from every vertex of the tile, with heights and slopes read off the generated
+ * vertices, drawing from a stream seeded by the foliage seed and the tile. Density follows the LOD.
+ *
+ * Every instance is split, by a draw of its own, between the set the middle ring thins down to and the set only
+ * the near ring shows, so a tile changes ring without being placed again.
+ *
+ * Instances always stand on the tile that owns them. Immutable once built, any thread may build one.
+ */
+struct TG_API FTerrainFoliageInstances
+{
+	// Shown in the near and middle rings
+	TArray<TArray<FTransform>> Transforms;
+
+	// Only shown in the near ring, the instances thinned out of the middle ring
+	TArray<TArray<FTransform>> NearTransforms;
+
+	int32 NumInstances = 0;
+
+	// Around the instance origins, not their meshes
+	FBox Bounds = FBox(ForceInit);
+
+	static void Build(const FTerrainTileParams& TileParams, const FTerrainFoliageParams& Params, const FIntPoint& Tile, int32 LODLevel, TConstArrayView<FVector> Vertices, FTerrainFoliageInstances& OutInstances);
+};
+
+typedef TSharedRef<const FTerrainFoliageInstances, ESPMode::ThreadSafe> FTerrainFoliageInstancesRef;
+typedef TSharedPtr<const FTerrainFoliageInstances, ESPMode::ThreadSafe> FTerrainFoliageInstancesPtr;
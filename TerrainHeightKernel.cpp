@@ -0,0 +1,489 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "TerrainHeightKernel.h"
+#include "Math/RandomStream.h"
+
+#if PLATFORM_CPU_X86_FAMILY
+	#define TG_TERRAIN_SIMD 1
+	#include <immintrin.h>
+	#if defined(_MSC_VER)
+		#include <intrin.h>
+	#else
+		#include <cpuid.h>
+	#endif
+	// MSVC lets any function use any intrinsic, clang and gcc need the ISA enabled per function
+	#if defined(_MSC_VER) && !defined(__clang__)
+		#define TG_TARGET_SSE41
+		#define TG_TARGET_AVX2
+		#define TG_TARGET_XSAVE
+	#else
+		#define TG_TARGET_SSE41 __attribute__((target("sse4.1")))
+		#define TG_TARGET_AVX2 __attribute__((target("avx2")))
+		#define TG_TARGET_XSAVE __attribute__((target("xsave")))
+	#endif
+#else
+	#define TG_TERRAIN_SIMD 0
+#endif
+
+namespace TerrainHeightKernel
+{
+	// One PerlinNoiseExtended call of CalculateProceduralHeight
+	struct FOctave
+	{
+		double Scale;
+		double Offset;
+		float Amplitude;
+	};
+
+	static constexpr int32 NumOctaves = 4;
+
+	// The constant FVector2D(.1f, .1f) PerlinNoiseExtended adds after PBalance
+	static const double Bias = .1f;
+
+	// Grad2 of FMath::PerlinNoise2D is Gx * X + Gy * Y for these gradients
+	static const float GradientX[8] = { 1.f, 1.f, 0.f, -1.f, -1.f, -1.f, 0.f, 1.f };
+	static const float GradientY[8] = { 0.f, 1.f, 1.f, 1.f, 0.f, -1.f, -1.f, -1.f };
+
+	static void MakeOctaves(const FTerrainNoiseParams& Params, FOctave (&Octaves)[NumOctaves])
+	{
+		// Same scales, offsets and amplitudes as AWorldGenerator::CalculateProceduralHeight
+		Octaves[0] = { 1 / Params.MountainScale, .1f, Params.MountainHeight };
+		Octaves[1] = { 1 / Params.LandScale, .2f, Params.LandHeight };
+		Octaves[2] = { .001f, .3f, 500 };
+		Octaves[3] = { .01f, .4f, 100 };
+	}
+
+	static float PerlinNoiseExtended(const FTerrainNoiseParams& Params, const FVector2D& Location, const float Scale, const float Amplitude, const FVector2D& Offset)
+	{
+		FVector2D ScaledLocation = (Location * Scale) + Offset + Params.PBalance + FVector2D(.1f, .1f);
+		return FMath::PerlinNoise2D(ScaledLocation) * Amplitude;
+	}
+
+#if TG_TERRAIN_SIMD
+
+	TG_TARGET_XSAVE static bool CpuSupportsAVX2()
+	{
+		int32 Info[4];
+#if defined(_MSC_VER)
+		__cpuid(Info, 0);
+		const int32 MaxLeaf = Info[0];
+		__cpuid(Info, 1);
+#else
+		unsigned int A, B, C, D;
+		const int32 MaxLeaf = (int32)__get_cpuid_max(0, nullptr);
+		__get_cpuid(1, &A, &B, &C, &D);
+		Info[0] = A; Info[1] = B; Info[2] = C; Info[3] = D;
+#endif
+		// AVX registers have to be enabled by the OS as well as present
+		const bool bOSXSave = (Info[2] & (1 << 27)) != 0;
+		const bool bAVX = (Info[2] & (1 << 28)) != 0;
+		if (MaxLeaf < 7 || !bOSXSave || !bAVX || (_xgetbv(0) & 6) != 6)
+		{
+			return false;
+		}
+#if defined(_MSC_VER)
+		__cpuidex(Info, 7, 0);
+#else
+		__get_cpuid_count(7, 0, &A, &B, &C, &D);
+		Info[1] = B;
+#endif
+		return (Info[1] & (1 << 5)) != 0;
+	}
+
+	static bool CpuSupportsSSE41()
+	{
+		int32 Info[4];
+#if defined(_MSC_VER)
+		__cpuid(Info, 1);
+#else
+		unsigned int A, B, C, D;
+		__get_cpuid(1, &A, &B, &C, &D);
+		Info[2] = C;
+#endif
+		return (Info[2] & (1 << 19)) != 0;
+	}
+
+	//**** SSE4.1, 4 samples per iteration ****//
+
+	TG_TARGET_SSE41 static inline __m128 ScaleAxisSSE41(const double* V, const FOctave& Octave, const double Balance)
+	{
+		// Same order of double operations as PerlinNoiseExtended, then the float cast PerlinNoise2D does
+		const __m128d Scale = _mm_set1_pd(Octave.Scale);
+		const __m128d Offset = _mm_set1_pd(Octave.Offset);
+		const __m128d PBalance = _mm_set1_pd(Balance);
+		const __m128d BiasV = _mm_set1_pd(Bias);
+
+		__m128d Lo = _mm_loadu_pd(V);
+		__m128d Hi = _mm_loadu_pd(V + 2);
+		Lo = _mm_add_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(Lo, Scale), Offset), PBalance), BiasV);
+		Hi = _mm_add_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(Hi, Scale), Offset), PBalance), BiasV);
+		return _mm_movelh_ps(_mm_cvtpd_ps(Lo), _mm_cvtpd_ps(Hi));
+	}
+
+	TG_TARGET_SSE41 static inline __m128 SmoothCurveSSE41(const __m128 X)
+	{
+		const __m128 X3 = _mm_mul_ps(_mm_mul_ps(X, X), X);
+		const __m128 Inner = _mm_add_ps(_mm_mul_ps(X, _mm_sub_ps(_mm_mul_ps(X, _mm_set1_ps(6.0f)), _mm_set1_ps(15.0f))), _mm_set1_ps(10.0f));
+		return _mm_mul_ps(X3, Inner);
+	}
+
+	TG_TARGET_SSE41 static inline __m128 GradSSE41(const uint8* Gradients, const int32* Index, const __m128 X, const __m128 Y)
+	{
+		// No gathers before AVX2, look the four corners up one at a time
+		const uint8 H0 = Gradients[Index[0]];
+		const uint8 H1 = Gradients[Index[1]];
+		const uint8 H2 = Gradients[Index[2]];
+		const uint8 H3 = Gradients[Index[3]];
+		const __m128 Gx = _mm_setr_ps(GradientX[H0], GradientX[H1], GradientX[H2], GradientX[H3]);
+		const __m128 Gy = _mm_setr_ps(GradientY[H0], GradientY[H1], GradientY[H2], GradientY[H3]);
+		return _mm_add_ps(_mm_mul_ps(Gx, X), _mm_mul_ps(Gy, Y));
+	}
+
+	TG_TARGET_SSE41 static inline __m128 LerpSSE41(const __m128 A, const __m128 B, const __m128 Alpha)
+	{
+		return _mm_add_ps(A, _mm_mul_ps(Alpha, _mm_sub_ps(B, A)));
+	}
+
+	TG_TARGET_SSE41 static inline __m128 PerlinNoise2DSSE41(const __m128 PX, const __m128 PY, const uint8* Gradients)
+	{
+		const __m128i Mask = _mm_set1_epi32(255);
+		const __m128i OneI = _mm_set1_epi32(1);
+		const __m128 One = _mm_set1_ps(1.0f);
+
+		const __m128 Xfl = _mm_floor_ps(PX);
+		const __m128 Yfl = _mm_floor_ps(PY);
+		const __m128i Xi = _mm_and_si128(_mm_cvttps_epi32(Xfl), Mask);
+		const __m128i Yi = _mm_and_si128(_mm_cvttps_epi32(Yfl), Mask);
+		const __m128i Row0 = _mm_slli_epi32(Xi, 8);
+		const __m128i Row1 = _mm_slli_epi32(_mm_and_si128(_mm_add_epi32(Xi, OneI), Mask), 8);
+		const __m128i Yi1 = _mm_and_si128(_mm_add_epi32(Yi, OneI), Mask);
+
+		alignas(16) int32 I00[4], I10[4], I01[4], I11[4];
+		_mm_store_si128((__m128i*)I00, _mm_or_si128(Row0, Yi));
+		_mm_store_si128((__m128i*)I10, _mm_or_si128(Row1, Yi));
+		_mm_store_si128((__m128i*)I01, _mm_or_si128(Row0, Yi1));
+		_mm_store_si128((__m128i*)I11, _mm_or_si128(Row1, Yi1));
+
+		const __m128 X = _mm_sub_ps(PX, Xfl);
+		const __m128 Y = _mm_sub_ps(PY, Yfl);
+		const __m128 Xm1 = _mm_sub_ps(X, One);
+		const __m128 Ym1 = _mm_sub_ps(Y, One);
+
+		const __m128 U = SmoothCurveSSE41(X);
+		const __m128 V = SmoothCurveSSE41(Y);
+
+		return LerpSSE41(
+			LerpSSE41(GradSSE41(Gradients, I00, X, Y), GradSSE41(Gradients, I10, Xm1, Y), U),
+			LerpSSE41(GradSSE41(Gradients, I01, X, Ym1), GradSSE41(Gradients, I11, Xm1, Ym1), U),
+			V);
+	}
+
+	TG_TARGET_SSE41 static int32 ProceduralHeightsSSE41(const FOctave (&Octaves)[NumOctaves], const FVector2D& PBalance, const uint8* Gradients, const double* X, const double* Y, float* OutHeights, int32 Count)
+	{
+		int32 Index = 0;
+		for (; Index + 4 <= Count; Index += 4)
+		{
+			__m128 Height = _mm_setzero_ps();
+			for (const FOctave& Octave : Octaves)
+			{
+				const __m128 PX = ScaleAxisSSE41(X + Index, Octave, PBalance.X);
+				const __m128 PY = ScaleAxisSSE41(Y + Index, Octave, PBalance.Y);
+				const __m128 Noise = PerlinNoise2DSSE41(PX, PY, Gradients);
+				Height = _mm_add_ps(Height, _mm_mul_ps(Noise, _mm_set1_ps(Octave.Amplitude)));
+			}
+			_mm_storeu_ps(OutHeights + Index, Height);
+		}
+		return Index;
+	}
+
+	//**** AVX2, 8 samples per iteration ****//
+
+	TG_TARGET_AVX2 static inline __m256 ScaleAxisAVX2(const double* V, const FOctave& Octave, const double Balance)
+	{
+		const __m256d Scale = _mm256_set1_pd(Octave.Scale);
+		const __m256d Offset = _mm256_set1_pd(Octave.Offset);
+		const __m256d PBalance = _mm256_set1_pd(Balance);
+		const __m256d BiasV = _mm256_set1_pd(Bias);
+
+		__m256d Lo = _mm256_loadu_pd(V);
+		__m256d Hi = _mm256_loadu_pd(V + 4);
+		Lo = _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(Lo, Scale), Offset), PBalance), BiasV);
+		Hi = _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(Hi, Scale), Offset), PBalance), BiasV);
+		return _mm256_set_m128(_mm256_cvtpd_ps(Hi), _mm256_cvtpd_ps(Lo));
+	}
+
+	TG_TARGET_AVX2 static inline __m256 SmoothCurveAVX2(const __m256 X)
+	{
+		const __m256 X3 = _mm256_mul_ps(_mm256_mul_ps(X, X), X);
+		const __m256 Inner = _mm256_add_ps(_mm256_mul_ps(X, _mm256_sub_ps(_mm256_mul_ps(X, _mm256_set1_ps(6.0f)), _mm256_set1_ps(15.0f))), _mm256_set1_ps(10.0f));
+		return _mm256_mul_ps(X3, Inner);
+	}
+
+	TG_TARGET_AVX2 static inline __m256 GradAVX2(const uint8* Gradients, const __m256i Index, const __m256 X, const __m256 Y)
+	{
+		// Gather 4 bytes at each byte offset and keep the low one
+		const __m256i Hash = _mm256_and_si256(_mm256_i32gather_epi32((const int*)Gradients, Index, 1), _mm256_set1_epi32(7));
+		const __m256 Gx = _mm256_permutevar8x32_ps(_mm256_loadu_ps(GradientX), Hash);
+		const __m256 Gy = _mm256_permutevar8x32_ps(_mm256_loadu_ps(GradientY), Hash);
+		return _mm256_add_ps(_mm256_mul_ps(Gx, X), _mm256_mul_ps(Gy, Y));
+	}
+
+	TG_TARGET_AVX2 static inline __m256 LerpAVX2(const __m256 A, const __m256 B, const __m256 Alpha)
+	{
+		return _mm256_add_ps(A, _mm256_mul_ps(Alpha, _mm256_sub_ps(B, A)));
+	}
+
+	TG_TARGET_AVX2 static inline __m256 PerlinNoise2DAVX2(const __m256 PX, const __m256 PY, const uint8* Gradients)
+	{
+		const __m256i Mask = _mm256_set1_epi32(255);
+		const __m256i OneI = _mm256_set1_epi32(1);
+		const __m256 One = _mm256_set1_ps(1.0f);
+
+		const __m256 Xfl = _mm256_floor_ps(PX);
+		const __m256 Yfl = _mm256_floor_ps(PY);
+		const __m256i Xi = _mm256_and_si256(_mm256_cvttps_epi32(Xfl), Mask);
+		const __m256i Yi = _mm256_and_si256(_mm256_cvttps_epi32(Yfl), Mask);
+		const __m256i Row0 = _mm256_slli_epi32(Xi, 8);
+		const __m256i Row1 = _mm256_slli_epi32(_mm256_and_si256(_mm256_add_epi32(Xi, OneI), Mask), 8);
+		const __m256i Yi1 = _mm256_and_si256(_mm256_add_epi32(Yi, OneI), Mask);
+
+		const __m256 X = _mm256_sub_ps(PX, Xfl);
+		const __m256 Y = _mm256_sub_ps(PY, Yfl);
+		const __m256 Xm1 = _mm256_sub_ps(X, One);
+		const __m256 Ym1 = _mm256_sub_ps(Y, One);
+
+		const __m256 U = SmoothCurveAVX2(X);
+		const __m256 V = SmoothCurveAVX2(Y);
+
+		return LerpAVX2(
+			LerpAVX2(GradAVX2(Gradients, _mm256_or_si256(Row0, Yi), X, Y), GradAVX2(Gradients, _mm256_or_si256(Row1, Yi), Xm1, Y), U),
+			LerpAVX2(GradAVX2(Gradients, _mm256_or_si256(Row0, Yi1), X, Ym1), GradAVX2(Gradients, _mm256_or_si256(Row1, Yi1), Xm1, Ym1), U),
+			V);
+	}
+
+	TG_TARGET_AVX2 static int32 ProceduralHeightsAVX2(const FOctave (&Octaves)[NumOctaves], const FVector2D& PBalance, const uint8* Gradients, const double* X, const double* Y, float* OutHeights, int32 Count)
+	{
+		int32 Index = 0;
+		for (; Index + 8 <= Count; Index += 8)
+		{
+			__m256 Height = _mm256_setzero_ps();
+			for (const FOctave& Octave : Octaves)
+			{
+				const __m256 PX = ScaleAxisAVX2(X + Index, Octave, PBalance.X);
+				const __m256 PY = ScaleAxisAVX2(Y + Index, Octave, PBalance.Y);
+				const __m256 Noise = PerlinNoise2DAVX2(PX, PY, Gradients);
+				Height = _mm256_add_ps(Height, _mm256_mul_ps(Noise, _mm256_set1_ps(Octave.Amplitude)));
+			}
+			_mm256_storeu_ps(OutHeights + Index, Height);
+		}
+		return Index;
+	}
+
+#endif // TG_TERRAIN_SIMD
+}
+
+using namespace TerrainHeightKernel;
+
+const FTerrainHeightKernel& FTerrainHeightKernel::Get()
+{
+	static const FTerrainHeightKernel Kernel;
+	return Kernel;
+}
+
+FTerrainHeightKernel::FTerrainHeightKernel()
+{
+	// Probe every lattice corner just off its axes. Close to a corner the noise is dominated by that
+	// corner's gradient, and the signs of the two probes identify which of the 8 gradients it uses.
+	static const uint8 IndexFromSigns[9] = { 5, 6, 7, 4, 0, 0, 3, 2, 1 };
+	const float Probe = .125f;
+	const float Threshold = Probe * .5f;
+
+	Gradients.SetNumZeroed(256 * 256 + 4);
+	for (int32 LatticeX = 0; LatticeX < 256; LatticeX++)
+	{
+		for (int32 LatticeY = 0; LatticeY < 256; LatticeY++)
+		{
+			const float AlongX = FMath::PerlinNoise2D(FVector2D(LatticeX + Probe, LatticeY));
+			const float AlongY = FMath::PerlinNoise2D(FVector2D(LatticeX, LatticeY + Probe));
+			const int32 SignX = AlongX > Threshold ? 1 : (AlongX < -Threshold ? -1 : 0);
+			const int32 SignY = AlongY > Threshold ? 1 : (AlongY < -Threshold ? -1 : 0);
+			Gradients[(LatticeX << 8) | LatticeY] = IndexFromSigns[(SignY + 1) * 3 + SignX + 1];
+		}
+	}
+
+#if TG_TERRAIN_SIMD
+	if (CpuSupportsAVX2())
+	{
+		Path = EPath::AVX2;
+	}
+	else if (CpuSupportsSSE41())
+	{
+		Path = EPath::SSE41;
+	}
+
+	if (Path != EPath::Scalar)
+	{
+		const float Error = MeasureError();
+		if (Error > Tolerance)
+		{
+			UE_LOG(LogTemp, Warning, TEXT("Terrain height kernel %s differs from FMath::PerlinNoise2D by %f, using the scalar path."), GetPathName(), Error);
+			Path = EPath::Scalar;
+		}
+	}
+#endif
+
+	UE_LOG(LogTemp, Log, TEXT("Terrain height kernel: %s"), GetPathName());
+}
+
+const TCHAR* FTerrainHeightKernel::GetPathName() const
+{
+	switch (Path)
+	{
+	case EPath::AVX2: return TEXT("AVX2");
+	case EPath::SSE41: return TEXT("SSE4.1");
+	default: return TEXT("Scalar");
+	}
+}
+
+float FTerrainHeightKernel::MeasureError() const
+{
+	// Layouts in the range GenerateTerrainLayout produces, sampled well past the play area
+	FRandomStream Stream(0x7E22A1);
+	const int32 NumSamples = 1024;
+
+	TArray<double> X, Y;
+	TArray<float> Heights;
+	X.SetNumUninitialized(NumSamples);
+	Y.SetNumUninitialized(NumSamples);
+	Heights.SetNumUninitialized(NumSamples);
+
+	float MaxError = 0.f;
+	for (int32 Layout = 0; Layout < 4; Layout++)
+	{
+		FTerrainNoiseParams Params;
+		Params.PBalance = FVector2D(Stream.FRandRange(0.f, 1000000.f), Stream.FRandRange(0.f, 1000000.f));
+		Params.MountainHeight *= Stream.FRandRange(.4f, 1.5f);
+		Params.LandHeight *= Stream.FRandRange(.4f, 1.5f);
+		Params.MountainScale *= Stream.FRandRange(.6f, 2.f);
+		Params.LandScale *= Stream.FRandRange(.8f, 2.f);
+
+		for (int32 Index = 0; Index < NumSamples; Index++)
+		{
+			X[Index] = Stream.FRandRange(-2000000.f, 2000000.f);
+			Y[Index] = Stream.FRandRange(-2000000.f, 2000000.f);
+		}
+
+		GetProceduralHeights(Params, X.GetData(), Y.GetData(), Heights.GetData(), NumSamples);
+
+		for (int32 Index = 0; Index < NumSamples; Index++)
+		{
+			const float Reference = GetProceduralHeight(Params, FVector2D(X[Index], Y[Index]));
+			MaxError = FMath::Max(MaxError, FMath::Abs(Heights[Index] - Reference));
+		}
+	}
+	return MaxError;
+}
+
+float FTerrainHeightKernel::GetProceduralHeight(const FTerrainNoiseParams& Params, const FVector2D& Location)
+{
+	return PerlinNoiseExtended(Params, Location, 1 / Params.MountainScale, Params.MountainHeight, FVector2D(.1f)) +
+		PerlinNoiseExtended(Params, Location, 1 / Params.LandScale, Params.LandHeight, FVector2D(.2f)) +
+		PerlinNoiseExtended(Params, Location, .001f, 500, FVector2D(.3f)) +
+		PerlinNoiseExtended(Params, Location, .01f, 100, FVector2D(.4f));
+}
+
+float FTerrainHeightKernel::GetHeight(const FTerrainNoiseParams& Params, const FVector2D& Location)
+{
+	float DistFromCenter = FVector2D::Distance(Location, FVector2D(0, 0));
+
+	if (DistFromCenter <= Params.FlatRadius)
+	{
+		return Params.FlatHeight; // Inside the central flat area
+	}
+
+	float ProceduralHeight = GetProceduralHeight(Params, Location);
+
+	if (DistFromCenter <= Params.FlatRadius + Params.TransitionWidth)
+	{
+		// Transition zone
+		float TransitionFactor = (DistFromCenter - Params.FlatRadius) / Params.TransitionWidth;
+		return FMath::Lerp(Params.FlatHeight, ProceduralHeight, TransitionFactor);
+	}
+
+	return ProceduralHeight; // Outside transition zone
+}
+
+void FTerrainHeightKernel::GetProceduralHeights(const FTerrainNoiseParams& Params, const double* X, const double* Y, float* OutHeights, int32 Count) const
+{
+	int32 Done = 0;
+
+#if TG_TERRAIN_SIMD
+	FOctave Octaves[NumOctaves];
+	MakeOctaves(Params, Octaves);
+
+	if (Path == EPath::AVX2)
+	{
+		Done = ProceduralHeightsAVX2(Octaves, Params.PBalance, Gradients.GetData(), X, Y, OutHeights, Count);
+	}
+	else if (Path == EPath::SSE41)
+	{
+		Done = ProceduralHeightsSSE41(Octaves, Params.PBalance, Gradients.GetData(), X, Y, OutHeights, Count);
+	}
+#endif
+
+	// Scalar path, and the tail the vector loops leave over
+	for (int32 Index = Done; Index < Count; Index++)
+	{
+		OutHeights[Index] = GetProceduralHeight(Params, FVector2D(X[Index], Y[Index]));
+	}
+}
+
+void FTerrainHeightKernel::GetHeights(const FTerrainNoiseParams& Params, const double* X, const double* Y, float* OutHeights, int32 Count) const
+{
+	GetProceduralHeights(Params, X, Y, OutHeights, Count);
+
+	// Blend in the flat spawn area the same way GetHeight does. Only samples near the origin are affected.
+	const double TransitionEndRadius = Params.FlatRadius + Params.TransitionWidth;
+	const double CheckRadiusSquared = FMath::Square(TransitionEndRadius + 1.0);
+	for (int32 Index = 0; Index < Count; Index++)
+	{
+		if (X[Index] * X[Index] + Y[Index] * Y[Index] > CheckRadiusSquared)
+		{
+			continue;
+		}
+
+		float DistFromCenter = FVector2D::Distance(FVector2D(X[Index], Y[Index]), FVector2D(0, 0));
+		if (DistFromCenter <= Params.FlatRadius)
+		{
+			OutHeights[Index] = Params.FlatHeight;
+		}
+		else if (DistFromCenter <= Params.FlatRadius + Params.TransitionWidth)
+		{
+			float TransitionFactor = (DistFromCenter - Params.FlatRadius) / Params.TransitionWidth;
+			OutHeights[Index] = FMath::Lerp(Params.FlatHeight, OutHeights[Index], TransitionFactor);
+		}
+	}
+}
+
+void FTerrainHeightKernel::GetHeightGrid(const FTerrainNoiseParams& Params, const FVector2D& Origin, float Step, int32 FirstX, int32 FirstY, int32 NumX, int32 NumY, float* OutHeights) const
+{
+	TArray<double, TInlineAllocator<64>> RowX, RowY;
+	RowX.SetNumUninitialized(NumX);
+	RowY.SetNumUninitialized(NumX);
+
+	for (int32 iX = 0; iX < NumX; iX++)
+	{
+		RowX[iX] = (FirstX + iX) * Step + Origin.X;
+	}
+
+	for (int32 iY = 0; iY < NumY; iY++)
+	{
+		const double CurrentY = (FirstY + iY) * Step + Origin.Y;
+		for (int32 iX = 0; iX < NumX; iX++)
+		{
+			RowY[iX] = CurrentY;
+		}
+		GetHeights(Params, RowX.GetData(), RowY.GetData(), OutHeights + iY * NumX, NumX);
+	}
+}
@@ -0,0 +1,81 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Copy of the terrain layout that the height function depends on.
+ * Taken by value so heights can be evaluated without touching the world generator actor.
+ */
+struct TG_API FTerrainNoiseParams
+{
+	FVector2D PBalance = FVector2D::ZeroVector;
+	float MountainHeight = 4000.f;
+	float LandHeight = 2000.f;
+	float MountainScale = 50000.f;
+	float LandScale = 60000.f;
+
+	float FlatRadius = 3000.0f;
+	float FlatHeight = 250.0f;
+	float TransitionWidth = 3000.0f;
+};
+
+/**
+ * Batched evaluator for the terrain height function.
+ *
+ * Produces the same values as AWorldGenerator::GetHeight, but works on whole rows or grids of
+ * samples (structure-of-arrays in, float heights out) and evaluates the four noise octaves with
+ * SSE4.1 or AVX2 kernels picked once at startup for the running CPU.
+ */
+class TG_API FTerrainHeightKernel
+{
+public:
+	enum class EPath : uint8
+	{
+		Scalar,
+		SSE41,
+		AVX2
+	};
+
+	/** Largest height difference, in world units, accepted between the vector kernels and the scalar path. */
+	static constexpr float Tolerance = 0.05f;
+
+	/** Returns the shared kernel, building the gradient table and picking a path on first use. */
+	static const FTerrainHeightKernel& Get();
+
+	EPath GetPath() const { return Path; }
+	const TCHAR* GetPathName() const;
+
+	/** Scalar reference, identical to AWorldGenerator::CalculateProceduralHeight. */
+	static float GetProceduralHeight(const FTerrainNoiseParams& Params, const FVector2D& Location);
+
+	/** Scalar reference, identical to AWorldGenerator::GetHeight. */
+	static float GetHeight(const FTerrainNoiseParams& Params, const FVector2D& Location);
+
+	/** Evaluates Count heights for the locations (X[i], Y[i]). */
+	void GetHeights(const FTerrainNoiseParams& Params, const double* X, const double* Y, float* OutHeights, int32 Count) const;
+
+	/**
+	 * Evaluates a NumX x NumY grid into OutHeights, row-major. Sample (i, j) sits at
+	 * Origin + ((FirstX + i) * Step, (FirstY + j) * Step), matching how GenerateTerrain lays out its vertices.
+	 */
+	void GetHeightGrid(const FTerrainNoiseParams& Params, const FVector2D& Origin, float Step, int32 FirstX, int32 FirstY, int32 NumX, int32 NumY, float* OutHeights) const;
+
+private:
+	FTerrainHeightKernel();
+
+	/** Checks the selected vector path against the scalar one, returns the largest difference seen. */
+	float MeasureError() const;
+
+	void GetProceduralHeights(const FTerrainNoiseParams& Params, const double* X, const double* Y, float* OutHeights, int32 Count) const;
+
+	/**
+	 * Gradient index (0-7) of every lattice corner, indexed by (X & 255) << 8 | (Y & 255).
+	 * Read back from FMath::PerlinNoise2D so the kernels follow the engine's permutation table.
+	 * Padded so 32 bit gathers at the last entry stay in bounds.
+	 */
+	TArray<uint8> Gradients;
+
+	EPath Path = EPath::Scalar;
+};
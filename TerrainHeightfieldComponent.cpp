@@ -0,0 +1,195 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "TerrainHeightfieldComponent.h"
+#include "AI/NavigationSystemBase.h"
+#include "AI/NavigationSystemHelpers.h"
+#include "Chaos/ParticleHandle.h"
+#include "Chaos/ShapeInstance.h"
+#include "Engine/Engine.h"
+#include "Engine/World.h"
+#include "PhysicalMaterials/PhysicalMaterial.h"
+#include "Physics/Experimental/PhysScene_Chaos.h"
+#include "Physics/PhysicsFiltering.h"
+#include "Physics/PhysicsInterfaceCore.h"
+#include "PhysicsProxy/SingleParticlePhysicsProxy.h"
+
+const FRotator UTerrainHeightfieldComponent::Rotation(0.f, 90.f, 0.f);
+
+UTerrainHeightfieldComponent::UTerrainHeightfieldComponent()
+{
+	SetCollisionProfileName(UCollisionProfile::BlockAll_ProfileName);
+	SetGenerateOverlapEvents(false);
+	bHiddenInGame = true;
+	CanCharacterStepUpOn = ECB_Yes;
+	bHasCustomNavigableGeometry = EHasCustomNavigableGeometry::EvenIfNotCollidable;
+}
+
+void UTerrainHeightfieldComponent::SetHeights(const FIntPoint& VertexCount, float InCellSize, TConstArrayView<FVector> Vertices, UPhysicalMaterial* InMaterial)
+{
+	// The body is static, so it is rebuilt rather than moved
+	DestroyPhysicsState();
+
+	FVector Origin = FVector::ZeroVector;
+	HeightField = BuildHeightField(VertexCount, InCellSize, Vertices, Origin);
+	Material = InMaterial;
+	SetRelativeLocationAndRotation(Origin, Rotation);
+
+	UpdateBounds();
+	RecreatePhysicsState();
+	FNavigationSystem::UpdateComponentData(*this);
+}
+
+void UTerrainHeightfieldComponent::ClearHeights()
+{
+	DestroyPhysicsState();
+	HeightField = nullptr;
+	LODLevel = INDEX_NONE;
+
+	UpdateBounds();
+	FNavigationSystem::UpdateComponentData(*this);
+}
+
+TRefCountPtr<Chaos::FHeightField> UTerrainHeightfieldComponent::BuildHeightField(const FIntPoint& VertexCount, float InCellSize, TConstArrayView<FVector> Vertices, FVector& OutOrigin)
+{
+	if (VertexCount.X < 2 || VertexCount.Y < 2 || Vertices.Num() != VertexCount.X * VertexCount.Y)
+	{
+		return nullptr;
+	}
+
+	float MinHeight = MAX_flt;
+	float MaxHeight = -MAX_flt;
+	for (const FVector& Vertex : Vertices)
+	{
+		MinHeight = FMath::Min(MinHeight, (float)Vertex.Z);
+		MaxHeight = FMath::Max(MaxHeight, (float)Vertex.Z);
+	}
+
+	// Full 16 bit range over the tile's own height span, as the tile cache stores it
+	const float HeightStep = FMath::Max((MaxHeight - MinHeight) / MAX_uint16, UE_KINDA_SMALL_NUMBER);
+
+	// Row r, column c holds tile vertex (VertexCount.X - 1 - r, c)
+	const int32 NumRows = VertexCount.X;
+	const int32 NumCols = VertexCount.Y;
+	TArray<uint16> Heights;
+	Heights.SetNumUninitialized(NumRows * NumCols);
+	for (int32 Row = 0; Row < NumRows; Row++)
+	{
+		for (int32 Col = 0; Col < NumCols; Col++)
+		{
+			const float Z = Vertices[Col * VertexCount.X + VertexCount.X - 1 - Row].Z;
+			Heights[Row * NumCols + Col] = (uint16)FMath::Clamp(FMath::RoundToInt((Z - MinHeight) / HeightStep), 0, (int32)MAX_uint16);
+		}
+	}
+
+	// One material for the whole tile
+	TArray<uint8> MaterialIndices;
+	MaterialIndices.SetNumZeroed((NumRows - 1) * (NumCols - 1));
+
+	const FVector& Corner = Vertices[VertexCount.X - 1];
+	OutOrigin = FVector(Corner.X, Corner.Y, MinHeight);
+
+	return TRefCountPtr<Chaos::FHeightField>(new Chaos::FHeightField(MoveTemp(Heights), MoveTemp(MaterialIndices), NumRows, NumCols, Chaos::FVec3(InCellSize, InCellSize, HeightStep)));
+}
+
+FBoxSphereBounds UTerrainHeightfieldComponent::CalcBounds(const FTransform& LocalToWorld) const
+{
+	if (!HeightField.IsValid())
+	{
+		return FBoxSphereBounds(LocalToWorld.GetLocation(), FVector::ZeroVector, 0.f);
+	}
+
+	const Chaos::FAABB3& LocalBounds = HeightField->BoundingBox();
+	return FBoxSphereBounds(FBox(LocalBounds.Min(), LocalBounds.Max())).TransformBy(LocalToWorld);
+}
+
+bool UTerrainHeightfieldComponent::ShouldCreatePhysicsState() const
+{
+	return HeightField.IsValid() && Super::ShouldCreatePhysicsState();
+}
+
+bool UTerrainHeightfieldComponent::DoCustomNavigableGeometryExport(FNavigableGeometryExport& GeomExport) const
+{
+	if (HeightField.IsValid())
+	{
+		GeomExport.ExportChaosHeightField(HeightField.GetReference(), GetComponentTransform());
+	}
+
+	// Nothing else to export, there is no body setup
+	return false;
+}
+
+void UTerrainHeightfieldComponent::OnCreatePhysicsState()
+{
+	// Skips UPrimitiveComponent, which would build the body from a body setup
+	USceneComponent::OnCreatePhysicsState();
+
+	UWorld* World = GetWorld();
+	FPhysScene_Chaos* PhysScene = World ? World->GetPhysicsScene() : nullptr;
+	if (!HeightField.IsValid() || !PhysScene)
+	{
+		return;
+	}
+
+	FActorCreationParams Params;
+	Params.InitialTM = GetComponentTransform();
+	Params.InitialTM.SetScale3D(FVector::OneVector);
+	Params.bQueryOnly = false;
+	Params.bStatic = true;
+	Params.Scene = PhysScene;
+
+	FPhysicsActorHandle PhysHandle;
+	FPhysicsInterface::CreateActor(Params, PhysHandle);
+	Chaos::FRigidBodyHandle_External& Body_External = PhysHandle->GetGameThreadAPI();
+
+	// The heightfield answers simple and complex queries alike
+	FCollisionFilterData QueryFilterData, SimFilterData;
+	CreateShapeFilterData(GetCollisionObjectType(), FMaskFilter(0), GetOwner() ? GetOwner()->GetUniqueID() : 0, GetCollisionResponseToChannels(),
+		GetUniqueID(), 0, QueryFilterData, SimFilterData, false, false, true);
+	QueryFilterData.Word3 |= EPDF_SimpleCollision | EPDF_ComplexCollision;
+	SimFilterData.Word3 |= EPDF_SimpleCollision | EPDF_ComplexCollision;
+
+	UPhysicalMaterial* ShapeMaterial = Material ? Material : GEngine->DefaultPhysMaterial;
+
+	Chaos::FImplicitObjectPtr Geometry(HeightField);
+	TUniquePtr<Chaos::FPerShapeData> Shape = Chaos::FShapeInstanceProxy::Make(0, Geometry);
+	Shape->SetQueryData(QueryFilterData);
+	Shape->SetSimData(SimFilterData);
+	Shape->SetMaterial(ShapeMaterial->GetPhysicsMaterial());
+
+	Body_External.SetGeometry(Geometry);
+	Shape->UpdateShapeBounds(Chaos::FRigidTransform3(Body_External.GetX(), Body_External.GetR()));
+
+	Chaos::FShapesArray Shapes;
+	Shapes.Emplace(MoveTemp(Shape));
+	Body_External.MergeShapesArray(MoveTemp(Shapes));
+
+	BodyInstance.PhysicsUserData = FPhysicsUserData(&BodyInstance);
+	BodyInstance.OwnerComponent = this;
+	BodyInstance.ActorHandle = PhysHandle;
+	Body_External.SetUserData(&BodyInstance.PhysicsUserData);
+
+	TArray<FPhysicsActorHandle> Actors;
+	Actors.Add(PhysHandle);
+	FPhysicsCommand::ExecuteWrite(PhysScene, [&]()
+		{
+			PhysScene->AddActorsToScene_AssumesLocked(Actors, true);
+		}
+	);
+	PhysScene->AddToComponentMaps(this, PhysHandle);
+}
+
+void UTerrainHeightfieldComponent::OnDestroyPhysicsState()
+{
+	Super::OnDestroyPhysicsState();
+
+	UWorld* World = GetWorld();
+	if (FPhysScene_Chaos* PhysScene = World ? World->GetPhysicsScene() : nullptr)
+	{
+		FPhysicsActorHandle& ActorHandle = BodyInstance.GetPhysicsActorHandle();
+		if (FPhysicsInterface::IsValid(ActorHandle))
+		{
+			PhysScene->RemoveFromComponentMaps(ActorHandle);
+		}
+	}
+}
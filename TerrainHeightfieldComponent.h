@@ -0,0 +1,64 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Components/PrimitiveComponent.h"
+#include "Chaos/HeightField.h"
+#include "TerrainHeightfieldComponent.generated.h"
+
+class UPhysicalMaterial;
+
+/**
+ * Collision and navigation geometry for one terrain tile as a physics heightfield, built straight from the
+ * tile's height samples instead of cooking its triangles. Navigation is exported with or without collision
+ * enabled, so a tile can be its own nav element while its mesh section does the colliding. Never rendered.
+ *
+ * Tile grids split each quad along the (x + 1, y) - (x, y + 1) diagonal and heightfields along the other one,
+ * so the samples are stored a quarter turn round: heightfield columns run along +Y, rows along -X. The
+ * surface then has the same triangles as the drawn tile.
+ */
+UCLASS()
+class TG_API UTerrainHeightfieldComponent : public UPrimitiveComponent
+{
+	GENERATED_BODY()
+
+public:
+	UTerrainHeightfieldComponent();
+
+	// LOD of the tile the heightfield was last built from, INDEX_NONE while empty
+	int32 LODLevel = INDEX_NONE;
+
+	// Rebuilds the heightfield from tile vertices laid out as GenerateTerrainTile lays them out, in the parent's space
+	void SetHeights(const FIntPoint& VertexCount, float InCellSize, TConstArrayView<FVector> Vertices, UPhysicalMaterial* InMaterial);
+
+	// Drops the heightfield and its physics body
+	void ClearHeights();
+
+	const Chaos::FHeightField* GetHeightField() const { return HeightField.GetReference(); }
+
+	/**
+	 * Heightfield for tile vertices, quantised to 16 bits over the tile's height span. OutOrigin is where
+	 * the heightfield's first sample goes, rotated by Rotation. Null if the vertex count does not match.
+	 */
+	static TRefCountPtr<Chaos::FHeightField> BuildHeightField(const FIntPoint& VertexCount, float InCellSize, TConstArrayView<FVector> Vertices, FVector& OutOrigin);
+
+	static const FRotator Rotation;
+
+	//~ Begin UPrimitiveComponent Interface
+	virtual FBoxSphereBounds CalcBounds(const FTransform& LocalToWorld) const override;
+	virtual bool ShouldCreatePhysicsState() const override;
+	virtual bool DoCustomNavigableGeometryExport(FNavigableGeometryExport& GeomExport) const override;
+	//~ End UPrimitiveComponent Interface
+
+protected:
+	virtual void OnCreatePhysicsState() override;
+	virtual void OnDestroyPhysicsState() override;
+
+private:
+	TRefCountPtr<Chaos::FHeightField> HeightField;
+
+	// Terrain material's physical material, so hits report the same surface as the drawn mesh
+	UPROPERTY(Transient)
+	UPhysicalMaterial* Material = nullptr;
+};
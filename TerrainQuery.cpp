@@ -0,0 +1,138 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "TerrainQuery.h"
+
+FTerrainQuery::FTerrainQuery(const FTerrainTileParams& InParams, TMap<FIntPoint, int32> InTileLODs)
+	: Params(InParams)
+	, TileSize(FVector2D(InParams.XVertexCount - 1, InParams.YVertexCount - 1) * InParams.CellSize)
+	, TileLODs(MoveTemp(InTileLODs))
+{
+}
+
+FIntPoint FTerrainQuery::GetTile(const FVector2D& Location) const
+{
+	return FIntPoint(FMath::FloorToInt(Location.X / TileSize.X), FMath::FloorToInt(Location.Y / TileSize.Y));
+}
+
+int32 FTerrainQuery::GetLODLevel(const FIntPoint& Tile) const
+{
+	const int32* LODLevel = TileLODs.Find(Tile);
+	return LODLevel ? FMath::Max(1, *LODLevel) : 1;
+}
+
+float FTerrainQuery::GetSlopeDegrees(const FVector& Normal)
+{
+	return FMath::RadiansToDegrees(FMath::Acos(FMath::Clamp(Normal.Z, -1.0, 1.0)));
+}
+
+void FTerrainQuery::Sample(const double* X, const double* Y, int32 Count, float* OutHeights, FVector3f* OutNormals) const
+{
+	for (int32 First = 0; First < Count; First += BatchSize)
+	{
+		const int32 Num = FMath::Min(BatchSize, Count - First);
+		SampleBatch(X + First, Y + First, Num, OutHeights + First, OutNormals ? OutNormals + First : nullptr);
+	}
+}
+
+void FTerrainQuery::Sample(TConstArrayView<FVector2D> Locations, TArray<FTerrainSurfaceSample>& OutSamples) const
+{
+	const int32 Count = Locations.Num();
+	TArray<double> X;
+	TArray<double> Y;
+	X.SetNumUninitialized(Count);
+	Y.SetNumUninitialized(Count);
+	for (int32 Index = 0; Index < Count; Index++)
+	{
+		X[Index] = Locations[Index].X;
+		Y[Index] = Locations[Index].Y;
+	}
+
+	TArray<float> Heights;
+	TArray<FVector3f> Normals;
+	Heights.SetNumUninitialized(Count);
+	Normals.SetNumUninitialized(Count);
+	Sample(X.GetData(), Y.GetData(), Count, Heights.GetData(), Normals.GetData());
+
+	OutSamples.SetNum(Count);
+	for (int32 Index = 0; Index < Count; Index++)
+	{
+		FTerrainSurfaceSample& Out = OutSamples[Index];
+		Out.Height = Heights[Index];
+		Out.Normal = FVector(Normals[Index]);
+		Out.SlopeDegrees = GetSlopeDegrees(Out.Normal);
+	}
+}
+
+FTerrainSurfaceSample FTerrainQuery::Sample(const FVector2D& Location) const
+{
+	TArray<FTerrainSurfaceSample> Samples;
+	Sample(MakeArrayView(&Location, 1), Samples);
+	return Samples[0];
+}
+
+void FTerrainQuery::SampleBatch(const double* X, const double* Y, int32 Count, float* OutHeights, FVector3f* OutNormals) const
+{
+	// Corners (0, 0), (1, 0), (0, 1), (1, 1) of each point's cell, and where the point sits in it
+	double CornerX[BatchSize * 4];
+	double CornerY[BatchSize * 4];
+	float CornerHeights[BatchSize * 4];
+	float FracX[BatchSize];
+	float FracY[BatchSize];
+	float Step[BatchSize];
+
+	for (int32 Index = 0; Index < Count; Index++)
+	{
+		const FVector2D Location(X[Index], Y[Index]);
+		const FIntPoint Tile = GetTile(Location);
+		const int32 LODLevel = GetLODLevel(Tile);
+		const FIntPoint LODVertexCount = Params.GetLODVertexCount(LODLevel);
+		const FVector2D Origin = Params.GetTileOrigin(Tile);
+		Step[Index] = Params.CellSize * LODLevel;
+
+		const FVector2D Local = (Location - Origin) / Step[Index];
+		const int32 CellX = FMath::Clamp(FMath::FloorToInt(Local.X), 0, LODVertexCount.X - 2);
+		const int32 CellY = FMath::Clamp(FMath::FloorToInt(Local.Y), 0, LODVertexCount.Y - 2);
+		FracX[Index] = FMath::Clamp((float)(Local.X - CellX), 0.f, 1.f);
+		FracY[Index] = FMath::Clamp((float)(Local.Y - CellY), 0.f, 1.f);
+
+		for (int32 Corner = 0; Corner < 4; Corner++)
+		{
+			CornerX[Index * 4 + Corner] = Origin.X + (CellX + (Corner & 1)) * (double)Step[Index];
+			CornerY[Index * 4 + Corner] = Origin.Y + (CellY + (Corner >> 1)) * (double)Step[Index];
+		}
+	}
+
+	FTerrainHeightKernel::Get().GetHeights(Params.Noise, CornerX, CornerY, CornerHeights, Count * 4);
+
+	// Quads are split along the (1, 0) - (0, 1) diagonal, as FTerrainIndexBuffers builds them
+	for (int32 Index = 0; Index < Count; Index++)
+	{
+		const float H00 = CornerHeights[Index * 4];
+		const float H10 = CornerHeights[Index * 4 + 1];
+		const float H01 = CornerHeights[Index * 4 + 2];
+		const float H11 = CornerHeights[Index * 4 + 3];
+		const float FX = FracX[Index];
+		const float FY = FracY[Index];
+
+		float SlopeX;
+		float SlopeY;
+		if (FX + FY <= 1.f)
+		{
+			OutHeights[Index] = H00 + FX * (H10 - H00) + FY * (H01 - H00);
+			SlopeX = H10 - H00;
+			SlopeY = H01 - H00;
+		}
+		else
+		{
+			OutHeights[Index] = H11 + (1.f - FX) * (H01 - H11) + (1.f - FY) * (H10 - H11);
+			SlopeX = H11 - H01;
+			SlopeY = H11 - H10;
+		}
+
+		if (OutNormals)
+		{
+			OutNormals[Index] = FVector3f(-SlopeX, -SlopeY, Step[Index]).GetSafeNormal();
+		}
+	}
+}
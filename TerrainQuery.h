@@ -0,0 +1,66 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "TerrainTile.h"
+#include "TerrainQuery.generated.h"
+
+USTRUCT(BlueprintType)
+struct FTerrainSurfaceSample
+{
+	GENERATED_BODY()
+
+	UPROPERTY(BlueprintReadOnly, Category = "Land")
+	float Height = 0.f;
+
+	UPROPERTY(BlueprintReadOnly, Category = "Land")
+	FVector Normal = FVector::UpVector;
+
+	// Angle between the surface and the horizontal, as IsLocationSuitable measures it
+	UPROPERTY(BlueprintReadOnly, Category = "Land")
+	float SlopeDegrees = 0.f;
+};
+
+/**
+ * Height, normal and slope of the terrain at batches of XY points, straight from the height function instead
+ * of traced against physics. Points are sampled the way the drawn mesh shows them: the corners of the LOD grid
+ * cell around each point are evaluated with FTerrainHeightKernel, four per point, and interpolated over the
+ * triangle the point falls in, whose face normal is returned. Tiles missing from the LOD snapshot are sampled
+ * at LOD 1.
+ *
+ * Holds copies only, so a query taken on the game thread can be used from any thread.
+ */
+class TG_API FTerrainQuery
+{
+public:
+	FTerrainQuery() = default;
+	FTerrainQuery(const FTerrainTileParams& InParams, TMap<FIntPoint, int32> InTileLODs);
+
+	// Structure of arrays in and out. OutNormals may be null.
+	void Sample(const double* X, const double* Y, int32 Count, float* OutHeights, FVector3f* OutNormals) const;
+
+	void Sample(TConstArrayView<FVector2D> Locations, TArray<FTerrainSurfaceSample>& OutSamples) const;
+
+	FTerrainSurfaceSample Sample(const FVector2D& Location) const;
+
+	FIntPoint GetTile(const FVector2D& Location) const;
+	int32 GetLODLevel(const FIntPoint& Tile) const;
+
+	const FTerrainTileParams& GetParams() const { return Params; }
+
+	static float GetSlopeDegrees(const FVector& Normal);
+
+private:
+	// Points handled per kernel call, bounds the scratch buffers
+	static constexpr int32 BatchSize = 256;
+
+	void SampleBatch(const double* X, const double* Y, int32 Count, float* OutHeights, FVector3f* OutNormals) const;
+
+	FTerrainTileParams Params;
+	FVector2D TileSize = FVector2D(1.f, 1.f);
+	TMap<FIntPoint, int32> TileLODs;
+};
+
+typedef TSharedRef<const FTerrainQuery, ESPMode::ThreadSafe> FTerrainQueryRef;
+typedef TSharedPtr<const FTerrainQuery, ESPMode::ThreadSafe> FTerrainQueryPtr;
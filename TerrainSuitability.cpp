@@ -0,0 +1,53 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "TerrainSuitability.h"
+
+void FTerrainSuitabilityIndex::Build(const FTerrainTileParams& TileParams, const FTerrainSuitabilityParams& InParams, const FIntPoint& InTile, FTerrainSuitabilityIndex& OutIndex)
+{
+	OutIndex.Tile = InTile;
+	OutIndex.ParamsHash = TileParams.GetHash();
+	OutIndex.Params = InParams;
+	OutIndex.Origin = TileParams.GetTileOrigin(InTile);
+	OutIndex.CellSize = TileParams.CellSize;
+	OutIndex.NumCells = FIntPoint(TileParams.XVertexCount - 1, TileParams.YVertexCount - 1);
+	OutIndex.NumSuitable = 0;
+
+	const int32 NumX = TileParams.XVertexCount;
+	const int32 NumY = TileParams.YVertexCount;
+	TArray<float> Heights;
+	Heights.SetNumUninitialized(NumX * NumY);
+	FTerrainHeightKernel::Get().GetHeightGrid(TileParams.Noise, OutIndex.Origin, TileParams.CellSize, 0, 0, NumX, NumY, Heights.GetData());
+
+	// Compared as squared height change per cell, no trigonometry per triangle
+	const float MaxRise = FMath::Tan(FMath::DegreesToRadians(FMath::Clamp(InParams.MaxSlopeDegrees, 0.f, 89.9f))) * TileParams.CellSize;
+	const float MaxRiseSquared = MaxRise * MaxRise;
+
+	OutIndex.Cells.Init(false, OutIndex.NumCells.X * OutIndex.NumCells.Y);
+	for (int32 CellY = 0; CellY < OutIndex.NumCells.Y; CellY++)
+	{
+		for (int32 CellX = 0; CellX < OutIndex.NumCells.X; CellX++)
+		{
+			const float H00 = Heights[CellY * NumX + CellX];
+			const float H10 = Heights[CellY * NumX + CellX + 1];
+			const float H01 = Heights[(CellY + 1) * NumX + CellX];
+			const float H11 = Heights[(CellY + 1) * NumX + CellX + 1];
+
+			if (FMath::Min(FMath::Min(H00, H10), FMath::Min(H01, H11)) < InParams.MinHeight)
+			{
+				continue;
+			}
+
+			// Both triangles of the quad, split along the (1, 0) - (0, 1) diagonal as the mesh is
+			const float RiseA = FMath::Square(H10 - H00) + FMath::Square(H01 - H00);
+			const float RiseB = FMath::Square(H11 - H01) + FMath::Square(H11 - H10);
+			if (RiseA > MaxRiseSquared || RiseB > MaxRiseSquared)
+			{
+				continue;
+			}
+
+			OutIndex.Cells[CellY * OutIndex.NumCells.X + CellX] = true;
+			OutIndex.NumSuitable++;
+		}
+	}
+}
@@ -0,0 +1,73 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "TerrainTile.h"
+
+/** Limits a spawn or goal location has to meet, everything except the surface type, which is the same over the whole terrain. */
+struct TG_API FTerrainSuitabilityParams
+{
+	// Highest of the sea level and the minimum spawn height
+	float MinHeight = 0.f;
+	float MaxSlopeDegrees = 45.f;
+
+	bool operator==(const FTerrainSuitabilityParams& Other) const
+	{
+		return MinHeight == Other.MinHeight && MaxSlopeDegrees == Other.MaxSlopeDegrees;
+	}
+};
+
+/**
+ * Cells of one tile where players, NPCs and goals can be placed, one bit per cell. A cell is set when all
+ * four corners are at or above MinHeight and both its triangles are within MaxSlopeDegrees, so every point
+ * inside it is suitable. Always built at LOD 1 cells from the height function, whatever LOD the tile is
+ * drawn at, so placements do not depend on which tiles happen to be loaded.
+ *
+ * Immutable once built, safe to share between threads.
+ */
+struct TG_API FTerrainSuitabilityIndex
+{
+	FIntPoint Tile = FIntPoint::ZeroValue;
+	uint32 ParamsHash = 0;
+	FTerrainSuitabilityParams Params;
+
+	FVector2D Origin = FVector2D::ZeroVector;
+	float CellSize = 1.f;
+	FIntPoint NumCells = FIntPoint::ZeroValue;
+	TBitArray<> Cells;
+	int32 NumSuitable = 0;
+
+	static void Build(const FTerrainTileParams& TileParams, const FTerrainSuitabilityParams& InParams, const FIntPoint& InTile, FTerrainSuitabilityIndex& OutIndex);
+
+	bool IsSuitable(int32 CellX, int32 CellY) const { return Cells[CellY * NumCells.X + CellX]; }
+
+	/**
+	 * Calls Visit(Location, Error) for every suitable cell, with the point of the cell closest to being Radius
+	 * away from Center and how far from Radius that point is.
+	 */
+	template <typename VisitorType>
+	void ForEachNearRadius(const FVector2D& Center, float Radius, VisitorType&& Visit) const
+	{
+		// Points stay just inside the cell so rounding cannot push them into a neighbour
+		const float Inset = CellSize * 0.01f;
+		for (TConstSetBitIterator<> It(Cells); It; ++It)
+		{
+			const int32 CellX = It.GetIndex() % NumCells.X;
+			const int32 CellY = It.GetIndex() / NumCells.X;
+			const FVector2D Min = Origin + FVector2D(CellX, CellY) * CellSize + FVector2D(Inset, Inset);
+			const FVector2D Max = Min + FVector2D(CellSize - 2.f * Inset, CellSize - 2.f * Inset);
+
+			// Point on the circle nearest the cell centre, pulled into the cell
+			const FVector2D Centre = (Min + Max) * 0.5f;
+			const FVector2D Direction = (Centre - Center).GetSafeNormal();
+			const FVector2D OnCircle = Center + Direction * Radius;
+			const FVector2D Location(FMath::Clamp(OnCircle.X, Min.X, Max.X), FMath::Clamp(OnCircle.Y, Min.Y, Max.Y));
+
+			Visit(Location, FMath::Abs((float)FVector2D::Distance(Location, Center) - Radius));
+		}
+	}
+};
+
+typedef TSharedRef<const FTerrainSuitabilityIndex, ESPMode::ThreadSafe> FTerrainSuitabilityIndexRef;
+typedef TSharedPtr<const FTerrainSuitabilityIndex, ESPMode::ThreadSafe> FTerrainSuitabilityIndexPtr;
@@ -0,0 +1,102 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "TerrainTile.h"
+#include "Misc/ScopeLock.h"
+
+FIntPoint FTerrainTileParams::GetLODVertexCount(int32 LODLevel) const
+{
+	const int32 LODFactor = FMath::Max(1, LODLevel);
+
+	int32 LODXVertexCount = XVertexCount / LODFactor;
+	int32 LODYVertexCount = YVertexCount / LODFactor;
+	float LODCellSize = CellSize * LODFactor;
+
+	// Extra vertices so lower LODs still cover the full tile
+	float XGap = (XVertexCount * CellSize - LODXVertexCount * LODCellSize) / LODCellSize;
+	float YGap = (YVertexCount * CellSize - LODYVertexCount * LODCellSize) / LODCellSize;
+
+	LODXVertexCount += FMath::CeilToInt(XGap) + 1;
+	LODYVertexCount += FMath::CeilToInt(YGap) + 1;
+
+	return FIntPoint(LODXVertexCount, LODYVertexCount);
+}
+
+FVector2D FTerrainTileParams::GetTileOrigin(const FIntPoint& Tile) const
+{
+	return FVector2D(Tile.X * (XVertexCount - 1), Tile.Y * (YVertexCount - 1)) * CellSize;
+}
+
+FVector2D FTerrainTileParams::GetVertexUV(const FIntPoint& Tile, int32 LODLevel, int32 iVX, int32 iVY) const
+{
+	const FIntPoint LODVertexCount = GetLODVertexCount(LODLevel);
+	const float LODCellSize = CellSize * FMath::Max(1, LODLevel);
+
+	FVector2D UV;
+	UV.X = (iVX + (Tile.X * (LODVertexCount.X - 1))) * LODCellSize / 100;
+	UV.Y = (iVY + (Tile.Y * (LODVertexCount.Y - 1))) * LODCellSize / 100;
+	return UV;
+}
+
+uint32 FTerrainTileParams::GetHash() const
+{
+	// Bump when the mesh layout changes so stale cached tiles stop matching
+	const uint32 LayoutVersion = 1;
+
+	uint32 Hash = FCrc::MemCrc32(&LayoutVersion, sizeof(LayoutVersion));
+	const double Balance[2] = { Noise.PBalance.X, Noise.PBalance.Y };
+	const float Values[] = { Noise.MountainHeight, Noise.LandHeight, Noise.MountainScale, Noise.LandScale,
+		Noise.FlatRadius, Noise.FlatHeight, Noise.TransitionWidth, CellSize };
+	const int32 Counts[] = { XVertexCount, YVertexCount };
+
+	Hash = FCrc::MemCrc32(Balance, sizeof(Balance), Hash);
+	Hash = FCrc::MemCrc32(Values, sizeof(Values), Hash);
+	Hash = FCrc::MemCrc32(Counts, sizeof(Counts), Hash);
+	return Hash;
+}
+
+FTerrainIndexBufferRef FTerrainIndexBuffers::Get(const FIntPoint& VertexCount)
+{
+	static FCriticalSection BuffersLock;
+	static TMap<FIntPoint, FTerrainIndexBufferRef> Buffers;
+
+	FScopeLock Lock(&BuffersLock);
+	if (const FTerrainIndexBufferRef* Existing = Buffers.Find(VertexCount))
+	{
+		return *Existing;
+	}
+
+	FTerrainIndexBufferRef Triangles = MakeShared<TArray<int32>, ESPMode::ThreadSafe>(Build(VertexCount));
+	Buffers.Add(VertexCount, Triangles);
+	return Triangles;
+}
+
+TArray<int32> FTerrainIndexBuffers::Build(const FIntPoint& VertexCount)
+{
+	const int32 NumX = VertexCount.X;
+	const int32 NumY = VertexCount.Y;
+
+	TArray<int32> Triangles;
+	Triangles.Reserve(FMath::Max(0, NumX - 1) * FMath::Max(0, NumY - 1) * 6);
+
+	// Same quads and winding as before, ordered in vertical strips for post-transform cache reuse
+	for (int32 StripStart = 0; StripStart < NumX - 1; StripStart += CacheStripWidth)
+	{
+		const int32 StripEnd = FMath::Min(StripStart + CacheStripWidth, NumX - 1);
+		for (int32 iTY = 0; iTY < NumY - 1; iTY++)
+		{
+			for (int32 iTX = StripStart; iTX < StripEnd; iTX++)
+			{
+				Triangles.Add(iTX + iTY * NumX);
+				Triangles.Add(iTX + iTY * NumX + NumX);
+				Triangles.Add(iTX + iTY * NumX + 1);
+
+				Triangles.Add(iTX + iTY * NumX + NumX);
+				Triangles.Add(iTX + iTY * NumX + NumX + 1);
+				Triangles.Add(iTX + iTY * NumX + 1);
+			}
+		}
+	}
+
+	return Triangles;
+}
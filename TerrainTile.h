@@ -0,0 +1,78 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "ProceduralMeshComponent.h"
+#include "TerrainHeightKernel.h"
+
+/**
+ * Everything tile generation reads from the world generator. A copy is taken when a tile is
+ * queued, so jobs never look at the actor while they run.
+ */
+struct TG_API FTerrainTileParams
+{
+	FTerrainNoiseParams Noise;
+	int32 XVertexCount = 20;
+	int32 YVertexCount = 20;
+	float CellSize = 2000;
+
+	// Vertices per side of a tile at LODLevel, as GenerateTerrainTile lays them out
+	FIntPoint GetLODVertexCount(int32 LODLevel) const;
+
+	// Location of the first vertex of a tile
+	FVector2D GetTileOrigin(const FIntPoint& Tile) const;
+
+	// UV of vertex (iVX, iVY) of a tile, continuous across neighbouring tiles of the same LOD
+	FVector2D GetVertexUV(const FIntPoint& Tile, int32 LODLevel, int32 iVX, int32 iVY) const;
+
+	// Stable hash of every value that affects the generated mesh, used to key cached tiles
+	uint32 GetHash() const;
+};
+
+typedef TSharedRef<const TArray<int32>, ESPMode::ThreadSafe> FTerrainIndexBufferRef;
+
+/**
+ * Triangle lists for tile grids. A tile's triangles only depend on its vertex counts, so each
+ * grid size is built once, on first use, and shared by every tile of that size.
+ */
+struct TG_API FTerrainIndexBuffers
+{
+	// Shared triangle list for a NumX x NumY vertex grid. Safe to call from any thread.
+	static FTerrainIndexBufferRef Get(const FIntPoint& VertexCount);
+
+private:
+	// Quads per strip. Walking the grid in strips this wide keeps the previous row's
+	// vertices in a ~32 entry post-transform cache when the next row is drawn.
+	static constexpr int32 CacheStripWidth = 12;
+
+	static TArray<int32> Build(const FIntPoint& VertexCount);
+};
+
+struct FTerrainSuitabilityIndex;
+struct FTerrainFoliageInstances;
+
+/** Mesh buffers for one generated tile. Each generation job owns its own. */
+struct TG_API FTerrainTileData
+{
+	FIntPoint Tile = FIntPoint::ZeroValue;
+	int32 LODLevel = 1;
+
+	// FTerrainTileParams::GetHash of the parameters the tile was built from
+	uint32 ParamsHash = 0;
+
+	TArray<FVector> Vertices;
+	TArray<FVector2D> UVs;
+	TSharedPtr<const TArray<int32>, ESPMode::ThreadSafe> Triangles;
+	TArray<FVector> Normals;
+	TArray<FProcMeshTangent> Tangents;
+
+	// Spawn and goal cells, built by generation jobs. Null for tiles read back from the cache or the tile store.
+	TSharedPtr<const FTerrainSuitabilityIndex, ESPMode::ThreadSafe> Suitability;
+
+	// Foliage transforms per foliage type, placed by generation jobs or a foliage job before the tile is committed
+	TSharedPtr<const FTerrainFoliageInstances, ESPMode::ThreadSafe> Foliage;
+};
+
+typedef TSharedRef<FTerrainTileData, ESPMode::ThreadSafe> FTerrainTileDataRef;
+typedef TSharedPtr<FTerrainTileData, ESPMode::ThreadSafe> FTerrainTileDataPtr;
@@ -0,0 +1,223 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "TerrainTileCache.h"
+
+//********************//
+// Compressed tiles //
+//********************//
+
+void FCompressedTerrainTile::Compress(const FTerrainTileData& Source, FCompressedTerrainTile& OutTile)
+{
+	OutTile.Tile = Source.Tile;
+	OutTile.LODLevel = Source.LODLevel;
+
+	float MaxHeight = -MAX_flt;
+	OutTile.MinHeight = MAX_flt;
+	for (const FVector& Vertex : Source.Vertices)
+	{
+		OutTile.MinHeight = FMath::Min(OutTile.MinHeight, (float)Vertex.Z);
+		MaxHeight = FMath::Max(MaxHeight, (float)Vertex.Z);
+	}
+	if (Source.Vertices.Num() == 0)
+	{
+		OutTile.MinHeight = MaxHeight = 0.f;
+	}
+
+	// Full 16 bit range over the tile's own height span, a fraction of a unit for normal terrain
+	OutTile.HeightStep = (MaxHeight - OutTile.MinHeight) / MAX_uint16;
+	const float InvHeightStep = OutTile.HeightStep > 0.f ? 1.f / OutTile.HeightStep : 0.f;
+
+	OutTile.Heights.SetNumUninitialized(Source.Vertices.Num());
+	for (int32 Index = 0; Index < Source.Vertices.Num(); Index++)
+	{
+		const float Quantised = ((float)Source.Vertices[Index].Z - OutTile.MinHeight) * InvHeightStep;
+		OutTile.Heights[Index] = (uint16)FMath::Clamp(FMath::RoundToInt(Quantised), 0, (int32)MAX_uint16);
+	}
+
+	OutTile.Normals.SetNumUninitialized(Source.Normals.Num());
+	for (int32 Index = 0; Index < Source.Normals.Num(); Index++)
+	{
+		OutTile.Normals[Index] = PackNormal(Source.Normals[Index]);
+	}
+}
+
+void FCompressedTerrainTile::Decompress(const FTerrainTileParams& Params, FTerrainTileData& OutTile) const
+{
+	Decompress(Params, GetView(), OutTile);
+}
+
+FCompressedTerrainTileView FCompressedTerrainTile::GetView() const
+{
+	FCompressedTerrainTileView View;
+	View.Tile = Tile;
+	View.LODLevel = LODLevel;
+	View.MinHeight = MinHeight;
+	View.HeightStep = HeightStep;
+	View.Heights = Heights;
+	View.Normals = Normals;
+	return View;
+}
+
+bool FCompressedTerrainTile::Decompress(const FTerrainTileParams& Params, const FCompressedTerrainTileView& Source, FTerrainTileData& OutTile)
+{
+	OutTile.Tile = Source.Tile;
+	OutTile.LODLevel = Source.LODLevel;
+
+	const FIntPoint LODVertexCount = Params.GetLODVertexCount(Source.LODLevel);
+	const float LODCellSize = Params.CellSize * Source.LODLevel;
+	const FVector2D Offset = Params.GetTileOrigin(Source.Tile);
+	const int32 NumVertices = LODVertexCount.X * LODVertexCount.Y;
+
+	if (Source.Heights.Num() != NumVertices || Source.Normals.Num() != NumVertices)
+	{
+		return false;
+	}
+
+	OutTile.Vertices.Reset(NumVertices);
+	OutTile.UVs.Reset(NumVertices);
+	OutTile.Normals.Reset(NumVertices);
+	OutTile.Tangents.Reset(NumVertices);
+
+	int32 VertexIndex = 0;
+	for (int32 iVY = 0; iVY < LODVertexCount.Y; iVY++)
+	{
+		for (int32 iVX = 0; iVX < LODVertexCount.X; iVX++)
+		{
+			FVector2D CurrentLocation(iVX * LODCellSize + Offset.X, iVY * LODCellSize + Offset.Y);
+			float Z = Source.MinHeight + Source.Heights[VertexIndex] * Source.HeightStep;
+			OutTile.Vertices.Add(FVector(CurrentLocation.X, CurrentLocation.Y, Z));
+			OutTile.UVs.Add(Params.GetVertexUV(Source.Tile, Source.LODLevel, iVX, iVY));
+
+			// The tangent runs along X in the surface plane, same as GenerateTerrainTile
+			const FVector Normal = UnpackNormal(Source.Normals[VertexIndex]);
+			OutTile.Normals.Add(Normal);
+			OutTile.Tangents.Add(FProcMeshTangent(FVector(Normal.Z, 0.f, -Normal.X).GetSafeNormal(), false));
+
+			VertexIndex++;
+		}
+	}
+
+	OutTile.Triangles = FTerrainIndexBuffers::Get(LODVertexCount);
+	return true;
+}
+
+SIZE_T FCompressedTerrainTile::GetAllocatedSize() const
+{
+	return sizeof(*this) + Heights.GetAllocatedSize() + Normals.GetAllocatedSize();
+}
+
+uint32 FCompressedTerrainTile::PackNormal(const FVector& Normal)
+{
+	// Octahedral encoding, 16 bits per axis
+	const FVector3f N = FVector3f(Normal) / FMath::Max(FMath::Abs(Normal.X) + FMath::Abs(Normal.Y) + FMath::Abs(Normal.Z), UE_SMALL_NUMBER);
+	float X = N.X;
+	float Y = N.Y;
+	if (N.Z < 0.f)
+	{
+		X = (1.f - FMath::Abs(N.Y)) * (N.X >= 0.f ? 1.f : -1.f);
+		Y = (1.f - FMath::Abs(N.X)) * (N.Y >= 0.f ? 1.f : -1.f);
+	}
+
+	const uint32 PackedX = (uint32)FMath::RoundToInt((X * .5f + .5f) * MAX_uint16);
+	const uint32 PackedY = (uint32)FMath::RoundToInt((Y * .5f + .5f) * MAX_uint16);
+	return PackedX | (PackedY << 16);
+}
+
+FVector FCompressedTerrainTile::UnpackNormal(uint32 Packed)
+{
+	const float X = (Packed & 0xFFFF) / (float)MAX_uint16 * 2.f - 1.f;
+	const float Y = (Packed >> 16) / (float)MAX_uint16 * 2.f - 1.f;
+
+	FVector3f N(X, Y, 1.f - FMath::Abs(X) - FMath::Abs(Y));
+	if (N.Z < 0.f)
+	{
+		const float FoldedX = (1.f - FMath::Abs(N.Y)) * (N.X >= 0.f ? 1.f : -1.f);
+		const float FoldedY = (1.f - FMath::Abs(N.X)) * (N.Y >= 0.f ? 1.f : -1.f);
+		N.X = FoldedX;
+		N.Y = FoldedY;
+	}
+	return FVector(N.GetSafeNormal());
+}
+
+//********************//
+// Cache //
+//********************//
+
+FTerrainTileCache::~FTerrainTileCache()
+{
+	Empty();
+}
+
+void FTerrainTileCache::SetBudget(int64 InBudgetBytes)
+{
+	BudgetBytes = FMath::Max<int64>(0, InBudgetBytes);
+	Stats.BudgetBytes = BudgetBytes;
+	EvictToBudget();
+}
+
+FCompressedTerrainTilePtr FTerrainTileCache::Find(const FTerrainTileCacheKey& Key)
+{
+	FEntry* Entry = Entries.Find(Key);
+	if (!Entry)
+	{
+		Stats.Misses++;
+		return nullptr;
+	}
+
+	// Move to the front of the usage list
+	UsageOrder.RemoveNode(Entry->Node, false);
+	UsageOrder.AddHead(Entry->Node);
+
+	Stats.Hits++;
+	return Entry->Tile;
+}
+
+void FTerrainTileCache::Add(const FTerrainTileCacheKey& Key, const FCompressedTerrainTileRef& Tile)
+{
+	Remove(Key);
+
+	const int64 Bytes = Tile->GetAllocatedSize();
+	if (Bytes > BudgetBytes)
+	{
+		return;
+	}
+
+	UsageOrder.AddHead(Key);
+	Entries.Add(Key, FEntry{ Tile, Bytes, UsageOrder.GetHead() });
+	Stats.BytesUsed += Bytes;
+	Stats.NumTiles = Entries.Num();
+
+	EvictToBudget();
+}
+
+void FTerrainTileCache::Empty()
+{
+	Entries.Empty();
+	UsageOrder.Empty();
+	Stats.BytesUsed = 0;
+	Stats.NumTiles = 0;
+}
+
+void FTerrainTileCache::Remove(const FTerrainTileCacheKey& Key)
+{
+	if (FEntry* Entry = Entries.Find(Key))
+	{
+		TDoubleLinkedList<FTerrainTileCacheKey>::TDoubleLinkedListNode* Node = Entry->Node;
+		Stats.BytesUsed -= Entry->Bytes;
+		Entries.Remove(Key);
+		UsageOrder.RemoveNode(Node);
+		Stats.NumTiles = Entries.Num();
+	}
+}
+
+void FTerrainTileCache::EvictToBudget()
+{
+	while (Stats.BytesUsed > BudgetBytes && UsageOrder.GetTail())
+	{
+		// Copy the key, the list node holding it is deleted by Remove
+		const FTerrainTileCacheKey LeastRecent = UsageOrder.GetTail()->GetValue();
+		Remove(LeastRecent);
+		Stats.Evictions++;
+	}
+}
@@ -0,0 +1,140 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/List.h"
+#include "TerrainTile.h"
+#include "TerrainTileCache.generated.h"
+
+/** Non-owning view of compressed tile data, for example straight out of a mapped tile store file. */
+struct FCompressedTerrainTileView
+{
+	FIntPoint Tile = FIntPoint::ZeroValue;
+	int32 LODLevel = 1;
+	float MinHeight = 0.f;
+	float HeightStep = 0.f;
+	TConstArrayView<uint16> Heights;
+	TConstArrayView<uint32> Normals;
+};
+
+/**
+ * Compact copy of a generated tile: 16 bit quantised heights and octahedral packed normals.
+ * Vertex X/Y, UVs, tangents and triangles are rebuilt from the tile layout.
+ */
+struct TG_API FCompressedTerrainTile
+{
+	FIntPoint Tile = FIntPoint::ZeroValue;
+	int32 LODLevel = 1;
+
+	// Height = MinHeight + Quantised * HeightStep
+	float MinHeight = 0.f;
+	float HeightStep = 0.f;
+
+	TArray<uint16> Heights;
+	TArray<uint32> Normals;
+
+	static void Compress(const FTerrainTileData& Source, FCompressedTerrainTile& OutTile);
+	void Decompress(const FTerrainTileParams& Params, FTerrainTileData& OutTile) const;
+
+	// Rebuilds a tile from compressed data it does not own. Returns false if the data does not fit the layout.
+	static bool Decompress(const FTerrainTileParams& Params, const FCompressedTerrainTileView& Source, FTerrainTileData& OutTile);
+
+	FCompressedTerrainTileView GetView() const;
+
+	SIZE_T GetAllocatedSize() const;
+
+	static uint32 PackNormal(const FVector& Normal);
+	static FVector UnpackNormal(uint32 Packed);
+};
+
+typedef TSharedRef<const FCompressedTerrainTile, ESPMode::ThreadSafe> FCompressedTerrainTileRef;
+typedef TSharedPtr<const FCompressedTerrainTile, ESPMode::ThreadSafe> FCompressedTerrainTilePtr;
+
+struct FTerrainTileCacheKey
+{
+	FIntPoint Tile = FIntPoint::ZeroValue;
+	int32 LODLevel = 1;
+	uint32 ParamsHash = 0;
+
+	bool operator==(const FTerrainTileCacheKey& Other) const
+	{
+		return Tile == Other.Tile && LODLevel == Other.LODLevel && ParamsHash == Other.ParamsHash;
+	}
+
+	friend uint32 GetTypeHash(const FTerrainTileCacheKey& Key)
+	{
+		return HashCombine(HashCombine(GetTypeHash(Key.Tile), GetTypeHash(Key.LODLevel)), Key.ParamsHash);
+	}
+};
+
+USTRUCT(BlueprintType)
+struct FTerrainTileCacheStats
+{
+	GENERATED_BODY()
+
+	UPROPERTY(BlueprintReadOnly, Category = "Land")
+	int64 Hits = 0;
+
+	UPROPERTY(BlueprintReadOnly, Category = "Land")
+	int64 Misses = 0;
+
+	UPROPERTY(BlueprintReadOnly, Category = "Land")
+	int64 Evictions = 0;
+
+	UPROPERTY(BlueprintReadOnly, Category = "Land")
+	int64 NumTiles = 0;
+
+	UPROPERTY(BlueprintReadOnly, Category = "Land")
+	int64 BytesUsed = 0;
+
+	UPROPERTY(BlueprintReadOnly, Category = "Land")
+	int64 BudgetBytes = 0;
+};
+
+/**
+ * In-memory least recently used cache of compressed tiles, bounded by a byte budget.
+ * Game thread only.
+ */
+class TG_API FTerrainTileCache
+{
+public:
+	FTerrainTileCache() = default;
+	FTerrainTileCache(const FTerrainTileCache&) = delete;
+	FTerrainTileCache& operator=(const FTerrainTileCache&) = delete;
+	~FTerrainTileCache();
+
+	// Evicts least recently used tiles until the cache fits the new budget
+	void SetBudget(int64 InBudgetBytes);
+
+	// Returns the cached tile and marks it most recently used, or null on a miss
+	FCompressedTerrainTilePtr Find(const FTerrainTileCacheKey& Key);
+
+	void Add(const FTerrainTileCacheKey& Key, const FCompressedTerrainTileRef& Tile);
+
+	// Lookup that neither counts towards the stats nor changes the usage order
+	bool Contains(const FTerrainTileCacheKey& Key) const { return Entries.Contains(Key); }
+
+	void Empty();
+
+	const FTerrainTileCacheStats& GetStats() const { return Stats; }
+
+private:
+	struct FEntry
+	{
+		FCompressedTerrainTileRef Tile;
+		int64 Bytes;
+		TDoubleLinkedList<FTerrainTileCacheKey>::TDoubleLinkedListNode* Node;
+	};
+
+	void Remove(const FTerrainTileCacheKey& Key);
+	void EvictToBudget();
+
+	TMap<FTerrainTileCacheKey, FEntry> Entries;
+
+	// Most recently used at the head
+	TDoubleLinkedList<FTerrainTileCacheKey> UsageOrder;
+
+	int64 BudgetBytes = 0;
+	FTerrainTileCacheStats Stats;
+};
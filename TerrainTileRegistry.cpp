@@ -0,0 +1,217 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "TerrainTileRegistry.h"
+
+namespace
+{
+	struct FLowestFirst
+	{
+		template <typename EntryType>
+		bool operator()(const EntryType& A, const EntryType& B) const { return A.Priority < B.Priority; }
+	};
+
+	struct FHighestFirst
+	{
+		template <typename EntryType>
+		bool operator()(const EntryType& A, const EntryType& B) const { return A.Priority > B.Priority; }
+	};
+}
+
+void FTerrainTileRegistry::SetTileSize(const FVector2D& InTileSize)
+{
+	TileSize = InTileSize;
+	for (TPair<FIntPoint, FTerrainTileRecord>& Pair : Records)
+	{
+		Pair.Value.Bounds = FBox2D(FVector2D(Pair.Key) * TileSize, FVector2D(Pair.Key + FIntPoint(1, 1)) * TileSize);
+	}
+	RebuildQueues();
+}
+
+void FTerrainTileRegistry::SetViewer(const FVector2D& Location, const FVector2D& ViewDirection)
+{
+	ViewerLocation = Location;
+	const FVector2D Direction = ViewDirection.GetSafeNormal();
+	if (!Direction.IsNearlyZero())
+	{
+		ViewerDirection = Direction;
+	}
+
+	// Small moves only shift priorities by a fraction of a tile, not worth a full pass
+	const float MoveLimit = RebuildDistance * FMath::Min(TileSize.X, TileSize.Y);
+	if (FVector2D::DistSquared(ViewerLocation, RankedLocation) > MoveLimit * MoveLimit
+		|| FVector2D::DotProduct(ViewerDirection, RankedDirection) < RebuildViewCos)
+	{
+		RebuildQueues();
+	}
+}
+
+void FTerrainTileRegistry::Set(const FIntPoint& Tile, const FTerrainTileRecord& Record)
+{
+	if (const FTerrainTileRecord* Existing = Records.Find(Tile))
+	{
+		CountOutdated(*Existing, -1);
+	}
+
+	FTerrainTileRecord& Stored = Records.Add(Tile, Record);
+	Stored.Bounds = FBox2D(FVector2D(Tile) * TileSize, FVector2D(Tile + FIntPoint(1, 1)) * TileSize);
+	Stored.Stamp = NextStamp++;
+	CountOutdated(Stored, 1);
+
+	Push(Tile, Stored);
+}
+
+void FTerrainTileRegistry::Remove(const FIntPoint& Tile)
+{
+	FTerrainTileRecord Removed;
+	if (Records.RemoveAndCopyValue(Tile, Removed))
+	{
+		CountOutdated(Removed, -1);
+	}
+}
+
+void FTerrainTileRegistry::Empty()
+{
+	Records.Empty();
+	LoadQueue.Empty();
+	UnloadQueues.Empty();
+	NumUnloadEntries = 0;
+	NumOutdated = 0;
+}
+
+bool FTerrainTileRegistry::GetClosestQueued(FIntPoint& OutTile)
+{
+	while (LoadQueue.Num() > 0)
+	{
+		const FQueueEntry& Top = LoadQueue.HeapTop();
+		const FTerrainTileRecord* Record = Records.Find(Top.Tile);
+		if (Record && Record->Stamp == Top.Stamp)
+		{
+			OutTile = Top.Tile;
+			return true;
+		}
+		LoadQueue.HeapPopDiscard(FLowestFirst());
+	}
+	return false;
+}
+
+bool FTerrainTileRegistry::GetFurthestDrawn(float MinDistance, FIntPoint& OutTile)
+{
+	// Only a handful of LODs, compare the top of each
+	bool bFound = false;
+	float FurthestDistance = MinDistance;
+	for (TPair<int32, TArray<FQueueEntry>>& Pair : UnloadQueues)
+	{
+		FIntPoint Tile;
+		if (GetUnloadTop(Pair.Value, Tile) && GetDistance(Tile) > FurthestDistance)
+		{
+			FurthestDistance = GetDistance(Tile);
+			OutTile = Tile;
+			bFound = true;
+		}
+	}
+	return bFound;
+}
+
+bool FTerrainTileRegistry::GetFurthestDrawn(float MinDistance, int32 LODLevel, FIntPoint& OutTile)
+{
+	TArray<FQueueEntry>* Queue = UnloadQueues.Find(LODLevel);
+	FIntPoint Tile;
+
+	// The queue order may lag the viewer slightly, the threshold uses the current distance
+	if (!Queue || !GetUnloadTop(*Queue, Tile) || GetDistance(Tile) <= MinDistance)
+	{
+		return false;
+	}
+	OutTile = Tile;
+	return true;
+}
+
+bool FTerrainTileRegistry::GetUnloadTop(TArray<FQueueEntry>& Queue, FIntPoint& OutTile)
+{
+	while (Queue.Num() > 0)
+	{
+		const FQueueEntry& Top = Queue.HeapTop();
+		const FTerrainTileRecord* Record = Records.Find(Top.Tile);
+		if (Record && Record->Stamp == Top.Stamp)
+		{
+			OutTile = Top.Tile;
+			return true;
+		}
+		Queue.HeapPopDiscard(FHighestFirst());
+		NumUnloadEntries--;
+	}
+	return false;
+}
+
+float FTerrainTileRegistry::GetLoadPriority(const FIntPoint& Tile) const
+{
+	const FVector2D ToTile = GetTileCentre(Tile) - ViewerLocation;
+	const float Distance = ToTile.Size();
+	if (Distance < UE_KINDA_SMALL_NUMBER)
+	{
+		return 0.f;
+	}
+
+	// 0 straight ahead, 1 straight behind
+	const float Behind = (1.f - FVector2D::DotProduct(ToTile / Distance, ViewerDirection)) * .5f;
+	return Distance * (1.f + ViewPriorityBias * Behind);
+}
+
+void FTerrainTileRegistry::Push(const FIntPoint& Tile, const FTerrainTileRecord& Record)
+{
+	if (Record.State == ETerrainTileState::Queued)
+	{
+		LoadQueue.HeapPush(FQueueEntry{ GetLoadPriority(Tile), Tile, Record.Stamp }, FLowestFirst());
+	}
+	else if (Record.State == ETerrainTileState::Drawn)
+	{
+		UnloadQueues.FindOrAdd(Record.LODLevel).HeapPush(FQueueEntry{ GetDistance(Tile), Tile, Record.Stamp }, FHighestFirst());
+		NumUnloadEntries++;
+	}
+
+	// Stale entries pile up while tiles change state, drop them before they outnumber the live ones
+	if (LoadQueue.Num() + NumUnloadEntries > 2 * Records.Num() + 64)
+	{
+		RebuildQueues();
+	}
+}
+
+void FTerrainTileRegistry::RebuildQueues()
+{
+	RankedLocation = ViewerLocation;
+	RankedDirection = ViewerDirection;
+
+	LoadQueue.Reset();
+	for (TPair<int32, TArray<FQueueEntry>>& Pair : UnloadQueues)
+	{
+		Pair.Value.Reset();
+	}
+	NumUnloadEntries = 0;
+
+	for (const TPair<FIntPoint, FTerrainTileRecord>& Pair : Records)
+	{
+		if (Pair.Value.State == ETerrainTileState::Queued)
+		{
+			LoadQueue.Add(FQueueEntry{ GetLoadPriority(Pair.Key), Pair.Key, Pair.Value.Stamp });
+		}
+		else if (Pair.Value.State == ETerrainTileState::Drawn)
+		{
+			UnloadQueues.FindOrAdd(Pair.Value.LODLevel).Add(FQueueEntry{ GetDistance(Pair.Key), Pair.Key, Pair.Value.Stamp });
+			NumUnloadEntries++;
+		}
+	}
+	LoadQueue.Heapify(FLowestFirst());
+	for (TPair<int32, TArray<FQueueEntry>>& Pair : UnloadQueues)
+	{
+		Pair.Value.Heapify(FHighestFirst());
+	}
+}
+
+void FTerrainTileRegistry::CountOutdated(const FTerrainTileRecord& Record, int32 Delta)
+{
+	if (Record.OutdatedSectionIndex != INDEX_NONE)
+	{
+		NumOutdated += Delta;
+	}
+}
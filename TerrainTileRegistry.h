@@ -0,0 +1,157 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+enum class ETerrainTileState : uint8
+{
+	// Wanted, waiting for a generation slot
+	Queued,
+	// Generating on a worker, or generated and waiting for DrawTile
+	Generating,
+	// Shown in a mesh section
+	Drawn
+};
+
+enum class ETerrainCollisionTier : uint8
+{
+	// No collision, nothing is near enough to touch the tile
+	None,
+	// Low resolution copy of the tile on the collision-only mesh
+	Coarse,
+	// Collision on the drawn section itself
+	Full
+};
+
+enum class ETerrainFoliageTier : uint8
+{
+	// Culled, too far away to be seen
+	Far,
+	// Thinned to a fixed subset of the instances, without collision
+	Middle,
+	// Every instance, with collision
+	Near
+};
+
+/** Everything the world generator tracks about one tile. */
+struct FTerrainTileRecord
+{
+	ETerrainTileState State = ETerrainTileState::Queued;
+	int32 LODLevel = 1;
+
+	// Mesh section showing the tile, INDEX_NONE unless drawn
+	int32 SectionIndex = INDEX_NONE;
+
+	// Section still showing the tile at its previous LOD, removed once the new LOD is drawn
+	int32 OutdatedSectionIndex = INDEX_NONE;
+	int32 OutdatedLODLevel = 1;
+
+	// World space XY footprint
+	FBox2D Bounds = FBox2D(ForceInit);
+
+	// The tile's foliage components in the generator's pool, and the box around its instance origins
+	int32 FoliageIndex = INDEX_NONE;
+	FBox FoliageBounds = FBox(ForceInit);
+
+	// Collision the drawn tile currently has, and its collision-only mesh in the generator's pool when a mesh collides
+	ETerrainCollisionTier CollisionTier = ETerrainCollisionTier::None;
+	int32 CollisionMeshIndex = INDEX_NONE;
+
+	// Heightfield component holding the tile's navigation, and its collision when heightfield collision is on
+	int32 HeightfieldIndex = INDEX_NONE;
+
+	// Changes on every update, so queue entries left over from an earlier state can be told apart
+	uint32 Stamp = 0;
+};
+
+/**
+ * Tile records keyed by tile coordinate, plus priority queues over them: queued tiles ordered by
+ * distance to the viewer weighted by view direction, and drawn tiles ordered furthest first, one
+ * queue per LOD so a tile can be swapped for one with the same mesh layout.
+ *
+ * Queue entries are not removed when a record changes, they go stale and are skipped when they reach
+ * the top. Priorities are recomputed, in one linear pass, only once the viewer has moved or turned far
+ * enough to matter; every other query or update is O(log n).
+ *
+ * Game thread only.
+ */
+class TG_API FTerrainTileRegistry
+{
+public:
+	// Distance, as a fraction of a tile, the viewer may move before priorities are recomputed
+	static constexpr float RebuildDistance = 0.25f;
+
+	// Cosine of the angle the view may turn before priorities are recomputed, 15 degrees
+	static constexpr float RebuildViewCos = 0.966f;
+
+	// Extra weight on the distance of tiles behind the viewer. 1 makes a tile straight behind count as twice as far.
+	float ViewPriorityBias = 1.f;
+
+	void SetTileSize(const FVector2D& InTileSize);
+
+	// Updates the viewer, recomputing every priority if it moved or turned far enough
+	void SetViewer(const FVector2D& Location, const FVector2D& ViewDirection);
+
+	const FTerrainTileRecord* Find(const FIntPoint& Tile) const { return Records.Find(Tile); }
+
+	// Adds or replaces a record. Bounds and Stamp are filled in by the registry.
+	void Set(const FIntPoint& Tile, const FTerrainTileRecord& Record);
+
+	void Remove(const FIntPoint& Tile);
+
+	void Empty();
+
+	int32 Num() const { return Records.Num(); }
+	int32 GetNumOutdated() const { return NumOutdated; }
+	const TMap<FIntPoint, FTerrainTileRecord>& GetRecords() const { return Records; }
+
+	// Highest priority queued tile. False if nothing is queued.
+	bool GetClosestQueued(FIntPoint& OutTile);
+
+	// Furthest drawn tile, if it is further than MinDistance from the viewer
+	bool GetFurthestDrawn(float MinDistance, FIntPoint& OutTile);
+
+	// Furthest drawn tile at LODLevel, if it is further than MinDistance from the viewer
+	bool GetFurthestDrawn(float MinDistance, int32 LODLevel, FIntPoint& OutTile);
+
+	FVector2D GetTileCentre(const FIntPoint& Tile) const { return (FVector2D(Tile) + FVector2D(.5f, .5f)) * TileSize; }
+	float GetDistance(const FIntPoint& Tile) const { return FVector2D::Distance(GetTileCentre(Tile), ViewerLocation); }
+
+private:
+	struct FQueueEntry
+	{
+		float Priority;
+		FIntPoint Tile;
+		uint32 Stamp;
+	};
+
+	float GetLoadPriority(const FIntPoint& Tile) const;
+
+	// Drops stale entries off the top of an unload queue, returns false once it is empty
+	bool GetUnloadTop(TArray<FQueueEntry>& Queue, FIntPoint& OutTile);
+
+	void Push(const FIntPoint& Tile, const FTerrainTileRecord& Record);
+	void RebuildQueues();
+	void CountOutdated(const FTerrainTileRecord& Record, int32 Delta);
+
+	TMap<FIntPoint, FTerrainTileRecord> Records;
+
+	// Queued tiles, lowest priority value on top
+	TArray<FQueueEntry> LoadQueue;
+
+	// Drawn tiles by LOD, furthest on top
+	TMap<int32, TArray<FQueueEntry>> UnloadQueues;
+	int32 NumUnloadEntries = 0;
+
+	FVector2D TileSize = FVector2D(1.f, 1.f);
+	FVector2D ViewerLocation = FVector2D::ZeroVector;
+	FVector2D ViewerDirection = FVector2D(1.f, 0.f);
+
+	// Viewer the current priorities were computed for
+	FVector2D RankedLocation = FVector2D::ZeroVector;
+	FVector2D RankedDirection = FVector2D(1.f, 0.f);
+
+	uint32 NextStamp = 1;
+	int32 NumOutdated = 0;
+};
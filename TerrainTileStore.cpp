@@ -0,0 +1,431 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "TerrainTileStore.h"
+#include "HAL/PlatformFileManager.h"
+#include "Async/MappedFileHandle.h"
+#include "Misc/Paths.h"
+#include "Async/Async.h"
+
+FTerrainTileStore::FTerrainTileStore(const FString& InDirectory, const FString& InBakedDirectory)
+	: Directory(InDirectory)
+	, BakedDirectory(InBakedDirectory)
+{
+}
+
+FTerrainTileStore::~FTerrainTileStore()
+{
+	Flush();
+	UnmapAll();
+}
+
+FString FTerrainTileStore::GetDefaultDirectory()
+{
+	return FPaths::ProjectSavedDir() / TEXT("TerrainTiles");
+}
+
+FString FTerrainTileStore::GetBakedDirectory()
+{
+	return FPaths::ProjectContentDir() / TEXT("TerrainTiles");
+}
+
+FString FTerrainTileStore::GetRegionFileName(uint32 ParamsHash, const FIntPoint& Region, int32 LODLevel)
+{
+	return FString::Printf(TEXT("%08x/L%d/R_%d_%d.tiles"), ParamsHash, LODLevel, Region.X, Region.Y);
+}
+
+FIntPoint FTerrainTileStore::GetRegion(const FIntPoint& Tile)
+{
+	// Floor division so negative tiles land in their own regions
+	return FIntPoint(FMath::FloorToInt((float)Tile.X / RegionSize), FMath::FloorToInt((float)Tile.Y / RegionSize));
+}
+
+int32 FTerrainTileStore::GetSlotSize(int32 NumVertices)
+{
+	return sizeof(FSlotHeader) + Align(NumVertices * (int32)sizeof(uint16), 4) + NumVertices * (int32)sizeof(uint32);
+}
+
+int32 FTerrainTileStore::GetSlotIndex(const FIntPoint& Tile)
+{
+	const FIntPoint Region = GetRegion(Tile);
+	return (Tile.Y - Region.Y * RegionSize) * RegionSize + (Tile.X - Region.X * RegionSize);
+}
+
+FTerrainTileStore::FFileHeader FTerrainTileStore::MakeHeader(uint32 ParamsHash, const FIntPoint& Region, int32 LODLevel, int32 NumVertices)
+{
+	FFileHeader Header;
+	Header.Magic = FileMagic;
+	Header.Version = Version;
+	Header.ParamsHash = ParamsHash;
+	Header.RegionX = Region.X;
+	Header.RegionY = Region.Y;
+	Header.LODLevel = LODLevel;
+	Header.NumVertices = NumVertices;
+	Header.RegionSize = RegionSize;
+	Header.SlotSize = GetSlotSize(NumVertices);
+	return Header;
+}
+
+bool FTerrainTileStore::IsHeaderValid(const FFileHeader& Header, const FFileHeader& Expected)
+{
+	return FMemory::Memcmp(&Header, &Expected, sizeof(FFileHeader)) == 0;
+}
+
+//********************//
+// Reading //
+//********************//
+
+bool FTerrainTileStore::Load(const FTerrainTileParams& Params, uint32 ParamsHash, const FIntPoint& Tile, int32 LODLevel, FTerrainTileData& OutTile)
+{
+	FinishWrite(false);
+
+	// Not written yet
+	const FTerrainTileCacheKey Key{ Tile, LODLevel, ParamsHash };
+	const FCompressedTerrainTileRef* Pending = PendingWrites.Find(Key);
+	Pending = Pending ? Pending : WritingTiles.Find(Key);
+	if (Pending)
+	{
+		return FCompressedTerrainTile::Decompress(Params, (*Pending)->GetView(), OutTile);
+	}
+
+	// Tiles generated on this machine first, then the baked ones shipped with the game. A file being written
+	// is skipped, its other tiles are generated again rather than read half written.
+	const FString FileName = GetRegionFileName(ParamsHash, GetRegion(Tile), LODLevel);
+	if (!WritingFiles.Contains(Directory / FileName) && LoadFromFile(Directory / FileName, Params, ParamsHash, Tile, LODLevel, OutTile))
+	{
+		return true;
+	}
+	return !BakedDirectory.IsEmpty() && LoadFromFile(BakedDirectory / FileName, Params, ParamsHash, Tile, LODLevel, OutTile);
+}
+
+bool FTerrainTileStore::Contains(const FTerrainTileParams& Params, uint32 ParamsHash, const FIntPoint& Tile, int32 LODLevel)
+{
+	FinishWrite(false);
+
+	const FTerrainTileCacheKey Key{ Tile, LODLevel, ParamsHash };
+	if (PendingWrites.Contains(Key) || WritingTiles.Contains(Key))
+	{
+		return true;
+	}
+
+	const FString FileName = GetRegionFileName(ParamsHash, GetRegion(Tile), LODLevel);
+	FSlotHeader SlotHeader;
+	return (!WritingFiles.Contains(Directory / FileName) && ReadSlotHeader(Directory / FileName, Params, ParamsHash, Tile, LODLevel, SlotHeader))
+		|| (!BakedDirectory.IsEmpty() && ReadSlotHeader(BakedDirectory / FileName, Params, ParamsHash, Tile, LODLevel, SlotHeader));
+}
+
+bool FTerrainTileStore::ReadSlotHeader(const FString& Path, const FTerrainTileParams& Params, uint32 ParamsHash, const FIntPoint& Tile, int32 LODLevel, FSlotHeader& OutHeader)
+{
+	const FIntPoint LODVertexCount = Params.GetLODVertexCount(LODLevel);
+	const int32 NumVertices = LODVertexCount.X * LODVertexCount.Y;
+	const FFileHeader Expected = MakeHeader(ParamsHash, GetRegion(Tile), LODLevel, NumVertices);
+	const int64 SlotOffset = HeaderSize + (int64)GetSlotIndex(Tile) * Expected.SlotSize;
+
+	if (const FMappedFile* Mapped = MapFile(Path))
+	{
+		if (Mapped->Size < SlotOffset + Expected.SlotSize || !IsHeaderValid(*(const FFileHeader*)Mapped->Data, Expected))
+		{
+			return false;
+		}
+		FMemory::Memcpy(&OutHeader, Mapped->Data + SlotOffset, sizeof(FSlotHeader));
+	}
+	else
+	{
+		TUniquePtr<IFileHandle> File(FPlatformFileManager::Get().GetPlatformFile().OpenRead(*Path));
+		FFileHeader Header;
+		if (!File || File->Size() < SlotOffset + Expected.SlotSize || !File->Read((uint8*)&Header, sizeof(FFileHeader)) || !IsHeaderValid(Header, Expected)
+			|| !File->Seek(SlotOffset) || !File->Read((uint8*)&OutHeader, sizeof(FSlotHeader)))
+		{
+			return false;
+		}
+	}
+	return OutHeader.Magic == SlotMagic && OutHeader.NumVertices == NumVertices;
+}
+
+bool FTerrainTileStore::LoadFromFile(const FString& Path, const FTerrainTileParams& Params, uint32 ParamsHash, const FIntPoint& Tile, int32 LODLevel, FTerrainTileData& OutTile)
+{
+	const FIntPoint LODVertexCount = Params.GetLODVertexCount(LODLevel);
+	const int32 NumVertices = LODVertexCount.X * LODVertexCount.Y;
+	const FFileHeader Expected = MakeHeader(ParamsHash, GetRegion(Tile), LODLevel, NumVertices);
+	const int64 SlotOffset = HeaderSize + (int64)GetSlotIndex(Tile) * Expected.SlotSize;
+
+	const uint8* Slot = nullptr;
+	TArray<uint8> SlotBuffer;
+	if (const FMappedFile* Mapped = MapFile(Path))
+	{
+		if (Mapped->Size < SlotOffset + Expected.SlotSize || !IsHeaderValid(*(const FFileHeader*)Mapped->Data, Expected))
+		{
+			return false;
+		}
+		Slot = Mapped->Data + SlotOffset;
+	}
+	else
+	{
+		// Platforms without mapped files read the one slot instead
+		TUniquePtr<IFileHandle> File(FPlatformFileManager::Get().GetPlatformFile().OpenRead(*Path));
+		if (!File || File->Size() < SlotOffset + Expected.SlotSize)
+		{
+			return false;
+		}
+
+		FFileHeader Header;
+		SlotBuffer.SetNumUninitialized(Expected.SlotSize);
+		if (!File->Read((uint8*)&Header, sizeof(FFileHeader)) || !IsHeaderValid(Header, Expected)
+			|| !File->Seek(SlotOffset) || !File->Read(SlotBuffer.GetData(), Expected.SlotSize))
+		{
+			return false;
+		}
+		Slot = SlotBuffer.GetData();
+	}
+
+	const FSlotHeader& SlotHeader = *(const FSlotHeader*)Slot;
+	if (SlotHeader.Magic != SlotMagic || SlotHeader.NumVertices != NumVertices)
+	{
+		return false;
+	}
+
+	// View straight into the slot, nothing is copied until the mesh buffers are built
+	const uint8* HeightData = Slot + sizeof(FSlotHeader);
+	const uint8* NormalData = HeightData + Align(NumVertices * (int32)sizeof(uint16), 4);
+
+	FCompressedTerrainTileView View;
+	View.Tile = Tile;
+	View.LODLevel = LODLevel;
+	View.MinHeight = SlotHeader.MinHeight;
+	View.HeightStep = SlotHeader.HeightStep;
+	View.Heights = TConstArrayView<uint16>((const uint16*)HeightData, NumVertices);
+	View.Normals = TConstArrayView<uint32>((const uint32*)NormalData, NumVertices);
+
+	return FCompressedTerrainTile::Decompress(Params, View, OutTile);
+}
+
+const FTerrainTileStore::FMappedFile* FTerrainTileStore::MapFile(const FString& Path)
+{
+	if (FMappedFile* Existing = MappedFiles.Find(Path))
+	{
+		Existing->LastUsed = ++UseCounter;
+		return Existing;
+	}
+
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+	if (!PlatformFile.FileExists(*Path))
+	{
+		return nullptr;
+	}
+
+	IMappedFileHandle* Handle = PlatformFile.OpenMapped(*Path);
+	if (!Handle)
+	{
+		return nullptr;
+	}
+
+	IMappedFileRegion* MappedRegion = Handle->GetFileSize() >= HeaderSize ? Handle->MapRegion() : nullptr;
+	if (!MappedRegion)
+	{
+		delete Handle;
+		return nullptr;
+	}
+
+	// Keep the number of open mappings bounded, closing the least recently used
+	if (MappedFiles.Num() >= MaxMappedFiles)
+	{
+		FString LeastRecent;
+		uint64 LeastRecentUse = MAX_uint64;
+		for (const TPair<FString, FMappedFile>& Pair : MappedFiles)
+		{
+			if (Pair.Value.LastUsed < LeastRecentUse)
+			{
+				LeastRecentUse = Pair.Value.LastUsed;
+				LeastRecent = Pair.Key;
+			}
+		}
+		UnmapFile(LeastRecent);
+	}
+
+	FMappedFile& Mapped = MappedFiles.Add(Path);
+	Mapped.Handle = Handle;
+	Mapped.Region = MappedRegion;
+	Mapped.Data = MappedRegion->GetMappedPtr();
+	Mapped.Size = MappedRegion->GetMappedSize();
+	Mapped.LastUsed = ++UseCounter;
+	return &Mapped;
+}
+
+void FTerrainTileStore::UnmapFile(const FString& Path)
+{
+	FMappedFile Mapped;
+	if (MappedFiles.RemoveAndCopyValue(Path, Mapped))
+	{
+		// The region has to go before the handle it was mapped from
+		delete Mapped.Region;
+		delete Mapped.Handle;
+	}
+}
+
+void FTerrainTileStore::UnmapAll()
+{
+	for (TPair<FString, FMappedFile>& Pair : MappedFiles)
+	{
+		delete Pair.Value.Region;
+		delete Pair.Value.Handle;
+	}
+	MappedFiles.Empty();
+}
+
+//********************//
+// Writing //
+//********************//
+
+void FTerrainTileStore::Save(uint32 ParamsHash, const FCompressedTerrainTileRef& Tile)
+{
+	PendingWrites.Add(FTerrainTileCacheKey{ Tile->Tile, Tile->LODLevel, ParamsHash }, Tile);
+}
+
+bool FTerrainTileStore::Flush()
+{
+	bool bWritten = FinishWrite(true);
+	StartWrite();
+	return FinishWrite(true) && bWritten;
+}
+
+void FTerrainTileStore::FlushAsync()
+{
+	FinishWrite(false);
+	if (!WriteResult.IsValid())
+	{
+		StartWrite();
+	}
+}
+
+void FTerrainTileStore::StartWrite()
+{
+	if (PendingWrites.Num() == 0)
+	{
+		return;
+	}
+
+	// One batch per region file, so each file is opened once
+	TMap<FTerrainTileCacheKey, TArray<FCompressedTerrainTileRef>> Batches;
+	for (const TPair<FTerrainTileCacheKey, FCompressedTerrainTileRef>& Pair : PendingWrites)
+	{
+		Batches.FindOrAdd(FTerrainTileCacheKey{ GetRegion(Pair.Key.Tile), Pair.Key.LODLevel, Pair.Key.ParamsHash }).Add(Pair.Value);
+	}
+	WritingTiles = MoveTemp(PendingWrites);
+	PendingWrites.Reset();
+
+	// Never write under a live mapping, the files stay unmapped until the worker is done
+	for (const TPair<FTerrainTileCacheKey, TArray<FCompressedTerrainTileRef>>& Batch : Batches)
+	{
+		const FString Path = Directory / GetRegionFileName(Batch.Key.ParamsHash, Batch.Key.Tile, Batch.Key.LODLevel);
+		UnmapFile(Path);
+		WritingFiles.Add(Path);
+	}
+
+	WriteResult = Async(EAsyncExecution::ThreadPool, [InDirectory = Directory, Batches = MoveTemp(Batches)]()
+		{
+			bool bWritten = true;
+			for (const TPair<FTerrainTileCacheKey, TArray<FCompressedTerrainTileRef>>& Batch : Batches)
+			{
+				if (!WriteRegion(InDirectory, Batch.Key.ParamsHash, Batch.Value))
+				{
+					UE_LOG(LogTemp, Warning, TEXT("Could not write terrain region (%d, %d) LOD %d to the tile store"), Batch.Key.Tile.X, Batch.Key.Tile.Y, Batch.Key.LODLevel);
+					bWritten = false;
+				}
+			}
+			return bWritten;
+		}
+	);
+}
+
+bool FTerrainTileStore::FinishWrite(bool bWait)
+{
+	if (!WriteResult.IsValid() || (!bWait && !WriteResult.IsReady()))
+	{
+		return true;
+	}
+
+	const bool bWritten = WriteResult.Get();
+	WriteResult.Reset();
+	WritingTiles.Empty();
+	WritingFiles.Empty();
+	return bWritten;
+}
+
+bool FTerrainTileStore::WriteRegion(const FString& InDirectory, uint32 ParamsHash, TConstArrayView<FCompressedTerrainTileRef> Tiles)
+{
+	if (Tiles.Num() == 0)
+	{
+		return true;
+	}
+
+	const FIntPoint Region = GetRegion(Tiles[0]->Tile);
+	const int32 LODLevel = Tiles[0]->LODLevel;
+	const int32 NumVertices = Tiles[0]->Heights.Num();
+	const FFileHeader Expected = MakeHeader(ParamsHash, Region, LODLevel, NumVertices);
+	const int64 FileSize = HeaderSize + (int64)RegionSize * RegionSize * Expected.SlotSize;
+	const FString Path = InDirectory / GetRegionFileName(ParamsHash, Region, LODLevel);
+
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+
+	bool bFileValid = false;
+	{
+		TUniquePtr<IFileHandle> File(PlatformFile.OpenRead(*Path));
+		FFileHeader Header;
+		bFileValid = File && File->Size() == FileSize && File->Read((uint8*)&Header, sizeof(FFileHeader)) && IsHeaderValid(Header, Expected);
+	}
+
+	TUniquePtr<IFileHandle> File;
+	if (bFileValid)
+	{
+		File.Reset(PlatformFile.OpenWrite(*Path, true, true));
+	}
+	else
+	{
+		// New, stale or truncated region file, start over with every slot empty
+		PlatformFile.CreateDirectoryTree(*FPaths::GetPath(Path));
+		File.Reset(PlatformFile.OpenWrite(*Path, false, true));
+		if (File)
+		{
+			TArray<uint8> Empty;
+			Empty.SetNumZeroed(FileSize);
+			FMemory::Memcpy(Empty.GetData(), &Expected, sizeof(FFileHeader));
+			if (!File->Write(Empty.GetData(), Empty.Num()))
+			{
+				return false;
+			}
+		}
+	}
+	if (!File)
+	{
+		return false;
+	}
+
+	TArray<uint8> Slot;
+	Slot.SetNumZeroed(Expected.SlotSize);
+
+	for (const FCompressedTerrainTileRef& Tile : Tiles)
+	{
+		if (GetRegion(Tile->Tile) != Region || Tile->LODLevel != LODLevel || Tile->Heights.Num() != NumVertices || Tile->Normals.Num() != NumVertices)
+		{
+			return false;
+		}
+
+		FSlotHeader& SlotHeader = *(FSlotHeader*)Slot.GetData();
+		SlotHeader.Magic = SlotMagic;
+		SlotHeader.MinHeight = Tile->MinHeight;
+		SlotHeader.HeightStep = Tile->HeightStep;
+		SlotHeader.NumVertices = NumVertices;
+
+		uint8* HeightData = Slot.GetData() + sizeof(FSlotHeader);
+		uint8* NormalData = HeightData + Align(NumVertices * (int32)sizeof(uint16), 4);
+		FMemory::Memcpy(HeightData, Tile->Heights.GetData(), NumVertices * sizeof(uint16));
+		FMemory::Memcpy(NormalData, Tile->Normals.GetData(), NumVertices * sizeof(uint32));
+
+		const int64 SlotOffset = HeaderSize + (int64)GetSlotIndex(Tile->Tile) * Expected.SlotSize;
+		if (!File->Seek(SlotOffset) || !File->Write(Slot.GetData(), Slot.Num()))
+		{
+			return false;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,142 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Async/Future.h"
+#include "TerrainTileCache.h"
+
+class IMappedFileHandle;
+class IMappedFileRegion;
+
+/**
+ * Persistent tile store on disk.
+ *
+ * Tiles are grouped into regions of RegionSize x RegionSize tiles, one file per region and LOD, under a
+ * directory named after the layout hash. Every tile of a file has the same vertex count, so each tile
+ * owns a fixed size slot and files can be memory mapped and read in place.
+ *
+ * File layout, native endian:
+ *   FFileHeader, padded to HeaderSize
+ *   RegionSize * RegionSize slots of: FSlotHeader, uint16 heights (padded to 4 bytes), uint32 packed normals
+ *
+ * A store can also read from a second, read-only directory of tiles baked offline by UBakeTerrainCommandlet.
+ *
+ * Not thread safe, each store belongs to one thread. FlushAsync hands its tiles to a worker, which only
+ * touches the batch it was given.
+ */
+class TG_API FTerrainTileStore
+{
+public:
+	static constexpr uint32 Version = 1;
+	static constexpr int32 RegionSize = 16;
+
+	explicit FTerrainTileStore(const FString& InDirectory, const FString& InBakedDirectory = FString());
+	~FTerrainTileStore();
+
+	/** Rebuilds a tile from its slot on disk, or from a write that has not been flushed yet. */
+	bool Load(const FTerrainTileParams& Params, uint32 ParamsHash, const FIntPoint& Tile, int32 LODLevel, FTerrainTileData& OutTile);
+
+	/** Whether Load would find the tile, without rebuilding it. */
+	bool Contains(const FTerrainTileParams& Params, uint32 ParamsHash, const FIntPoint& Tile, int32 LODLevel);
+
+	/** Queues a tile to be written on the next Flush. */
+	void Save(uint32 ParamsHash, const FCompressedTerrainTileRef& Tile);
+
+	/** Writes every queued tile to disk before returning, after any write in flight. Returns false if any region file could not be written. */
+	bool Flush();
+
+	/**
+	 * Starts writing every queued tile on a worker. Does nothing while the previous batch is still being written,
+	 * the tiles stay queued for the next call. Queued and in flight tiles can still be loaded meanwhile.
+	 */
+	void FlushAsync();
+
+	int32 GetNumPendingWrites() const { return PendingWrites.Num(); }
+
+	/** Directory the default store lives in. */
+	static FString GetDefaultDirectory();
+
+	/** Directory baked tiles are shipped in, staged with the game as loose files. */
+	static FString GetBakedDirectory();
+
+	/** Region file holding a tile, relative to the store directory. */
+	static FString GetRegionFileName(uint32 ParamsHash, const FIntPoint& Region, int32 LODLevel);
+
+	static FIntPoint GetRegion(const FIntPoint& Tile);
+
+private:
+	struct FFileHeader
+	{
+		uint32 Magic;
+		uint32 Version;
+		uint32 ParamsHash;
+		int32 RegionX;
+		int32 RegionY;
+		int32 LODLevel;
+		int32 NumVertices;
+		int32 RegionSize;
+		int32 SlotSize;
+	};
+
+	struct FSlotHeader
+	{
+		// SlotMagic once the slot has been written, zero before
+		uint32 Magic;
+		float MinHeight;
+		float HeightStep;
+		int32 NumVertices;
+	};
+
+	struct FMappedFile
+	{
+		IMappedFileHandle* Handle = nullptr;
+		IMappedFileRegion* Region = nullptr;
+		const uint8* Data = nullptr;
+		int64 Size = 0;
+		uint64 LastUsed = 0;
+	};
+
+	static constexpr uint32 FileMagic = 0x52544754; // 'TGTR'
+	static constexpr uint32 SlotMagic = 0x544C5354; // 'TSLT'
+	static constexpr int32 HeaderSize = 64;
+	static_assert(sizeof(FFileHeader) <= HeaderSize, "Tile store header does not fit its reserved space");
+	static constexpr int32 MaxMappedFiles = 32;
+
+	static int32 GetSlotSize(int32 NumVertices);
+	static int32 GetSlotIndex(const FIntPoint& Tile);
+	static FFileHeader MakeHeader(uint32 ParamsHash, const FIntPoint& Region, int32 LODLevel, int32 NumVertices);
+	static bool IsHeaderValid(const FFileHeader& Header, const FFileHeader& Expected);
+
+	// Maps a region file, or returns the existing mapping. Null if the file is missing or cannot be mapped.
+	const FMappedFile* MapFile(const FString& Path);
+	void UnmapFile(const FString& Path);
+	void UnmapAll();
+
+	bool LoadFromFile(const FString& Path, const FTerrainTileParams& Params, uint32 ParamsHash, const FIntPoint& Tile, int32 LODLevel, FTerrainTileData& OutTile);
+
+	// Header of the tile's slot in a region file, false if the file or the slot is missing or stale
+	bool ReadSlotHeader(const FString& Path, const FTerrainTileParams& Params, uint32 ParamsHash, const FIntPoint& Tile, int32 LODLevel, FSlotHeader& OutHeader);
+
+	// Writes tiles that all belong to the same region file, any thread
+	static bool WriteRegion(const FString& InDirectory, uint32 ParamsHash, TConstArrayView<FCompressedTerrainTileRef> Tiles);
+
+	// Moves the queued tiles to WritingTiles and starts the worker writing them
+	void StartWrite();
+
+	// Waits for the write in flight, if any, and forgets its tiles. Returns false if it failed.
+	bool FinishWrite(bool bWait);
+
+	FString Directory;
+	FString BakedDirectory;
+	TMap<FString, FMappedFile> MappedFiles;
+	uint64 UseCounter = 0;
+
+	// Tiles generated since the last Flush, readable before they reach the disk
+	TMap<FTerrainTileCacheKey, FCompressedTerrainTileRef> PendingWrites;
+
+	// Tiles and region files the worker is writing. The files are not read until it is done.
+	TMap<FTerrainTileCacheKey, FCompressedTerrainTileRef> WritingTiles;
+	TSet<FString> WritingFiles;
+	TFuture<bool> WriteResult;
+};
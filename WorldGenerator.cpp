@@ -2,7 +2,7 @@
 
 
 #include "WorldGenerator.h"
-#include "KismetProceduralMeshLibrary.h"
+#include "TerrainHeightKernel.h"
 #include "Kismet/GameplayStatics.h"
 #include "GameFramework/Character.h"
 #include "Async/Async.h"
@@ -11,22 +11,34 @@
 #include "TGGameMode.h"
 #include "NavigationSystem.h"
 #include "NavMesh/NavMeshBoundsVolume.h"
+#include "NavMesh/RecastNavMesh.h"
 #include "GameFramework/PlayerController.h"
 #include "DrawDebugHelpers.h"
+#include "PhysicsEngine/BodySetup.h"
+#include "Chaos/ChaosArchive.h"
+#include "Chaos/TriangleMeshImplicitObject.h"
+#include "Serialization/MemoryWriter.h"
+#include "PhysicalMaterials/PhysicalMaterial.h"
 
 
 AWorldGenerator::AWorldGenerator()
 {
 	
-	PrimaryActorTick.bCanEverTick = false;
+	// Ticks to commit finished tiles
+	PrimaryActorTick.bCanEverTick = true;
 
 	TerrainMesh = CreateDefaultSubobject<UProceduralMeshComponent>(TEXT("TerrainMesh"));
 	
 	TerrainMesh->bUseAsyncCooking = true;
 	TerrainMesh->SetupAttachment(GetRootComponent());
+
+	// Navigation comes from per-tile heightfields, so a tile changing only dirties its own area
+	TerrainMesh->SetCanEverAffectNavigation(false);
+
 	
 
 	TileReplaceableDistance = CellSize * (NumOfSectionsX + NumOfSectionsY) / 2 * (XVertexCount + YVertexCount);
+	TileUnloadHysteresis = (XVertexCount - 1) * CellSize / 2;
 	
 
 	seaMesh = CreateDefaultSubobject<UStaticMeshComponent>(TEXT("SeaMesh"));
@@ -43,15 +55,59 @@ void AWorldGenerator::BeginPlay()
 	FoliageRandomisation();
 	InitialiseFoliageTypes();
 
+	TileCache.SetBudget(int64(TileCacheBudgetMB) * 1024 * 1024);
+	TileRegistry.SetTileSize(FVector2D(XVertexCount - 1, YVertexCount - 1) * CellSize);
+
+	if (UseTileStore)
+	{
+		TileStore = MakeUnique<FTerrainTileStore>(FTerrainTileStore::GetDefaultDirectory(), FTerrainTileStore::GetBakedDirectory());
+	}
+
 	if (TerrainMesh)
 	{
 		TerrainMesh->RegisterComponentWithWorld(GetWorld());
-		if (TerrainMesh->IsRegistered() && GetWorld())
+	}
+
+	// Tile areas are rebuilt by the navmesh's own async tile jobs, capped here
+	if (UNavigationSystemV1* NavSys = FNavigationSystem::GetCurrent<UNavigationSystemV1>(GetWorld()))
+	{
+		if (ARecastNavMesh* NavMesh = Cast<ARecastNavMesh>(NavSys->GetDefaultNavDataInstance()))
+		{
+			NavMesh->SetMaxSimultaneousTileGenerationJobsCount(FMath::Max(1, MaxNavTileJobs));
+			if (NavMesh->GetRuntimeGenerationMode() != ERuntimeGenerationType::Dynamic)
+			{
+				UE_LOG(LogTemp, Warning, TEXT("Navigation only follows terrain tiles with dynamic runtime generation."));
+			}
+		}
+
+		if (UseNavRegions && !NavSys->IsActiveTilesGenerationEnabled())
 		{
-			TerrainMesh->SetCanEverAffectNavigation(true);
-			FNavigationSystem::UpdateComponentData(*TerrainMesh);
+			UE_LOG(LogTemp, Warning, TEXT("Navigation regions need Generate Navigation Only Around Navigation Invokers, the whole bounds volume will be built."));
 		}
 	}
+
+	SetupNavBounds();
+
+	PathQueries = MakeShared<FPathQueryService>(GetWorld());
+	PathQueries->MaxSearchesInFlight = FMath::Max(1, MaxPathSearchesInFlight);
+	PathQueries->CacheLifetime = PathCacheLifetime;
+}
+
+void AWorldGenerator::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	if (PathQueries)
+	{
+		PathQueries->CancelAll();
+		PathQueries.Reset();
+	}
+
+	if (TileStore)
+	{
+		TileStore->Flush();
+		TileStore.Reset();
+	}
+
+	Super::EndPlay(EndPlayReason);
 }
 
 
@@ -59,13 +115,30 @@ void AWorldGenerator::Tick(float DeltaTime)
 {
 	Super::Tick(DeltaTime);
 
+	if (AutoCommitTiles)
+	{
+		CommitTiles();
+	}
+
+	UpdateCollisionTiers();
+	UpdateFoliageTiers();
+	UpdateNavTiles();
+	UpdateNavRegions();
+
+	if (PathQueries)
+	{
+		PathQueries->Tick();
+	}
+
+	const double Now = GetWorld()->GetTimeSeconds();
+	if (FoliagePoolShrinkInterval > 0.f && Now - LastFoliagePoolShrinkTime >= FoliagePoolShrinkInterval)
+	{
+		LastFoliagePoolShrinkTime = Now;
+		ShrinkFoliagePools();
+	}
+
 	ActorsToMove();
 	RelocateSea();
-
-	
-	RebuildNavMesh();
-		
-	
 }
 
 void AWorldGenerator::SaveTerrainLayout()
@@ -110,55 +183,91 @@ void AWorldGenerator::LoadTerrainLayout()
 //********************//
 
 void AWorldGenerator::UpdateAndRemoveOutdatedLODs() {
-	TArray<FIntPoint> keyArray, valueArray;
-	RemoveLODQueue.GenerateKeyArray(keyArray);
-	RemoveLODQueue.GenerateValueArray(valueArray);
+	SyncTileRegistry();
 
 	FIntPoint currentSection(SectionIndexX, SectionIndexY);
-	if (RemoveLODQueue.Contains(currentSection)) {
-		FIntPoint* value = RemoveLODQueue.Find(currentSection);
-		if (value) {
-			RemoveFoliageTileCpp(value->X);
-			TerrainMesh->ClearMeshSection(value->X);
-			RemoveLODQueue.Remove(currentSection);
-		}
+	const FTerrainTileRecord* record = TileRegistry.Find(currentSection);
+	if (record && record->OutdatedSectionIndex != INDEX_NONE) {
+		FTerrainTileRecord updated = *record;
+		TerrainMesh->ClearMeshSection(updated.OutdatedSectionIndex);
+		FreeMeshSections.Add(updated.OutdatedSectionIndex);
+		updated.OutdatedSectionIndex = INDEX_NONE;
+		SetTileRecord(currentSection, updated);
 	}
 }
 
 int AWorldGenerator::UpdateMeshSections() {
-	int furthestTileIndex = GetFurthestUpdateableTile();
-	if (furthestTileIndex > -1) {
-		TArray<FIntPoint> keyArray, valueArray;
-		QueuedTiles.GenerateKeyArray(keyArray);
-		QueuedTiles.GenerateValueArray(valueArray);
-		int replaceableMeshSection = valueArray[furthestTileIndex].X;
-		FIntPoint replaceableTile = keyArray[furthestTileIndex];
-
-		RemoveFoliageTileCpp(replaceableMeshSection);
-		TerrainMesh->ClearMeshSection(replaceableMeshSection);
-		TerrainMesh->CreateMeshSection(replaceableMeshSection, SubVertices, SubTriangles, SubNormals, SubUVs, TArray<FColor>(), SubTangents, true);
-		QueuedTiles.Add(FIntPoint(SectionIndexX, SectionIndexY), FIntPoint(replaceableMeshSection, CellLODLevel));
-		QueuedTiles.Remove(replaceableTile);
-
-		return replaceableMeshSection;
+	SyncTileRegistry();
+
+	const FTerrainTileData& Tile = *CommittingTile;
+	const FIntPoint currentTile(SectionIndexX, SectionIndexY);
+
+	FTerrainTileRecord drawn;
+	if (const FTerrainTileRecord* existing = TileRegistry.Find(currentTile)) {
+		drawn = *existing;
+	}
+	drawn.State = ETerrainTileState::Drawn;
+	drawn.LODLevel = CellLODLevel;
+
+	// Drawn sections never collide, the tile's collision is added below on its own component
+	const ETerrainCollisionTier collisionTier = GetDesiredCollisionTier(currentTile, ETerrainCollisionTier::None);
+
+	int drawnMeshSection;
+
+	// A tile out of range at the same LOD has the same vertex layout, so its section can be rewritten in place
+	FIntPoint replaceableTile;
+	const bool sameLayout = GetFurthestReplaceableTile(CellLODLevel, replaceableTile);
+	if (sameLayout || GetFurthestReplaceableTile(replaceableTile)) {
+		drawnMeshSection = TileRegistry.Find(replaceableTile)->SectionIndex;
+
+		const FProcMeshSection* section = TerrainMesh->GetProcMeshSection(drawnMeshSection);
+		if (sameLayout && section && section->ProcVertexBuffer.Num() == Tile.Vertices.Num()) {
+			// Keeps the section's buffers and indices, only the vertices are rewritten
+			TerrainMesh->UpdateMeshSection(drawnMeshSection, Tile.Vertices, Tile.Normals, Tile.UVs, TArray<FColor>(), Tile.Tangents);
+		}
+		else {
+			TerrainMesh->ClearMeshSection(drawnMeshSection);
+			TerrainMesh->CreateMeshSection(drawnMeshSection, Tile.Vertices, *Tile.Triangles, Tile.Normals, Tile.UVs, TArray<FColor>(), Tile.Tangents, false);
+		}
+		RemoveTileRecord(replaceableTile);
+	}
+	else if (FreeMeshSections.Num() > 0) {
+		// Cleared earlier, the material is still assigned
+		drawnMeshSection = FreeMeshSections.Pop();
+		TerrainMesh->CreateMeshSection(drawnMeshSection, Tile.Vertices, *Tile.Triangles, Tile.Normals, Tile.UVs, TArray<FColor>(), Tile.Tangents, false);
 	}
 	else {
-		TerrainMesh->CreateMeshSection(MeshSectionIndex, SubVertices, SubTriangles, SubNormals, SubUVs, TArray<FColor>(), SubTangents, true);
+		drawnMeshSection = MeshSectionIndex++;
+		TerrainMesh->CreateMeshSection(drawnMeshSection, Tile.Vertices, *Tile.Triangles, Tile.Normals, Tile.UVs, TArray<FColor>(), Tile.Tangents, false);
 		if (TerrainMaterial) {
-			TerrainMesh->SetMaterial(MeshSectionIndex, TerrainMaterial);
+			TerrainMesh->SetMaterial(drawnMeshSection, TerrainMaterial);
 		}
-		return MeshSectionIndex++;
 	}
+
+	drawn.SectionIndex = drawnMeshSection;
+	SetTileRecord(currentTile, drawn);
+	SetTileCollisionTier(currentTile, collisionTier, true);
+	return drawnMeshSection;
 }
 
 void AWorldGenerator::ClearMeshData() {
-	SubVertices.Empty();
-	SubNormals.Empty();
-	SubUVs.Empty();
-	SubTangents.Empty();
+	CommittingTile.Reset();
 }
 
 int AWorldGenerator::DrawTile() {
+	if (CompletedTiles.Num() == 0) {
+		return -1;
+	}
+
+	// Oldest finished tile first
+	CommittingTile = CompletedTiles[0];
+	CompletedTiles.RemoveAt(0);
+	TileReady = CompletedTiles.Num() > 0;
+
+	SectionIndexX = CommittingTile->Tile.X;
+	SectionIndexY = CommittingTile->Tile.Y;
+	CellLODLevel = CommittingTile->LODLevel;
+
 	// Update and check outdated LODs
 	UpdateAndRemoveOutdatedLODs();
 
@@ -170,383 +279,1881 @@ int AWorldGenerator::DrawTile() {
 	return drawnMeshSection;
 }
 
-void AWorldGenerator::GenerateFoliageTile(int32 TerrainMeshSectionIndex)
+void AWorldGenerator::AddCompletedTile(const FTerrainTileDataRef& Tile)
 {
-	if (TerrainMesh)
+	// Cached and stored tiles come back without foliage, it is placed off the game thread before they are committed.
+	// The job counts as a tile in flight, so cache and store hits are throttled like generated tiles.
+	if (!Tile->Foliage.IsValid() && FoliageTypes.Num() > 0)
 	{
-		// Attempt to get a pointer to the procedural mesh section
-		FProcMeshSection* MeshSection = TerrainMesh->GetProcMeshSection(TerrainMeshSectionIndex);
+		TilesInFlight++;
+		GeneratorBusy = TilesInFlight >= MaxConcurrentTiles;
+		(new FAutoDeleteAsyncTask<FAsyncFoliageGenerator>(this, GetTileParams(), GetFoliageParams(), Tile))->StartBackgroundTask();
+		return;
+	}
 
-		for (const FProcMeshVertex& Vertex : MeshSection->ProcVertexBuffer)
-		{
+	if (Tile->Suitability.IsValid())
+	{
+		SuitabilityIndices.Add(Tile->Tile, Tile->Suitability.ToSharedRef());
+	}
+
+	CompletedTiles.Add(Tile);
+	TileReady = !AutoCommitTiles;
+}
+
+void AWorldGenerator::CommitTiles()
+{
+	const double StartTime = FPlatformTime::Seconds();
+	const double Deadline = StartTime + CommitBudgetMs / 1000.0;
+	int32 StepsRun = 0;
 
-			FVector ActorLocation = GetActorLocation();
+	// At least one step a frame, so the queue drains whatever the budget
+	while (StepsRun == 0 || FPlatformTime::Seconds() < Deadline)
+	{
+		if (!ActiveCommit.Tile.IsValid())
+		{
+			if (CompletedTiles.Num() == 0)
+			{
+				break;
+			}
 
-			FVector LocationToAddFoliage = ActorLocation + Vertex.Position;
+			int32 NextIndex = 0;
+			if (CommitNearestFirst)
+			{
+				UpdateTileViewer();
+				for (int32 Index = 1; Index < CompletedTiles.Num(); Index++)
+				{
+					if (TileRegistry.GetDistance(CompletedTiles[Index]->Tile) < TileRegistry.GetDistance(CompletedTiles[NextIndex]->Tile))
+					{
+						NextIndex = Index;
+					}
+				}
+			}
 
-			AddFoliageInstances(LocationToAddFoliage);
-			AddRelevantFoliageInstances(LocationToAddFoliage);
+			ActiveCommit = FTileCommit();
+			ActiveCommit.Tile = CompletedTiles[NextIndex];
+			CompletedTiles.RemoveAt(NextIndex);
 		}
 
-		RefreshFoliage();
+		RunCommitStep();
+		StepsRun++;
+	}
+
 
+	const float FrameMs = (FPlatformTime::Seconds() - StartTime) * 1000.0;
+	CommitStats.LastFrameMs = FrameMs;
+	if (StepsRun > 0)
+	{
+		CommitStats.AverageFrameMs = FMath::Lerp(CommitStats.AverageFrameMs, FrameMs, .1f);
+		CommitStats.MaxFrameMs = FMath::Max(CommitStats.MaxFrameMs, FrameMs);
+		CommitStats.FramesOverBudget += FrameMs > CommitBudgetMs ? 1 : 0;
 	}
 }
 
-FVector AWorldGenerator::GetPlayerLocation()
+void AWorldGenerator::RunCommitStep()
 {
+	const FTerrainTileData& Tile = *ActiveCommit.Tile;
 
+	// The DrawTile helpers work on the tile named by these
+	SectionIndexX = Tile.Tile.X;
+	SectionIndexY = Tile.Tile.Y;
+	CellLODLevel = Tile.LODLevel;
 
-
-	ACharacter* PlayerCharacter = UGameplayStatics::GetPlayerCharacter(GetWorld(), 0);
-	if (PlayerCharacter)
+	switch (ActiveCommit.Step)
 	{
-		return PlayerCharacter->GetActorLocation();
+	case ECommitStep::Upload:
+		// The old LOD goes in the same step, after the new section is up, so the tile is never left without mesh or collision
+		CommittingTile = ActiveCommit.Tile;
+		ActiveCommit.SectionIndex = UpdateMeshSections();
+		UpdateAndRemoveOutdatedLODs();
+		ClearMeshData();
+		ActiveCommit.Step = Tile.Foliage.IsValid() ? ECommitStep::Foliage : ECommitStep::Done;
+		break;
+
+	case ECommitStep::Foliage:
+	{
+		// Placed by the tile's job, replaces whatever the tile showed at its previous LOD. One foliage type a step,
+		// so each instance upload and tree build is timed against the budget on its own.
+		const FTerrainTileRecord* Existing = TileRegistry.Find(Tile.Tile);
+		if (!Existing || (ActiveCommit.FoliageTypeIndex > 0 && Existing->FoliageIndex == INDEX_NONE))
+		{
+			ActiveCommit.Step = ECommitStep::Done;
+			break;
+		}
+
+		FTerrainTileRecord Record = *Existing;
+		if (ActiveCommit.FoliageTypeIndex == 0 && !BeginTileFoliage(Record, *Tile.Foliage))
+		{
+			SetTileRecord(Tile.Tile, Record);
+			ActiveCommit.Step = ECommitStep::Done;
+			break;
+		}
+
+		SetTileFoliageType(Record, *Tile.Foliage, ActiveCommit.FoliageTypeIndex++);
+		SetTileRecord(Tile.Tile, Record);
+		if (ActiveCommit.FoliageTypeIndex >= TileFoliage[Record.FoliageIndex].Components.Num())
+		{
+			ActiveCommit.Step = ECommitStep::Done;
+		}
+		break;
 	}
-	APawn* PlayerPawn = UGameplayStatics::GetPlayerPawn(GetWorld(), 0);
 
-	if (PlayerPawn)
+	case ECommitStep::Done:
+		break;
+	}
+
+	if (ActiveCommit.Step == ECommitStep::Done)
 	{
-		return PlayerPawn->GetActorLocation();
+		ActiveCommit = FTileCommit();
+		CommitStats.TilesCommitted++;
 	}
+}
 
-	return FVector(0, 0, 0);
+FTerrainCommitStats AWorldGenerator::GetCommitStats() const
+{
+	FTerrainCommitStats Stats = CommitStats;
+	Stats.QueueDepth = CompletedTiles.Num() + (ActiveCommit.Tile.IsValid() ? 1 : 0);
+	return Stats;
 }
 
-FVector2D AWorldGenerator::GetTileLocation(FIntPoint TileCoordinate)
+// Size of a collision shape as it would be stored, a stand-in for its memory
+static int64 GetCollisionBytes(Chaos::FImplicitObject& Geometry)
 {
-	return FVector2D(TileCoordinate * FIntPoint(XVertexCount - 1, YVertexCount - 1) * CellSize) + FVector2D(XVertexCount - 1, YVertexCount - 1) * CellSize / 2;
+	TArray<uint8> Bytes;
+	FMemoryWriter Writer(Bytes);
+	Chaos::FChaosArchive ChaosArchive(Writer);
+	Geometry.Serialize(ChaosArchive);
+	return Bytes.Num();
 }
 
-FIntPoint AWorldGenerator::GetClosestQueuedTile()
+FTerrainCollisionBenchmark AWorldGenerator::BenchmarkTileCollision(int NumTiles, int LODLevel)
 {
-	float ClosestDistance = TNumericLimits<float>::Max();
-	FIntPoint ClosestTile;
-	for (const auto& Entry : QueuedTiles)
+	FTerrainCollisionBenchmark Result;
+	Result.NumTiles = FMath::Max(1, NumTiles);
+
+	const FTerrainTileParams Params = GetTileParams();
+	const int32 LOD = FMath::Max(1, LODLevel);
+	const FIntPoint VertexCount = Params.GetLODVertexCount(LOD);
+	const float LODCellSize = Params.CellSize * LOD;
+
+	// Outside any world, so it cooks synchronously like a mesh section with async cooking off
+	UProceduralMeshComponent* TrimeshProbe = NewObject<UProceduralMeshComponent>(GetTransientPackage());
+	TrimeshProbe->bUseAsyncCooking = false;
+
+	double TrimeshSeconds = 0.0;
+	double HeightfieldSeconds = 0.0;
+	for (int32 TileIndex = 0; TileIndex < Result.NumTiles; TileIndex++)
 	{
-		const FIntPoint& Key = Entry.Key;
-		int Value = Entry.Value.X;
-		if (Value == -1)
+		FTerrainTileData Tile;
+		Tile.Tile = FIntPoint(TileIndex % 8, TileIndex / 8);
+		Tile.LODLevel = LOD;
+		GenerateTerrainTile(Params, Tile);
+
+		double StartTime = FPlatformTime::Seconds();
+		TrimeshProbe->CreateMeshSection(0, Tile.Vertices, *Tile.Triangles, TArray<FVector>(), TArray<FVector2D>(), TArray<FColor>(), TArray<FProcMeshTangent>(), true);
+		TrimeshSeconds += FPlatformTime::Seconds() - StartTime;
+
+		if (UBodySetup* BodySetup = TrimeshProbe->GetBodySetup())
 		{
-			FVector2D TileLocation = GetTileLocation(Key);
-			FVector PlayerLocation = GetPlayerLocation();
-			float Distance = FVector2D::Distance(TileLocation, FVector2D(PlayerLocation));
-			if (Distance < ClosestDistance)
+			for (const auto& TriMesh : BodySetup->TriMeshGeometries)
 			{
-				ClosestDistance = Distance;
-				ClosestTile = Key;
+				Result.TrimeshBytes += GetCollisionBytes(*TriMesh);
 			}
 		}
-	}
-	return ClosestTile;
-}
 
-int AWorldGenerator::GetFurthestUpdateableTile()
-{
-	float FurthestDistance = std::numeric_limits<float>::lowest();
-	int FurthestTileIndex = -1;
-	int CurrentIndex = 0;
-	for (const auto& Entry : QueuedTiles)
-	{
-		const FIntPoint& Key = Entry.Key;
-		int Value = Entry.Value.X;
-		if (Value != -1)
+		StartTime = FPlatformTime::Seconds();
+		FVector Origin;
+		TRefCountPtr<Chaos::FHeightField> HeightField = UTerrainHeightfieldComponent::BuildHeightField(VertexCount, LODCellSize, Tile.Vertices, Origin);
+		HeightfieldSeconds += FPlatformTime::Seconds() - StartTime;
+		if (!HeightField.IsValid())
 		{
-			FVector2D TileLocation = GetTileLocation(Key);
-			FVector PlayerLocation = GetPlayerLocation();
-			float Distance = FVector2D::Distance(TileLocation, FVector2D(PlayerLocation));
-			if (Distance > FurthestDistance && Distance > TileReplaceableDistance)
+			continue;
+		}
+		Result.HeightfieldBytes += GetCollisionBytes(*HeightField);
+
+		// Drops a ray onto the heightfield over a point of the tile, undoing the component's placement by hand
+		const float RayLength = HeightField->BoundingBox().Max().Z + 1000.f;
+		auto GetHeightfieldZ = [&](const FVector2D& Location, float& OutZ)
+		{
+			const Chaos::FVec3 RayStart(Location.Y - Origin.Y, Origin.X - Location.X, RayLength - 500.f);
+			Chaos::FReal Time;
+			Chaos::FVec3 Position, Normal;
+			int32 FaceIndex;
+			if (!HeightField->Raycast(RayStart, Chaos::FVec3(0, 0, -1), RayLength, 0, Time, Position, Normal, FaceIndex))
+			{
+				return false;
+			}
+			OutZ = Position.Z + Origin.Z;
+			return true;
+		};
+
+		// A point inside each triangle of every quad, against the triangles the mesh section draws
+		const auto VertexAt = [&](int32 iVX, int32 iVY) { return Tile.Vertices[iVY * VertexCount.X + iVX]; };
+		for (int32 iVY = 0; iVY < VertexCount.Y - 1; iVY++)
+		{
+			for (int32 iVX = 0; iVX < VertexCount.X - 1; iVX++)
 			{
-				FurthestDistance = Distance;
-				FurthestTileIndex = CurrentIndex;
+				const FVector V00 = VertexAt(iVX, iVY);
+				const FVector V10 = VertexAt(iVX + 1, iVY);
+				const FVector V01 = VertexAt(iVX, iVY + 1);
+				const FVector V11 = VertexAt(iVX + 1, iVY + 1);
+
+				const FVector Samples[] = {
+					V00 + (V10 - V00) * .25f + (V01 - V00) * .25f,
+					V11 + (V01 - V11) * .25f + (V10 - V11) * .25f
+				};
+				for (const FVector& Sample : Samples)
+				{
+					float HeightfieldZ;
+					const float Error = GetHeightfieldZ(FVector2D(Sample), HeightfieldZ) ? FMath::Abs(HeightfieldZ - Sample.Z) : MAX_flt;
+					Result.MaxHeightError = FMath::Max(Result.MaxHeightError, Error);
+				}
 			}
 		}
-		CurrentIndex++;
 	}
-	return FurthestTileIndex;
+
+	TrimeshProbe->ClearAllMeshSections();
+
+	Result.TrimeshCookMs = TrimeshSeconds * 1000.0 / Result.NumTiles;
+	Result.HeightfieldBuildMs = HeightfieldSeconds * 1000.0 / Result.NumTiles;
+	Result.TrimeshBytes /= Result.NumTiles;
+	Result.HeightfieldBytes /= Result.NumTiles;
+
+	UE_LOG(LogTemp, Log, TEXT("Tile collision, %d tiles at LOD %d: trimesh %.3f ms %lld bytes, heightfield %.3f ms %lld bytes, max height error %.3f"),
+		Result.NumTiles, LOD, Result.TrimeshCookMs, Result.TrimeshBytes, Result.HeightfieldBuildMs, Result.HeightfieldBytes, Result.MaxHeightError);
+	return Result;
 }
 
-void AWorldGenerator::RemoveFoliageTileCpp(const int TileIndex)
+void AWorldGenerator::GenerateFoliageTile(int32 TerrainMeshSectionIndex)
 {
-	TArray<FProcMeshVertex> Vertices1 = TerrainMesh->GetProcMeshSection(TileIndex)->ProcVertexBuffer;
-	FVector FirstVertex = Vertices1[0].Position;
-	FVector LastVertex = Vertices1[Vertices1.Num() - 1].Position;
-	FBox Box = FBox(FVector(FirstVertex.X, FirstVertex.Y, (MountainHeight + LandHeight) * (-1)), FVector(LastVertex.X, LastVertex.Y, (MountainHeight + LandHeight)));
-
-	for (int FoliageComponentIndex = 0; FoliageComponentIndex < FoliageComponents.Num(); FoliageComponentIndex++)
+	if (TerrainMesh)
 	{
-		UInstancedStaticMeshComponent* FoliageComponent = FoliageComponents[FoliageComponentIndex];
-		TArray<int> Instances = FoliageComponent->GetInstancesOverlappingBox(Box);
-
-		FFoliageInstanceData* FolData = ReplaceableFoliagePool.Find(FoliageComponent);
+		// Attempt to get a pointer to the procedural mesh section
+		FProcMeshSection* MeshSection = TerrainMesh->GetProcMeshSection(TerrainMeshSectionIndex);
+		if (!MeshSection)
+		{
+			return;
+		}
 
-		if (FolData)
+		// Tiles place their own foliage when they are committed, this is for sections drawn by hand
+		const TPair<FIntPoint, FTerrainTileRecord>* DrawnTile = nullptr;
+		for (const TPair<FIntPoint, FTerrainTileRecord>& Pair : TileRegistry.GetRecords())
 		{
-			FolData->Instances.Append(Instances);
+			if (Pair.Value.SectionIndex == TerrainMeshSectionIndex)
+			{
+				DrawnTile = &Pair;
+				break;
+			}
 		}
-		else
+		if (!DrawnTile)
 		{
-			ReplaceableFoliagePool.Add(FoliageComponent, FFoliageInstanceData(Instances));
+			return;
 		}
-	}
-}
 
-//********************//
-// Land//
-//********************//
+		TArray<FVector> Vertices;
+		Vertices.Reserve(MeshSection->ProcVertexBuffer.Num());
+		for (const FProcMeshVertex& Vertex : MeshSection->ProcVertexBuffer)
+		{
+			Vertices.Add(Vertex.Position);
+		}
 
-void AWorldGenerator::GenerateTerrainLayout()
-{
-	// Check if we are loading from a saved game
-	if (LoadingFromSave)
-	{
-		LoadTerrainLayout();
+		FTerrainFoliageInstances Foliage;
+		FTerrainFoliageInstances::Build(GetTileParams(), GetFoliageParams(), DrawnTile->Key, DrawnTile->Value.LODLevel, Vertices, Foliage);
 
+		const FIntPoint Tile = DrawnTile->Key;
+		FTerrainTileRecord Record = DrawnTile->Value;
+		SetTileFoliage(Record, Foliage);
+		SetTileRecord(Tile, Record);
 
 	}
-	else if (CustomTerrainLayout)
-	{
-		// User enters values 
-
-		PBalance;
-		MountainHeight = CustomMountainHeight;
-		LandHeight = CustomLandHeight;
-		MountainScale = CustomMountainScale;
-		LandScale = CustomLandScale;
+}
 
+FVector AWorldGenerator::GetPlayerLocation()
+{
 
-	}
-	else if (RandomiseTerrainLayout)
-	{
-		PBalance = FVector2D(FMath::FRandRange(0.f, 1000000.f), FMath::FRandRange(0.f, 1000000.f));
-		MountainHeight = MountainHeight * FMath::FRandRange(.4f, 1.5f);
-		LandHeight = LandHeight * FMath::FRandRange(.4f, 1.5f);
-		MountainScale = MountainScale * FMath::FRandRange(.6f, 2.f);
-		LandScale = LandScale * FMath::FRandRange(.8f, 2.f);
 
 
+	ACharacter* PlayerCharacter = UGameplayStatics::GetPlayerCharacter(GetWorld(), 0);
+	if (PlayerCharacter)
+	{
+		return PlayerCharacter->GetActorLocation();
 	}
-	else {
-
-		PBalance;
-		MountainHeight;
-		LandHeight;
-		MountainScale;
-		LandScale;
+	APawn* PlayerPawn = UGameplayStatics::GetPlayerPawn(GetWorld(), 0);
 
+	if (PlayerPawn)
+	{
+		return PlayerPawn->GetActorLocation();
 	}
 
+	return FVector(0, 0, 0);
+}
 
-
+FVector2D AWorldGenerator::GetTileLocation(FIntPoint TileCoordinate)
+{
+	return FVector2D(TileCoordinate * FIntPoint(XVertexCount - 1, YVertexCount - 1) * CellSize) + FVector2D(XVertexCount - 1, YVertexCount - 1) * CellSize / 2;
 }
 
-void AWorldGenerator::GenerateTerrainAsync(const int InSectionIndexX,const int InSectionIndexY, const int LODLevel)
+void AWorldGenerator::QueueTile(FIntPoint Tile, int LODLevel)
 {
-	GeneratorBusy = true;
-	SectionIndexX = InSectionIndexX;
-	SectionIndexY = InSectionIndexY;
-	CellLODLevel = FMath::Max(1, LODLevel);
+	SyncTileRegistry();
+
+	FTerrainTileRecord Record;
+	Record.LODLevel = FMath::Max(1, LODLevel);
+	const FTerrainTileRecord* Existing = TileRegistry.Find(Tile);
+	if (!Existing)
+	{
+		EntryLODLevel = Record.LODLevel;
+	}
+	else
+	{
+		// Already wanted at this LOD, or still generating and requeued once drawn
+		if (Existing->LODLevel == Record.LODLevel || Existing->State == ETerrainTileState::Generating)
+		{
+			return;
+		}
 
-	QueuedTiles.Add(FIntPoint(InSectionIndexX, InSectionIndexY),
-		FIntPoint(MeshSectionIndex, CellLODLevel));
+		Record.OutdatedSectionIndex = Existing->OutdatedSectionIndex;
+		Record.OutdatedLODLevel = Existing->OutdatedLODLevel;
+		Record.CollisionTier = Existing->CollisionTier;
+		Record.CollisionMeshIndex = Existing->CollisionMeshIndex;
+		Record.HeightfieldIndex = Existing->HeightfieldIndex;
 
-	AsyncTask(ENamedThreads::AnyBackgroundThreadNormalTask, [&]()
+		// The foliage stays up until the new LOD's replaces it, dropping the slot here would leave it showing for good
+		Record.FoliageIndex = Existing->FoliageIndex;
+		Record.FoliageBounds = Existing->FoliageBounds;
+		if (Existing->State == ETerrainTileState::Drawn)
 		{
-			auto WorldGenTask = new FAsyncTask<FAsyncWorldGenerator>(this);
-			WorldGenTask->StartBackgroundTask();
-			WorldGenTask->EnsureCompletion();
-			delete WorldGenTask;
+			Record.OutdatedSectionIndex = Existing->SectionIndex;
+			Record.OutdatedLODLevel = Existing->LODLevel;
 		}
-	);
+	}
 
+	Record.State = ETerrainTileState::Queued;
+	SetTileRecord(Tile, Record);
 }
 
-float AWorldGenerator::GetHeight(FVector2D Location)
+FIntPoint AWorldGenerator::GetClosestQueuedTile()
 {
-	float DistFromCenter = FVector2D::Distance(Location, FVector2D(0, 0));
+	SyncTileRegistry();
+	UpdateTileViewer();
+	UpdatePrefetch();
+
+	FIntPoint ClosestTile = FIntPoint::ZeroValue;
+	TileRegistry.GetClosestQueued(ClosestTile);
+	return ClosestTile;
+}
 
-	if (DistFromCenter <= FlatRadius)
+int AWorldGenerator::GetFurthestUpdateableTile()
+{
+	FIntPoint FurthestTile;
+	if (!GetFurthestReplaceableTile(FurthestTile))
 	{
-		return FlatHeight; // Inside the central flat area
+		return -1;
 	}
 
-	float ProceduralHeight = CalculateProceduralHeight(Location);
-
-	if (DistFromCenter <= TransitionEndRadius)
+	int CurrentIndex = 0;
+	for (const auto& Entry : QueuedTiles)
 	{
-		// Transition zone
-		float TransitionFactor = (DistFromCenter - FlatRadius) / TransitionWidth;
-		return FMath::Lerp(FlatHeight, ProceduralHeight, TransitionFactor);
+		if (Entry.Key == FurthestTile)
+		{
+			return CurrentIndex;
+		}
+		CurrentIndex++;
 	}
-
-	return ProceduralHeight; // Outside transition zone
+	return -1;
 }
 
-float AWorldGenerator::CalculateProceduralHeight(FVector2D Location)
+bool AWorldGenerator::GetFurthestReplaceableTile(FIntPoint& OutTile)
 {
-	return PerlinNoiseExtended(Location, 1 / MountainScale, MountainHeight, FVector2D(.1f)) +
-		PerlinNoiseExtended(Location, 1 / LandScale, LandHeight, FVector2D(.2f)) +
-		PerlinNoiseExtended(Location, .001f, 500, FVector2D(.3f)) +
-		PerlinNoiseExtended(Location, .01f, 100, FVector2D(.4f));
+	SyncTileRegistry();
+	UpdateTileViewer();
+	return TileRegistry.GetFurthestDrawn(TileReplaceableDistance + TileUnloadHysteresis, OutTile);
 }
 
-float AWorldGenerator::PerlinNoiseExtended(const FVector2D Location, const float Scale, const float Amplitude, const FVector2D offset)
+bool AWorldGenerator::GetFurthestReplaceableTile(int32 LODLevel, FIntPoint& OutTile)
 {
-	FVector2D ScaledLocation = (Location * Scale) + offset + PBalance + FVector2D(.1f, .1f);
-	return FMath::PerlinNoise2D(ScaledLocation) * Amplitude;
+	SyncTileRegistry();
+	UpdateTileViewer();
+	return TileRegistry.GetFurthestDrawn(TileReplaceableDistance + TileUnloadHysteresis, LODLevel, OutTile);
 }
 
-void FAsyncWorldGenerator::DoWork()
+void AWorldGenerator::SetTileRecord(const FIntPoint& Tile, const FTerrainTileRecord& Record)
 {
-	
-	
-	WorldGenerator->GenerateTerrain(WorldGenerator->SectionIndexX, WorldGenerator->SectionIndexY, WorldGenerator->CellLODLevel);
+	TileRegistry.Set(Tile, Record);
+	TerrainQuery.Reset();
+
+	QueuedTiles.Add(Tile, GetQueuedTilesValue(Record));
+
+	if (Record.OutdatedSectionIndex != INDEX_NONE)
+	{
+		RemoveLODQueue.Add(Tile, FIntPoint(Record.OutdatedSectionIndex, Record.OutdatedLODLevel));
+	}
+	else
+	{
+		RemoveLODQueue.Remove(Tile);
+	}
 }
 
-void AWorldGenerator::RebuildNavMesh()
+void AWorldGenerator::RemoveTileRecord(const FIntPoint& Tile)
 {
-	UNavigationSystemV1* NavSys =
-		FNavigationSystem::GetCurrent<UNavigationSystemV1>(GetWorld());
-	if (NavSys)
+	if (const FTerrainTileRecord* Existing = TileRegistry.Find(Tile))
 	{
-		NavSys->Build();
+		FTerrainTileRecord Removed = *Existing;
+		ReleaseCollisionMesh(Removed);
+		ReleaseHeightfield(Removed);
+		ReleaseTileFoliage(Removed);
 	}
 
+	TileRegistry.Remove(Tile);
+	TerrainQuery.Reset();
+	SuitabilityIndices.Remove(Tile);
+	QueuedTiles.Remove(Tile);
+	RemoveLODQueue.Remove(Tile);
 }
 
-void AWorldGenerator::GenerateTerrain(const int InSectionIndexX, const int InSectionIndexY, const int LODFactor)
+void AWorldGenerator::MarkTileGenerating(const FIntPoint& Tile, int32 LODLevel)
 {
-	int LODXVertexCount = XVertexCount / LODFactor;
-	int LODYVertexCount = YVertexCount / LODFactor;
-	float LODCellSize = CellSize * LODFactor;
+	SyncTileRegistry();
 
-	float XGap = (XVertexCount * CellSize - LODXVertexCount * LODCellSize) / LODCellSize;
-	float YGap = (YVertexCount * CellSize - LODYVertexCount * LODCellSize) / LODCellSize;
-
-	LODXVertexCount += FMath::CeilToInt(XGap) + 1;
-	LODYVertexCount += FMath::CeilToInt(YGap) + 1;
+	FTerrainTileRecord Record;
+	if (const FTerrainTileRecord* Existing = TileRegistry.Find(Tile))
+	{
+		Record = *Existing;
 
+		// Regenerating a drawn tile, its current section goes once the new one is drawn
+		if (Existing->State == ETerrainTileState::Drawn)
+		{
+			Record.OutdatedSectionIndex = Existing->SectionIndex;
+			Record.OutdatedLODLevel = Existing->LODLevel;
+		}
+	}
+	Record.State = ETerrainTileState::Generating;
+	Record.LODLevel = LODLevel;
+	Record.SectionIndex = INDEX_NONE;
+	SetTileRecord(Tile, Record);
+}
 
-	FVector Offset = FVector(InSectionIndexX * (XVertexCount - 1), InSectionIndexY * (YVertexCount - 1), 0.f) * CellSize;
+FIntPoint AWorldGenerator::GetQueuedTilesValue(const FTerrainTileRecord& Record)
+{
+	const int State = Record.State == ETerrainTileState::Drawn ? Record.SectionIndex
+		: Record.State == ETerrainTileState::Generating ? TileGenerating : -1;
+	return FIntPoint(State, Record.LODLevel);
+}
+
+bool AWorldGenerator::AreTileMirrorsCurrent() const
+{
+	if (QueuedTiles.Num() != TileRegistry.Num() || RemoveLODQueue.Num() != TileRegistry.GetNumOutdated())
+	{
+		return false;
+	}
+
+	// Same counts, a Blueprint may still have overwritten values
+	for (const TPair<FIntPoint, FIntPoint>& Entry : QueuedTiles)
+	{
+		const FTerrainTileRecord* Record = TileRegistry.Find(Entry.Key);
+		if (!Record || GetQueuedTilesValue(*Record) != Entry.Value)
+		{
+			return false;
+		}
+	}
+	for (const TPair<FIntPoint, FIntPoint>& Entry : RemoveLODQueue)
+	{
+		const FTerrainTileRecord* Record = TileRegistry.Find(Entry.Key);
+		if (!Record || Record->OutdatedSectionIndex != Entry.Value.X || Record->OutdatedLODLevel != Entry.Value.Y)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+void AWorldGenerator::SyncTileRegistry()
+{
+	// Every registry update keeps the mirrors in step, so they only differ after a Blueprint write
+	if (AreTileMirrorsCurrent())
+	{
+		return;
+	}
+
+	// Collision is not mirrored, carry it over from the records being replaced
+	TMap<FIntPoint, FTerrainTileRecord> Previous = TileRegistry.GetRecords();
+
+	// Outdated sections are only cleared when their tile is drawn again, entries without a tile would never go
+	TArray<int32> DroppedSections;
+	for (TMap<FIntPoint, FIntPoint>::TIterator It = RemoveLODQueue.CreateIterator(); It; ++It)
+	{
+		if (!QueuedTiles.Contains(It.Key()))
+		{
+			DroppedSections.Add(It.Value().X);
+			It.RemoveCurrent();
+		}
+	}
+
+	TileRegistry.Empty();
+	TerrainQuery.Reset();
+	for (const TPair<FIntPoint, FIntPoint>& Entry : QueuedTiles)
+	{
+		FTerrainTileRecord Record;
+		Record.LODLevel = Entry.Value.Y;
+		if (Entry.Value.X >= 0)
+		{
+			Record.State = ETerrainTileState::Drawn;
+			Record.SectionIndex = Entry.Value.X;
+		}
+		else
+		{
+			Record.State = Entry.Value.X == TileGenerating ? ETerrainTileState::Generating : ETerrainTileState::Queued;
+		}
+
+		if (const FIntPoint* Outdated = RemoveLODQueue.Find(Entry.Key))
+		{
+			Record.OutdatedSectionIndex = Outdated->X;
+			Record.OutdatedLODLevel = Outdated->Y;
+		}
+
+		FTerrainTileRecord PreviousRecord;
+		if (Previous.RemoveAndCopyValue(Entry.Key, PreviousRecord))
+		{
+			Record.CollisionTier = PreviousRecord.CollisionTier;
+			Record.CollisionMeshIndex = PreviousRecord.CollisionMeshIndex;
+			Record.HeightfieldIndex = PreviousRecord.HeightfieldIndex;
+			Record.FoliageIndex = PreviousRecord.FoliageIndex;
+			Record.FoliageBounds = PreviousRecord.FoliageBounds;
+
+			// Outdated entry taken out or replaced by a Blueprint
+			if (PreviousRecord.OutdatedSectionIndex != Record.OutdatedSectionIndex)
+			{
+				DroppedSections.Add(PreviousRecord.OutdatedSectionIndex);
+			}
+		}
+		TileRegistry.Set(Entry.Key, Record);
+	}
+
+	// Tiles Blueprints dropped take their collision and outdated section with them
+	for (TPair<FIntPoint, FTerrainTileRecord>& Entry : Previous)
+	{
+		SuitabilityIndices.Remove(Entry.Key);
+		ReleaseCollisionMesh(Entry.Value);
+		ReleaseHeightfield(Entry.Value);
+		ReleaseTileFoliage(Entry.Value);
+		DroppedSections.Add(Entry.Value.OutdatedSectionIndex);
+	}
+
+	// Cleared and pooled, unless a tile still shows them
+	TSet<int32> UsedSections;
+	for (const TPair<FIntPoint, FTerrainTileRecord>& Entry : TileRegistry.GetRecords())
+	{
+		UsedSections.Add(Entry.Value.SectionIndex);
+		UsedSections.Add(Entry.Value.OutdatedSectionIndex);
+	}
+	for (const int32 Section : DroppedSections)
+	{
+		if (Section != INDEX_NONE && !UsedSections.Contains(Section) && !FreeMeshSections.Contains(Section))
+		{
+			TerrainMesh->ClearMeshSection(Section);
+			FreeMeshSections.Add(Section);
+			UsedSections.Add(Section);
+		}
+	}
+}
+
+void AWorldGenerator::UpdateTileViewer()
+{
+	FVector ViewDirection = FVector::ForwardVector;
+	if (APlayerController* PlayerController = UGameplayStatics::GetPlayerController(GetWorld(), 0))
+	{
+		ViewDirection = PlayerController->GetControlRotation().Vector();
+	}
+
+	TileRegistry.ViewPriorityBias = TileViewPriorityBias;
+	TileRegistry.SetViewer(FVector2D(GetPlayerLocation()), FVector2D(ViewDirection));
+}
+
+void AWorldGenerator::UpdateCollisionTiers()
+{
+	const double Now = GetWorld()->GetTimeSeconds();
+	if (LastCollisionUpdateTime >= 0.0 && Now - LastCollisionUpdateTime < CollisionUpdateInterval)
+	{
+		return;
+	}
+	LastCollisionUpdateTime = Now;
+
+	SyncTileRegistry();
+	UpdateCollisionAnchors();
+
+	// Collected first, changing a tier rewrites the tile's record
+	TArray<TPair<FIntPoint, ETerrainCollisionTier>> Changes;
+	for (const TPair<FIntPoint, FTerrainTileRecord>& Entry : TileRegistry.GetRecords())
+	{
+		if (Entry.Value.State != ETerrainTileState::Drawn)
+		{
+			continue;
+		}
+
+		const ETerrainCollisionTier Tier = GetDesiredCollisionTier(Entry.Key, Entry.Value.CollisionTier);
+		if (Tier != Entry.Value.CollisionTier)
+		{
+			Changes.Emplace(Entry.Key, Tier);
+		}
+	}
+
+	for (const TPair<FIntPoint, ETerrainCollisionTier>& Change : Changes)
+	{
+		SetTileCollisionTier(Change.Key, Change.Value);
+	}
+}
+
+void AWorldGenerator::UpdateCollisionAnchors()
+{
+	CollisionAnchors.Reset();
+
+	// Players and NPCs alike, anything that stands on the terrain
+	for (TActorIterator<APawn> It(GetWorld()); It; ++It)
+	{
+		CollisionAnchors.Add(FVector2D(It->GetActorLocation()));
+	}
+}
+
+ETerrainCollisionTier AWorldGenerator::GetDesiredCollisionTier(const FIntPoint& Tile, ETerrainCollisionTier CurrentTier) const
+{
+	// Until a pawn exists, spawn traces can land on any tile
+	if (!UseCollisionTiers || CollisionAnchors.Num() == 0)
+	{
+		return ETerrainCollisionTier::Full;
+	}
+
+	const FVector2D TileSize = FVector2D(XVertexCount - 1, YVertexCount - 1) * CellSize;
+	const FBox2D Bounds(FVector2D(Tile) * TileSize, FVector2D(Tile + FIntPoint(1, 1)) * TileSize);
+
+	float MinDistanceSquared = MAX_flt;
+	for (const FVector2D& Anchor : CollisionAnchors)
+	{
+		MinDistanceSquared = FMath::Min(MinDistanceSquared, (float)Bounds.ComputeSquaredDistanceToPoint(Anchor));
+	}
+	const float Distance = FMath::Sqrt(MinDistanceSquared);
+
+	// A tile keeps its tier until it is a cell past the radius, so a pawn on the edge does not toggle it every update
+	const float FullRadius = FullCollisionRadius + (CurrentTier == ETerrainCollisionTier::Full ? CellSize : 0.f);
+	const float CoarseRadius = CoarseCollisionRadius + (CurrentTier != ETerrainCollisionTier::None ? CellSize : 0.f);
+	if (Distance <= FullRadius)
+	{
+		return ETerrainCollisionTier::Full;
+	}
+	return Distance <= CoarseRadius ? ETerrainCollisionTier::Coarse : ETerrainCollisionTier::None;
+}
+
+void AWorldGenerator::SetTileCollisionTier(const FIntPoint& Tile, ETerrainCollisionTier Tier, bool bSectionChanged)
+{
+	const FTerrainTileRecord* Existing = TileRegistry.Find(Tile);
+	if (!Existing || Existing->State != ETerrainTileState::Drawn)
+	{
+		return;
+	}
+	FTerrainTileRecord Record = *Existing;
+
+	// With heightfields on, they hold both tiers and no mesh collides
+	const bool bMeshCollision = Tier != ETerrainCollisionTier::None && !UseHeightfieldCollision;
+	if (bMeshCollision)
+	{
+		if (Record.CollisionMeshIndex == INDEX_NONE || Tier != Existing->CollisionTier || (bSectionChanged && Tier == ETerrainCollisionTier::Full))
+		{
+			BuildTileCollisionMesh(Tile, Tier, Record);
+		}
+	}
+	else
+	{
+		ReleaseCollisionMesh(Record);
+	}
+
+	// Full and coarse tiles always have a heightfield, it carries their navigation even when a mesh does the colliding.
+	// Coarse tiles reach as far as the navigation regions around pawns, full ones alone would leave most of them empty.
+	if (Tier != ETerrainCollisionTier::None)
+	{
+		const int32 HeightfieldLOD = Tier == ETerrainCollisionTier::Full ? Record.LODLevel : FMath::Max(CoarseCollisionLOD, Record.LODLevel);
+		const UTerrainHeightfieldComponent* Heightfield = Record.HeightfieldIndex != INDEX_NONE ? HeightfieldComponents[Record.HeightfieldIndex] : nullptr;
+		if (!Heightfield || Heightfield->LODLevel != HeightfieldLOD || Tier != Existing->CollisionTier
+			|| (bSectionChanged && Tier == ETerrainCollisionTier::Full))
+		{
+			BuildTileHeightfield(Tile, Tier, HeightfieldLOD, Record);
+		}
+	}
+	else
+	{
+		ReleaseHeightfield(Record);
+	}
+
+	if (Record.CollisionTier != Tier || Record.CollisionMeshIndex != Existing->CollisionMeshIndex || Record.HeightfieldIndex != Existing->HeightfieldIndex)
+	{
+		Record.CollisionTier = Tier;
+		SetTileRecord(Tile, Record);
+	}
+}
+
+void AWorldGenerator::BuildTileHeightfield(const FIntPoint& Tile, ETerrainCollisionTier Tier, int32 LODLevel, FTerrainTileRecord& Record)
+{
+	const FTerrainTileParams Params = GetTileParams();
+
+	// Full collision follows the drawn section exactly, coarse collision is generated at its own LOD
+	TArray<FVector> Vertices;
+	const FProcMeshSection* Section = TerrainMesh->GetProcMeshSection(Record.SectionIndex);
+	if (Tier == ETerrainCollisionTier::Full && Section)
+	{
+		Vertices.Reserve(Section->ProcVertexBuffer.Num());
+		for (const FProcMeshVertex& Vertex : Section->ProcVertexBuffer)
+		{
+			Vertices.Add(Vertex.Position);
+		}
+	}
+	else
+	{
+		FTerrainTileData CoarseTile;
+		CoarseTile.Tile = Tile;
+		CoarseTile.LODLevel = LODLevel;
+		GenerateTerrainTile(Params, CoarseTile);
+		Vertices = MoveTemp(CoarseTile.Vertices);
+	}
+
+	if (Record.HeightfieldIndex == INDEX_NONE)
+	{
+		if (FreeHeightfields.Num() > 0)
+		{
+			Record.HeightfieldIndex = FreeHeightfields.Pop();
+		}
+		else
+		{
+			UTerrainHeightfieldComponent* NewHeightfield = NewObject<UTerrainHeightfieldComponent>(this);
+			NewHeightfield->SetupAttachment(TerrainMesh);
+			NewHeightfield->RegisterComponent();
+			Record.HeightfieldIndex = HeightfieldComponents.Add(NewHeightfield);
+		}
+	}
+
+	UTerrainHeightfieldComponent* Heightfield = HeightfieldComponents[Record.HeightfieldIndex];
+
+	// Out of navigation while it moves, UpdateNavTiles adds it back so only its new area is rebuilt, at a capped rate
+	Heightfield->SetCanEverAffectNavigation(false);
+	Heightfield->SetCollisionEnabled(UseHeightfieldCollision ? ECollisionEnabled::QueryAndPhysics : ECollisionEnabled::NoCollision);
+	Heightfield->LODLevel = LODLevel;
+	Heightfield->SetHeights(Params.GetLODVertexCount(LODLevel), CellSize * LODLevel, Vertices,
+		TerrainMaterial ? TerrainMaterial->GetPhysicalMaterial() : nullptr);
+
+	PendingNavTiles.Add(Record.HeightfieldIndex);
+}
+
+void AWorldGenerator::ReleaseHeightfield(FTerrainTileRecord& Record)
+{
+	if (Record.HeightfieldIndex == INDEX_NONE)
+	{
+		return;
+	}
+
+	// Removing a tile from navigation only marks its area dirty, so it is not deferred like adding one
+	UTerrainHeightfieldComponent* Heightfield = HeightfieldComponents[Record.HeightfieldIndex];
+	Heightfield->SetCanEverAffectNavigation(false);
+	Heightfield->ClearHeights();
+	PendingNavTiles.Remove(Record.HeightfieldIndex);
+	FreeHeightfields.Add(Record.HeightfieldIndex);
+	Record.HeightfieldIndex = INDEX_NONE;
+}
+
+void AWorldGenerator::BuildTileCollisionMesh(const FIntPoint& Tile, ETerrainCollisionTier Tier, FTerrainTileRecord& Record)
+{
+	// Full collision copies the drawn section, coarse collision is a few dozen vertices generated here
+	TArray<FVector> Vertices;
+	TArray<int32> Triangles;
+	const FProcMeshSection* Section = TerrainMesh->GetProcMeshSection(Record.SectionIndex);
+	if (Tier == ETerrainCollisionTier::Full && Section)
+	{
+		Vertices.Reserve(Section->ProcVertexBuffer.Num());
+		for (const FProcMeshVertex& Vertex : Section->ProcVertexBuffer)
+		{
+			Vertices.Add(Vertex.Position);
+		}
+		Triangles.Reserve(Section->ProcIndexBuffer.Num());
+		for (const uint32 Index : Section->ProcIndexBuffer)
+		{
+			Triangles.Add(Index);
+		}
+	}
+	else
+	{
+		FTerrainTileData CoarseTile;
+		CoarseTile.Tile = Tile;
+		CoarseTile.LODLevel = FMath::Max(CoarseCollisionLOD, Record.LODLevel);
+		GenerateTerrainTile(GetTileParams(), CoarseTile);
+		Vertices = MoveTemp(CoarseTile.Vertices);
+		Triangles = *CoarseTile.Triangles;
+	}
+
+	if (Record.CollisionMeshIndex == INDEX_NONE)
+	{
+		if (FreeCollisionMeshes.Num() > 0)
+		{
+			Record.CollisionMeshIndex = FreeCollisionMeshes.Pop();
+		}
+		else
+		{
+			// Collision only, never drawn and left out of navigation
+			UProceduralMeshComponent* NewCollisionMesh = NewObject<UProceduralMeshComponent>(this);
+			NewCollisionMesh->bUseAsyncCooking = true;
+			NewCollisionMesh->SetupAttachment(TerrainMesh);
+			NewCollisionMesh->SetVisibility(false);
+			NewCollisionMesh->SetCanEverAffectNavigation(false);
+			NewCollisionMesh->RegisterComponent();
+			Record.CollisionMeshIndex = CollisionMeshes.Add(NewCollisionMesh);
+		}
+	}
+
+	// One section per component, so changing this tile's tier only re-cooks this tile
+	CollisionMeshes[Record.CollisionMeshIndex]->CreateMeshSection(0, Vertices, Triangles,
+		TArray<FVector>(), TArray<FVector2D>(), TArray<FColor>(), TArray<FProcMeshTangent>(), true);
+}
+
+void AWorldGenerator::ReleaseCollisionMesh(FTerrainTileRecord& Record)
+{
+	if (Record.CollisionMeshIndex == INDEX_NONE)
+	{
+		return;
+	}
+
+	CollisionMeshes[Record.CollisionMeshIndex]->ClearAllMeshSections();
+	FreeCollisionMeshes.Add(Record.CollisionMeshIndex);
+	Record.CollisionMeshIndex = INDEX_NONE;
+}
+
+void AWorldGenerator::UpdateNavTiles()
+{
+	int32 Budget = MaxNavTileUpdatesPerFrame;
+	for (TSet<int32>::TIterator It = PendingNavTiles.CreateIterator(); It && Budget > 0; ++It)
+	{
+		// Registers the tile's heightfield with navigation, dirtying the nav tiles under it
+		HeightfieldComponents[*It]->SetCanEverAffectNavigation(true);
+		It.RemoveCurrent();
+		Budget--;
+	}
+}
+
+void AWorldGenerator::UpdateNavRegions()
+{
+	if (!UseNavRegions)
+	{
+		return;
+	}
+
+	// Pawns by distance from the player, so the player's region is never the one capped
+	const FVector PlayerLocation = GetPlayerLocation();
+	TArray<APawn*> Pawns;
+	for (TActorIterator<APawn> It(GetWorld()); It; ++It)
+	{
+		Pawns.Add(*It);
+	}
+	Pawns.Sort([&PlayerLocation](const APawn& A, const APawn& B)
+		{
+			return FVector::DistSquared2D(A.GetActorLocation(), PlayerLocation) < FVector::DistSquared2D(B.GetActorLocation(), PlayerLocation);
+		}
+	);
+
+	const FVector2D TileSize = FVector2D(XVertexCount - 1, YVertexCount - 1) * CellSize;
+	TArray<FIntPoint> RegionTiles;
+	for (const APawn* Pawn : Pawns)
+	{
+		if (RegionTiles.Num() >= MaxNavRegions)
+		{
+			break;
+		}
+		const FVector Location = Pawn->GetActorLocation();
+		RegionTiles.AddUnique(FIntPoint(FMath::FloorToInt(Location.X / TileSize.X), FMath::FloorToInt(Location.Y / TileSize.Y)));
+	}
+
+	// Nothing changes until a pawn crosses a tile boundary
+	TArray<FIntPoint> StaleTiles;
+	for (const TPair<FIntPoint, AActor*>& Region : NavRegionAnchors)
+	{
+		if (!RegionTiles.Contains(Region.Key))
+		{
+			StaleTiles.Add(Region.Key);
+		}
+	}
+
+	for (const FIntPoint& Tile : RegionTiles)
+	{
+		if (NavRegionAnchors.Contains(Tile))
+		{
+			continue;
+		}
+
+		// Moving a region's anchor lets the navmesh keep the tiles the old and new squares share
+		AActor* Anchor = nullptr;
+		if (StaleTiles.Num() > 0)
+		{
+			NavRegionAnchors.RemoveAndCopyValue(StaleTiles.Pop(), Anchor);
+		}
+		if (!Anchor)
+		{
+			Anchor = SpawnNavRegionAnchor();
+		}
+
+		const FVector2D Centre = (FVector2D(Tile) + FVector2D(.5f, .5f)) * TileSize;
+		Anchor->SetActorLocation(FVector(Centre, GetHeight(Centre)));
+		NavRegionAnchors.Add(Tile, Anchor);
+	}
+
+	for (const FIntPoint& Tile : StaleTiles)
+	{
+		AActor* Anchor = nullptr;
+		NavRegionAnchors.RemoveAndCopyValue(Tile, Anchor);
+		if (Anchor)
+		{
+			UNavigationSystemV1::UnregisterNavigationInvoker(Anchor);
+			Anchor->Destroy();
+		}
+	}
+}
+
+AActor* AWorldGenerator::SpawnNavRegionAnchor()
+{
+	FActorSpawnParameters SpawnParams;
+	SpawnParams.Owner = this;
+	AActor* Anchor = GetWorld()->SpawnActor<AActor>(AActor::StaticClass(), FTransform::Identity, SpawnParams);
+
+	USceneComponent* AnchorRoot = NewObject<USceneComponent>(Anchor, TEXT("Root"));
+	Anchor->SetRootComponent(AnchorRoot);
+	AnchorRoot->RegisterComponent();
+
+	// Invoker radii reach the corners of the square of tiles, nav tiles further than the keep radius are dropped
+	const float TileSize = FMath::Max(XVertexCount - 1, YVertexCount - 1) * CellSize;
+	const float GenerationRadius = (NavRegionRadiusTiles + .5f) * TileSize * UE_SQRT_2;
+	const float RemovalRadius = FMath::Max(GenerationRadius, (NavRegionKeepTiles + .5f) * TileSize * UE_SQRT_2);
+	UNavigationSystemV1::RegisterNavigationInvoker(Anchor, GenerationRadius, RemovalRadius);
+	return Anchor;
+}
+
+void AWorldGenerator::SetupNavBounds()
+{
+	if (!NavMeshBoundsVolume)
+	{
+		for (TActorIterator<ANavMeshBoundsVolume> It(GetWorld()); It; ++It)
+		{
+			NavMeshBoundsVolume = *It;
+			break;
+		}
+	}
+
+	UNavigationSystemV1* NavSys = FNavigationSystem::GetCurrent<UNavigationSystemV1>(GetWorld());
+	if (!UseNavRegions || !NavMeshBoundsVolume || !NavSys)
+	{
+		return;
+	}
+
+	// One fixed volume over the whole terrain, only the regions around pawns are ever built inside it
+	const FVector Extent = NavMeshBoundsVolume->GetComponentsBoundingBox(true).GetExtent();
+	const float HeightExtent = (MountainHeight + LandHeight) * 2.f;
+	if (Extent.X > 0.f && Extent.Y > 0.f && Extent.Z > 0.f)
+	{
+		NavMeshBoundsVolume->GetRootComponent()->SetMobility(EComponentMobility::Movable);
+		NavMeshBoundsVolume->SetActorLocation(GetActorLocation());
+		NavMeshBoundsVolume->SetActorScale3D(NavMeshBoundsVolume->GetActorScale3D() * FVector(NavBoundsExtent / Extent.X, NavBoundsExtent / Extent.Y, HeightExtent / Extent.Z));
+		NavSys->OnNavigationBoundsUpdated(NavMeshBoundsVolume);
+	}
+}
+
+bool AWorldGenerator::IsTerrainComponent(const UPrimitiveComponent* Component) const
+{
+	return Component && ((Component->IsA<UProceduralMeshComponent>() && Component->GetOwner() == this) || Component->IsA<UTerrainHeightfieldComponent>());
+}
+
+void AWorldGenerator::RemoveFoliageTileCpp(const int TileIndex)
+{
+	// Tiles release their own foliage when their record goes, this is for Blueprints holding a section index
+	for (const TPair<FIntPoint, FTerrainTileRecord>& Pair : TileRegistry.GetRecords())
+	{
+		if (Pair.Value.SectionIndex == TileIndex)
+		{
+			const FIntPoint Tile = Pair.Key;
+			FTerrainTileRecord Record = Pair.Value;
+			ReleaseTileFoliage(Record);
+			SetTileRecord(Tile, Record);
+			return;
+		}
+	}
+}
+
+//********************//
+// Land//
+//********************//
+
+void AWorldGenerator::GenerateTerrainLayout()
+{
+	// Check if we are loading from a saved game
+	if (LoadingFromSave)
+	{
+		LoadTerrainLayout();
+
+
+	}
+	else if (CustomTerrainLayout)
+	{
+		// User enters values 
+
+		PBalance;
+		MountainHeight = CustomMountainHeight;
+		LandHeight = CustomLandHeight;
+		MountainScale = CustomMountainScale;
+		LandScale = CustomLandScale;
+
+
+	}
+	else if (RandomiseTerrainLayout)
+	{
+		PBalance = FVector2D(FMath::FRandRange(0.f, 1000000.f), FMath::FRandRange(0.f, 1000000.f));
+		MountainHeight = MountainHeight * FMath::FRandRange(.4f, 1.5f);
+		LandHeight = LandHeight * FMath::FRandRange(.4f, 1.5f);
+		MountainScale = MountainScale * FMath::FRandRange(.6f, 2.f);
+		LandScale = LandScale * FMath::FRandRange(.8f, 2.f);
+
+
+	}
+	else {
+
+		PBalance;
+		MountainHeight;
+		LandHeight;
+		MountainScale;
+		LandScale;
+
+	}
+
+
+
+}
+
+void AWorldGenerator::GenerateTerrainAsync(const int InSectionIndexX,const int InSectionIndexY, const int LODLevel)
+{
+	const FTerrainTileParams Params = GetTileParams();
+
+	FTerrainTileDataRef Tile = MakeShared<FTerrainTileData, ESPMode::ThreadSafe>();
+	Tile->Tile = FIntPoint(InSectionIndexX, InSectionIndexY);
+	Tile->LODLevel = FMath::Max(1, LODLevel);
+	Tile->ParamsHash = Params.GetHash();
+
+	if (!TileRegistry.Find(Tile->Tile))
+	{
+		EntryLODLevel = Tile->LODLevel;
+	}
+
+	// Mark the tile as in flight so it is neither generated twice nor picked for replacement
+	MarkTileGenerating(Tile->Tile, Tile->LODLevel);
+
+	// Already being prefetched, the job delivers the tile when it finishes
+	const FTerrainTileCacheKey CacheKey{ Tile->Tile, Tile->LODLevel, Tile->ParamsHash };
+	if (bool* bClaimed = PrefetchJobs.Find(CacheKey))
+	{
+		*bClaimed = true;
+		PrefetchStats.Hits++;
+		TilesInFlight++;
+		GeneratorBusy = TilesInFlight >= MaxConcurrentTiles;
+		return;
+	}
+
+	// Revisited or prefetched tile, rebuild it from the cache instead of generating it again
+	if (FCompressedTerrainTilePtr CachedTile = TileCache.Find(CacheKey))
+	{
+		if (PrefetchedTiles.Remove(CacheKey) > 0)
+		{
+			PrefetchStats.Hits++;
+		}
+
+		CachedTile->Decompress(Params, *Tile);
+
+		AddCompletedTile(Tile);
+		return;
+	}
+
+	// Generated in an earlier session, read it back from disk
+	if (TileStore && TileStore->Load(Params, Tile->ParamsHash, Tile->Tile, Tile->LODLevel, *Tile))
+	{
+		AddCompletedTile(Tile);
+		return;
+	}
+
+	TilesInFlight++;
+	GeneratorBusy = TilesInFlight >= MaxConcurrentTiles;
+
+	StartTileJob(Params, Tile);
+}
+
+void AWorldGenerator::StartTileJob(const FTerrainTileParams& Params, const FTerrainTileDataRef& Tile)
+{
+	(new FAutoDeleteAsyncTask<FAsyncWorldGenerator>(this, Params, GetSuitabilityParams(), GetFoliageParams(), Tile))->StartBackgroundTask();
+}
+
+FTerrainFoliageParams AWorldGenerator::GetFoliageParams() const
+{
+	FTerrainFoliageParams Params;
+	for (const UFoliageType_InstancedStaticMesh* FoliageType : FoliageTypes)
+	{
+		Params.Types.Add(FTerrainFoliageTypeParams::Make(FoliageType));
+	}
+	for (int32 FoliageTypeIndex = 0; FoliageTypeIndex < Params.Types.Num(); FoliageTypeIndex++)
+	{
+		Params.Types[FoliageTypeIndex].MiddleDensity = UseFoliageTiers ? GetFoliageTierSettings(FoliageTypeIndex).MiddleDensity : 1.f;
+	}
+	Params.Seed = InitialSeed;
+	Params.bPoissonDisk = UsePoissonFoliage;
+	Params.GrowthProbabilityPercentage = GrowthProbabilityPercentage;
+	Params.InstanceOffset = InstanceOffset;
+	Params.InstanceOffsetVariation = InstanceOffsetVariation;
+	Params.GroundSlopeAngle = FFloatInterval(GroundSlopeAngleMin, GroundSlopeAngleMax);
+	Params.Offset = GetActorLocation();
+	return Params;
+}
+
+void AWorldGenerator::OnTileGenerated(const FTerrainTileDataRef& Tile, const FCompressedTerrainTileRef& CompressedTile)
+{
+	const FTerrainTileCacheKey CacheKey{ Tile->Tile, Tile->LODLevel, Tile->ParamsHash };
+
+	// Prefetched tiles only go to the cache, unless the tile queue asked for them meanwhile
+	bool bClaimed = true;
+	const bool bPrefetched = PrefetchJobs.RemoveAndCopyValue(CacheKey, bClaimed);
+	if (bPrefetched && !bClaimed)
+	{
+		PrefetchedTiles.Add(CacheKey);
+	}
+
+	if (bClaimed)
+	{
+		TilesInFlight--;
+		GeneratorBusy = TilesInFlight >= MaxConcurrentTiles;
+	}
+
+	TileCache.Add(CacheKey, CompressedTile);
+
+	if (TileStore)
+	{
+		TileStore->Save(Tile->ParamsHash, CompressedTile);
+		// Written on a worker, EndPlay waits for whatever is still queued
+		if (TileStore->GetNumPendingWrites() >= TileStoreWriteBatch)
+		{
+			TileStore->FlushAsync();
+		}
+	}
 
-	TArray<FVector> Vertices;
+	if (bClaimed)
+	{
+		AddCompletedTile(Tile);
+	}
+
+	UpdatePrefetch();
+}
+
+void AWorldGenerator::OnFoliageGenerated(const FTerrainTileDataRef& Tile)
+{
+	TilesInFlight--;
+	GeneratorBusy = TilesInFlight >= MaxConcurrentTiles;
+	AddCompletedTile(Tile);
+}
+
+FTerrainTileCacheStats AWorldGenerator::GetTileCacheStats() const
+{
+	return TileCache.GetStats();
+}
+
+FTerrainPrefetchStats AWorldGenerator::GetPrefetchStats() const
+{
+	FTerrainPrefetchStats Stats = PrefetchStats;
+	Stats.Pending = PrefetchJobs.Num() + PrefetchedTiles.Num();
+	Stats.HitRate = Stats.Hits + Stats.Wasted > 0 ? float(Stats.Hits) / float(Stats.Hits + Stats.Wasted) : 0.f;
+	return Stats;
+}
+
+void AWorldGenerator::UpdatePrefetch()
+{
+	if (!EnablePrefetch || !GetWorld())
+	{
+		return;
+	}
+
+	const double Now = GetWorld()->GetTimeSeconds();
+	if (Now - LastPrefetchTime < .1)
+	{
+		return;
+	}
+	LastPrefetchTime = Now;
+
+	APawn* PlayerPawn = UGameplayStatics::GetPlayerPawn(GetWorld(), 0);
+	if (!PlayerPawn)
+	{
+		return;
+	}
+
+	const FVector2D PlayerLocation(GetPlayerLocation());
+	const FVector2D Velocity(PlayerPawn->GetVelocity());
+	const float Speed = Velocity.Size();
+	const FVector2D TileSize = FVector2D(XVertexCount - 1, YVertexCount - 1) * CellSize;
+	const float Reach = TileReplaceableDistance + TileUnloadHysteresis + FMath::Max(Speed, PrefetchMinSpeed) * PrefetchLookaheadSeconds;
+
+	// Give up on prefetched tiles the player has left behind
+	for (TSet<FTerrainTileCacheKey>::TIterator It = PrefetchedTiles.CreateIterator(); It; ++It)
+	{
+		const FVector2D Centre = (FVector2D(It->Tile) + FVector2D(.5f, .5f)) * TileSize;
+		if (FVector2D::Distance(Centre, PlayerLocation) > Reach || !TileCache.Contains(*It))
+		{
+			PrefetchStats.Wasted++;
+			It.RemoveCurrent();
+		}
+	}
+
+	// Only spare generator slots, tiles the queue is waiting for always come first
+	FIntPoint QueuedTile;
+	if (Speed < PrefetchMinSpeed || TileRegistry.GetClosestQueued(QueuedTile))
+	{
+		return;
+	}
+
+	// Head along the velocity, bent towards where the camera looks
+	FVector2D Direction = Velocity / Speed;
+	if (APlayerController* PlayerController = UGameplayStatics::GetPlayerController(GetWorld(), 0))
+	{
+		const FVector2D ViewDirection = FVector2D(PlayerController->GetControlRotation().Vector()).GetSafeNormal();
+		if (!ViewDirection.IsNearlyZero())
+		{
+			Direction = FMath::Lerp(Direction, ViewDirection, FMath::Clamp(PrefetchViewWeight, 0.f, 1.f)).GetSafeNormal();
+		}
+	}
+	if (Direction.IsNearlyZero())
+	{
+		return;
+	}
+
+	// Tiles ahead are first asked for as they come into range, at the LOD the last tile to do so was asked for
+	int32 LODLevel = PrefetchLODLevel >= 1 ? PrefetchLODLevel : EntryLODLevel;
+	FIntPoint FurthestTile;
+	if (LODLevel < 1)
+	{
+		const FTerrainTileRecord* Furthest = TileRegistry.GetFurthestDrawn(-1.f, FurthestTile) ? TileRegistry.Find(FurthestTile) : nullptr;
+		LODLevel = Furthest ? Furthest->LODLevel : 1;
+	}
+
+	// Claimed jobs already count in TilesInFlight, only the speculative ones count against the prefetch budget
+	int32 NumSpeculative = 0;
+	for (const TPair<FTerrainTileCacheKey, bool>& Job : PrefetchJobs)
+	{
+		NumSpeculative += Job.Value ? 0 : 1;
+	}
+
+	const FTerrainTileParams Params = GetTileParams();
+	const uint32 ParamsHash = Params.GetHash();
+	const FVector2D Side(-Direction.Y, Direction.X);
+	const float Step = FMath::Min(TileSize.X, TileSize.Y) / 2;
+
+	// Walk the predicted path out to the edge of the lookahead, taking the tile under it and its neighbours to each side
+	for (float Travelled = Step; Travelled <= Reach; Travelled += Step)
+	{
+		for (float Offset : { 0.f, 1.f, -1.f })
+		{
+			if (NumSpeculative >= MaxPrefetchTiles || TilesInFlight + NumSpeculative >= MaxConcurrentTiles)
+			{
+				return;
+			}
+
+			const FVector2D Predicted = PlayerLocation + Direction * Travelled + Side * Offset * Step * 2;
+			const FIntPoint Tile(FMath::FloorToInt(Predicted.X / TileSize.X), FMath::FloorToInt(Predicted.Y / TileSize.Y));
+			const FTerrainTileCacheKey CacheKey{ Tile, LODLevel, ParamsHash };
+			// Stored tiles are read when they are requested, generating them again would only warm the cache
+			if (TileRegistry.Find(Tile) || PrefetchJobs.Contains(CacheKey) || TileCache.Contains(CacheKey)
+				|| (TileStore && TileStore->Contains(Params, ParamsHash, Tile, LODLevel)))
+			{
+				continue;
+			}
+
+			FTerrainTileDataRef PrefetchTile = MakeShared<FTerrainTileData, ESPMode::ThreadSafe>();
+			PrefetchTile->Tile = Tile;
+			PrefetchTile->LODLevel = LODLevel;
+			PrefetchTile->ParamsHash = ParamsHash;
+
+			PrefetchJobs.Add(CacheKey, false);
+			NumSpeculative++;
+			PrefetchStats.Issued++;
+			StartTileJob(Params, PrefetchTile);
+		}
+	}
+}
+
+FTerrainTileParams AWorldGenerator::GetTileParams() const
+{
+	FTerrainTileParams Params;
+	Params.Noise = GetNoiseParams();
+	Params.XVertexCount = XVertexCount;
+	Params.YVertexCount = YVertexCount;
+	Params.CellSize = CellSize;
+	return Params;
+}
+
+float AWorldGenerator::GetHeight(FVector2D Location)
+{
+	return FTerrainHeightKernel::GetHeight(GetNoiseParams(), Location);
+}
+
+float AWorldGenerator::CalculateProceduralHeight(FVector2D Location)
+{
+	return FTerrainHeightKernel::GetProceduralHeight(GetNoiseParams(), Location);
+}
+
+FTerrainQueryRef AWorldGenerator::GetTerrainQuery()
+{
+	const FTerrainTileParams Params = GetTileParams();
+	if (!TerrainQuery.IsValid() || TerrainQuery->GetParams().GetHash() != Params.GetHash())
+	{
+		// LOD each tile is shown at, the outdated section's while its new LOD is on the way
+		TMap<FIntPoint, int32> TileLODs;
+		for (const TPair<FIntPoint, FTerrainTileRecord>& Pair : TileRegistry.GetRecords())
+		{
+			const FTerrainTileRecord& Record = Pair.Value;
+			if (Record.State == ETerrainTileState::Drawn)
+			{
+				TileLODs.Add(Pair.Key, Record.LODLevel);
+			}
+			else if (Record.OutdatedSectionIndex != INDEX_NONE)
+			{
+				TileLODs.Add(Pair.Key, Record.OutdatedLODLevel);
+			}
+		}
+		TerrainQuery = MakeShared<const FTerrainQuery, ESPMode::ThreadSafe>(Params, MoveTemp(TileLODs));
+	}
+	return TerrainQuery.ToSharedRef();
+}
+
+void AWorldGenerator::QueryTerrain(const TArray<FVector2D>& Locations, TArray<FTerrainSurfaceSample>& OutSamples)
+{
+	GetTerrainQuery()->Sample(Locations, OutSamples);
+}
+
+FTerrainSurfaceSample AWorldGenerator::QueryTerrainAt(FVector2D Location)
+{
+	return GetTerrainQuery()->Sample(Location);
+}
+
+UPhysicalMaterial* AWorldGenerator::GetTerrainPhysicalMaterial() const
+{
+	return TerrainMaterial ? TerrainMaterial->GetPhysicalMaterial() : nullptr;
+}
+
+FTerrainNoiseParams AWorldGenerator::GetNoiseParams() const
+{
+	FTerrainNoiseParams Params;
+	Params.PBalance = PBalance;
+	Params.MountainHeight = MountainHeight;
+	Params.LandHeight = LandHeight;
+	Params.MountainScale = MountainScale;
+	Params.LandScale = LandScale;
+	Params.FlatRadius = FlatRadius;
+	Params.FlatHeight = FlatHeight;
+	Params.TransitionWidth = TransitionWidth;
+	return Params;
+}
+
+float AWorldGenerator::PerlinNoiseExtended(const FVector2D Location, const float Scale, const float Amplitude, const FVector2D offset)
+{
+	FVector2D ScaledLocation = (Location * Scale) + offset + PBalance + FVector2D(.1f, .1f);
+	return FMath::PerlinNoise2D(ScaledLocation) * Amplitude;
+}
+
+void FAsyncWorldGenerator::DoWork()
+{
+	AWorldGenerator::GenerateTerrainTile(Params, *Tile);
+
+	TSharedRef<FTerrainSuitabilityIndex, ESPMode::ThreadSafe> Suitability = MakeShared<FTerrainSuitabilityIndex, ESPMode::ThreadSafe>();
+	FTerrainSuitabilityIndex::Build(Params, SuitabilityParams, Tile->Tile, *Suitability);
+	Tile->Suitability = Suitability;
+
+	// Foliage is placed here too, the game thread only adds the finished transforms
+	TSharedRef<FTerrainFoliageInstances, ESPMode::ThreadSafe> Foliage = MakeShared<FTerrainFoliageInstances, ESPMode::ThreadSafe>();
+	FTerrainFoliageInstances::Build(Params, FoliageParams, Tile->Tile, Tile->LODLevel, Tile->Vertices, *Foliage);
+	Tile->Foliage = Foliage;
+
+	// Compact copy for the tile cache, built here so the game thread only has to store it
+	TSharedRef<FCompressedTerrainTile, ESPMode::ThreadSafe> CompressedTile = MakeShared<FCompressedTerrainTile, ESPMode::ThreadSafe>();
+	FCompressedTerrainTile::Compress(*Tile, *CompressedTile);
+
+	// Hand the finished buffers back to the game thread for commit
+	TWeakObjectPtr<AWorldGenerator> Owner = WorldGenerator;
+	FTerrainTileDataRef FinishedTile = Tile;
+	AsyncTask(ENamedThreads::GameThread, [Owner, FinishedTile, CompressedTile]()
+		{
+			if (AWorldGenerator* Generator = Owner.Get())
+			{
+				Generator->OnTileGenerated(FinishedTile, CompressedTile);
+			}
+		}
+	);
+}
+
+void FAsyncFoliageGenerator::DoWork()
+{
+	TSharedRef<FTerrainFoliageInstances, ESPMode::ThreadSafe> Foliage = MakeShared<FTerrainFoliageInstances, ESPMode::ThreadSafe>();
+	FTerrainFoliageInstances::Build(Params, FoliageParams, Tile->Tile, Tile->LODLevel, Tile->Vertices, *Foliage);
+	Tile->Foliage = Foliage;
+
+	TWeakObjectPtr<AWorldGenerator> Owner = WorldGenerator;
+	FTerrainTileDataRef FinishedTile = Tile;
+	AsyncTask(ENamedThreads::GameThread, [Owner, FinishedTile]()
+		{
+			if (AWorldGenerator* Generator = Owner.Get())
+			{
+				Generator->OnFoliageGenerated(FinishedTile);
+			}
+		}
+	);
+}
 
+void AWorldGenerator::RebuildNavMesh()
+{
+	// Full build of everything, terrain tiles keep navigation up to date on their own
+	UNavigationSystemV1* NavSys =
+		FNavigationSystem::GetCurrent<UNavigationSystemV1>(GetWorld());
+	if (NavSys)
+	{
+		NavSys->Build();
+	}
+
+}
+
+void AWorldGenerator::GenerateTerrain(const int InSectionIndexX, const int InSectionIndexY, const int LODFactor)
+{
+	FTerrainTileDataRef Tile = MakeShared<FTerrainTileData, ESPMode::ThreadSafe>();
+	Tile->Tile = FIntPoint(InSectionIndexX, InSectionIndexY);
+	Tile->LODLevel = FMath::Max(1, LODFactor);
+
+	const FTerrainTileParams Params = GetTileParams();
+	Tile->ParamsHash = Params.GetHash();
+	GenerateTerrainTile(Params, *Tile);
+
+	// Placed here as well, so the tile is ready for DrawTile as soon as this returns
+	TSharedRef<FTerrainFoliageInstances, ESPMode::ThreadSafe> Foliage = MakeShared<FTerrainFoliageInstances, ESPMode::ThreadSafe>();
+	FTerrainFoliageInstances::Build(Params, GetFoliageParams(), Tile->Tile, Tile->LODLevel, Tile->Vertices, *Foliage);
+	Tile->Foliage = Foliage;
+
+	MarkTileGenerating(Tile->Tile, Tile->LODLevel);
+	AddCompletedTile(Tile);
+}
+
+void AWorldGenerator::GenerateTerrainTile(const FTerrainTileParams& Params, FTerrainTileData& OutTile)
+{
+	const int LODFactor = OutTile.LODLevel;
+
+	const FIntPoint LODVertexCount = Params.GetLODVertexCount(LODFactor);
+	const int LODXVertexCount = LODVertexCount.X;
+	const int LODYVertexCount = LODVertexCount.Y;
+	float LODCellSize = Params.CellSize * LODFactor;
 
-	TArray<FVector2D> UVs;
-	FVector2D UV;
+	const FVector2D Offset = Params.GetTileOrigin(OutTile.Tile);
 
-	TArray<FVector> Normals;
-	TArray<FProcMeshTangent> Tangents;
+	// Heights with a one sample apron, so normals on the tile border see the neighbouring tiles
+	const int32 GridXCount = LODXVertexCount + 2;
+	TArray<float> Heights;
+	Heights.SetNumUninitialized(GridXCount * (LODYVertexCount + 2));
+	FTerrainHeightKernel::Get().GetHeightGrid(Params.Noise, Offset, LODCellSize, -1, -1, GridXCount, LODYVertexCount + 2, Heights.GetData());
 
-	//Vertices and UVs
-	for (int32 iVY = -1; iVY <= LODYVertexCount; iVY++)
+	const int32 NumVertices = LODXVertexCount * LODYVertexCount;
+	OutTile.Vertices.Reset(NumVertices);
+	OutTile.UVs.Reset(NumVertices);
+	OutTile.Normals.Reset(NumVertices);
+	OutTile.Tangents.Reset(NumVertices);
+
+	// Central differences over two cells
+	const float SlopeScale = 1.f / (2.f * LODCellSize);
+
+	//Vertices, UVs, normals and tangents
+	for (int32 iVY = 0; iVY < LODYVertexCount; iVY++)
 	{
-		for (int32 iVX = -1; iVX <= LODXVertexCount; iVX++)
+		for (int32 iVX = 0; iVX < LODXVertexCount; iVX++)
 		{
+			// Apron sample (iVX, iVY) sits at (iVX + 1, iVY + 1) in the height grid
+			const int32 HeightIndex = (iVY + 1) * GridXCount + iVX + 1;
+
 			// Vertex calculation
 			FVector2D CurrentLocation(iVX * LODCellSize + Offset.X, iVY * LODCellSize + Offset.Y);
-			float Z = GetHeight(CurrentLocation);
-			FVector Vertex(CurrentLocation.X, CurrentLocation.Y, Z);
-			Vertices.Add(Vertex);
+			float Z = Heights[HeightIndex];
+			OutTile.Vertices.Add(FVector(CurrentLocation.X, CurrentLocation.Y, Z));
 
 			//UV
-			UV.X = (iVX + (InSectionIndexX * (LODXVertexCount - 1))) * LODCellSize / 100;
-			UV.Y = (iVY + (InSectionIndexY * (LODYVertexCount - 1))) * LODCellSize / 100;
-			UVs.Add(UV);
+			OutTile.UVs.Add(Params.GetVertexUV(OutTile.Tile, LODFactor, iVX, iVY));
+
+			// Normal and tangent from the height gradient. The tangent follows U, which runs along X.
+			const float SlopeX = (Heights[HeightIndex + 1] - Heights[HeightIndex - 1]) * SlopeScale;
+			const float SlopeY = (Heights[HeightIndex + GridXCount] - Heights[HeightIndex - GridXCount]) * SlopeScale;
+			OutTile.Normals.Add(FVector(-SlopeX, -SlopeY, 1.f).GetSafeNormal());
+			OutTile.Tangents.Add(FProcMeshTangent(FVector(1.f, 0.f, SlopeX).GetSafeNormal(), false));
+		}
+	}
+
+	// Triangles only depend on the grid size and are shared between tiles
+	OutTile.Triangles = FTerrainIndexBuffers::Get(LODVertexCount);
+}
+
+
+//********************//
+// Trees//
+//********************//
+
+void AWorldGenerator::RefreshFoliage()
+{
+	for (UInstancedStaticMeshComponent* FoliageComponent : FoliageComponents)
+	{
+		if (FoliageComponent)
+		{
+			FoliageComponent->MarkRenderStateDirty();
+		}
+	}
+}
+
+void AWorldGenerator::SetTileFoliage(FTerrainTileRecord& Record, const FTerrainFoliageInstances& Foliage)
+{
+	if (!BeginTileFoliage(Record, Foliage))
+	{
+		return;
+	}
+
+	for (int32 FoliageTypeIndex = 0; FoliageTypeIndex < TileFoliage[Record.FoliageIndex].Components.Num(); FoliageTypeIndex++)
+	{
+		SetTileFoliageType(Record, Foliage, FoliageTypeIndex);
+	}
+}
+
+bool AWorldGenerator::BeginTileFoliage(FTerrainTileRecord& Record, const FTerrainFoliageInstances& Foliage)
+{
+	if (Foliage.NumInstances == 0)
+	{
+		ReleaseTileFoliage(Record);
+		return false;
+	}
+
+	if (Record.FoliageIndex == INDEX_NONE)
+	{
+		Record.FoliageIndex = FreeTileFoliage.Num() > 0 ? FreeTileFoliage.Pop() : TileFoliage.AddDefaulted();
+	}
+
+	// Pooled components may have held another tile's foliage, every one of them is rewritten
+	FTerrainTileFoliage& Slot = TileFoliage[Record.FoliageIndex];
+	const int32 NumTypes = FMath::Max(Slot.Components.Num(), Foliage.Transforms.Num());
+	Slot.Components.SetNum(NumTypes);
+	Slot.NearComponents.SetNum(NumTypes);
+	Slot.Tiers.SetNum(NumTypes);
+
+	Record.FoliageBounds = Foliage.Bounds;
+	return true;
+}
+
+void AWorldGenerator::SetTileFoliageType(FTerrainTileRecord& Record, const FTerrainFoliageInstances& Foliage, int32 FoliageTypeIndex)
+{
+	FTerrainTileFoliage& Slot = TileFoliage[Record.FoliageIndex];
+	const TArray<FTransform> NoTransforms;
+	auto Place = [this, &Foliage](UHierarchicalInstancedStaticMeshComponent*& FoliageComponent, int32 FoliageTypeIndex, const TArray<FTransform>& Transforms)
+	{
+		if (!FoliageComponent && Transforms.Num() > 0)
+		{
+			FoliageComponent = CreateTileFoliageComponent(FoliageTypeIndex);
+		}
+		if (FoliageComponent)
+		{
+			PlaceFoliageInstances(FoliageComponent, Transforms, Foliage.Bounds.GetCenter());
+			FoliageComponent->BuildTreeIfOutdated(false, false);
+		}
+	};
+
+	const bool bPlaced = Foliage.Transforms.IsValidIndex(FoliageTypeIndex);
+	Place(Slot.Components[FoliageTypeIndex], FoliageTypeIndex, bPlaced ? Foliage.Transforms[FoliageTypeIndex] : NoTransforms);
+	Place(Slot.NearComponents[FoliageTypeIndex], FoliageTypeIndex, bPlaced ? Foliage.NearTransforms[FoliageTypeIndex] : NoTransforms);
+	SetFoliageTier(Slot, FoliageTypeIndex, GetDesiredFoliageTier(Record, FoliageTypeIndex, Slot.Tiers[FoliageTypeIndex]));
+}
+
+void AWorldGenerator::ReleaseTileFoliage(FTerrainTileRecord& Record)
+{
+	if (Record.FoliageIndex == INDEX_NONE)
+	{
+		return;
+	}
+
+	// The instances keep their transforms until the components go to another tile, which rewrites them anyway.
+	// They are all free from here, so ShrinkFoliagePools trims them once the slot has sat unused for an interval.
+	FTerrainTileFoliage& Slot = TileFoliage[Record.FoliageIndex];
+	for (const TArray<UHierarchicalInstancedStaticMeshComponent*>* Components : { &Slot.Components, &Slot.NearComponents })
+	{
+		for (UHierarchicalInstancedStaticMeshComponent* FoliageComponent : *Components)
+		{
+			if (FoliageComponent)
+			{
+				FFoliageInstanceData& Pool = ReplaceableFoliagePool.FindOrAdd(FoliageComponent);
+				FoliagePoolStats.Released += FoliageComponent->GetInstanceCount() - Pool.Instances.Num();
+				Pool.Instances.Reset();
+				for (int32 Instance = FoliageComponent->GetInstanceCount() - 1; Instance >= 0; Instance--)
+				{
+					Pool.Instances.Add(Instance);
+				}
+				FoliageComponent->SetVisibility(false);
+				FoliageComponent->SetCollisionEnabled(ECollisionEnabled::NoCollision);
+			}
+		}
+	}
+
+	FreeTileFoliage.Add(Record.FoliageIndex);
+	Record.FoliageIndex = INDEX_NONE;
+	Record.FoliageBounds = FBox(ForceInit);
+}
+
+void AWorldGenerator::UpdateFoliageTiers()
+{
+	const double Now = GetWorld()->GetTimeSeconds();
+	if (LastFoliageTierUpdateTime >= 0.0 && Now - LastFoliageTierUpdateTime < FoliageTierUpdateInterval)
+	{
+		return;
+	}
+	LastFoliageTierUpdateTime = Now;
+
+	SyncTileRegistry();
+	UpdateFoliageViewers();
+
+	for (const TPair<FIntPoint, FTerrainTileRecord>& Entry : TileRegistry.GetRecords())
+	{
+		if (Entry.Value.FoliageIndex == INDEX_NONE)
+		{
+			continue;
+		}
+
+		FTerrainTileFoliage& Slot = TileFoliage[Entry.Value.FoliageIndex];
+		for (int32 FoliageTypeIndex = 0; FoliageTypeIndex < Slot.Tiers.Num(); FoliageTypeIndex++)
+		{
+			const ETerrainFoliageTier Tier = GetDesiredFoliageTier(Entry.Value, FoliageTypeIndex, Slot.Tiers[FoliageTypeIndex]);
+			if (Tier != Slot.Tiers[FoliageTypeIndex])
+			{
+				SetFoliageTier(Slot, FoliageTypeIndex, Tier);
+			}
+		}
+	}
+}
+
+void AWorldGenerator::UpdateFoliageViewers()
+{
+	FoliageViewers.Reset();
+
+	// Rings follow what players see, unlike collision tiers NPCs do not keep foliage around them
+	for (FConstPlayerControllerIterator It = GetWorld()->GetPlayerControllerIterator(); It; ++It)
+	{
+		FVector ViewLocation;
+		FRotator ViewRotation;
+		if (It->IsValid())
+		{
+			(*It)->GetPlayerViewPoint(ViewLocation, ViewRotation);
+			FoliageViewers.Add(FVector2D(ViewLocation));
 		}
 	}
+}
+
+const FFoliageTierSettings& AWorldGenerator::GetFoliageTierSettings(int32 FoliageTypeIndex) const
+{
+	const FFoliageTierSettings* Settings = FoliageTypes.IsValidIndex(FoliageTypeIndex) ? FoliageTiers.Find(FoliageTypes[FoliageTypeIndex]) : nullptr;
+	return Settings ? *Settings : DefaultFoliageTiers;
+}
+
+ETerrainFoliageTier AWorldGenerator::GetDesiredFoliageTier(const FTerrainTileRecord& Record, int32 FoliageTypeIndex, ETerrainFoliageTier CurrentTier) const
+{
+	// Without a player there is nobody to cull for, tiles placed before one spawns are shown in full
+	if (!UseFoliageTiers || FoliageViewers.Num() == 0)
+	{
+		return ETerrainFoliageTier::Near;
+	}
+
+	// Measured to the nearest instance rather than the tile's edge, foliage rarely fills a tile to its border
+	const FBox2D Bounds = Record.FoliageBounds.IsValid
+		? FBox2D(FVector2D(Record.FoliageBounds.Min), FVector2D(Record.FoliageBounds.Max))
+		: Record.Bounds;
+
+	const FFoliageTierSettings& Settings = GetFoliageTierSettings(FoliageTypeIndex);
+	float MinDistanceSquared = MAX_flt;
+	for (const FVector2D& Viewer : FoliageViewers)
+	{
+		MinDistanceSquared = FMath::Min(MinDistanceSquared, (float)Bounds.ComputeSquaredDistanceToPoint(Viewer));
+	}
+	const float Distance = FMath::Sqrt(MinDistanceSquared);
+
+	// Same margin as collision tiers, a tile keeps its ring until it is a cell past the radius
+	const float NearRadius = Settings.NearRadius + (CurrentTier == ETerrainFoliageTier::Near ? CellSize : 0.f);
+	const float MiddleRadius = Settings.MiddleRadius + (CurrentTier != ETerrainFoliageTier::Far ? CellSize : 0.f);
+	if (Distance <= NearRadius)
+	{
+		return ETerrainFoliageTier::Near;
+	}
+	return Distance <= MiddleRadius ? ETerrainFoliageTier::Middle : ETerrainFoliageTier::Far;
+}
 
-	// Triangles
-
-	Triangles.Empty();
-	for (int32 iTY = 0; iTY <= LODYVertexCount; iTY++)
+void AWorldGenerator::SetFoliageTier(FTerrainTileFoliage& Slot, int32 FoliageTypeIndex, ETerrainFoliageTier Tier)
+{
+	const ECollisionEnabled::Type Collision = GetDefault<UHierarchicalInstancedStaticMeshComponent>()->GetCollisionEnabled();
+	auto Show = [this, Collision](UHierarchicalInstancedStaticMeshComponent* FoliageComponent, bool bVisible, bool bCollision)
 	{
-		for (int32 iTX = 0; iTX <= LODXVertexCount; iTX++)
+		if (FoliageComponent)
 		{
-			Triangles.Add(iTX + iTY * (LODXVertexCount + 2));
-			Triangles.Add(iTX + (iTY + 1) * (LODXVertexCount + 2));
-			Triangles.Add(iTX + iTY * (LODXVertexCount + 2) + 1);
-
-			Triangles.Add(iTX + (iTY + 1) * (LODXVertexCount + 2));
-			Triangles.Add(iTX + (iTY + 1) * (LODXVertexCount + 2) + 1);
-			Triangles.Add(iTX + iTY * (LODXVertexCount + 2) + 1);
+			const bool bShown = bVisible && HasFoliageInstances(FoliageComponent);
+			FoliageComponent->SetVisibility(bShown);
+			FoliageComponent->SetCollisionEnabled(bShown && bCollision ? Collision : ECollisionEnabled::NoCollision);
 		}
+	};
+
+	Show(Slot.Components[FoliageTypeIndex], Tier != ETerrainFoliageTier::Far, Tier == ETerrainFoliageTier::Near);
+	Show(Slot.NearComponents[FoliageTypeIndex], Tier == ETerrainFoliageTier::Near, true);
+	Slot.Tiers[FoliageTypeIndex] = Tier;
+}
+
+bool AWorldGenerator::HasFoliageInstances(UInstancedStaticMeshComponent* FoliageComponent) const
+{
+	const FFoliageInstanceData* Pool = ReplaceableFoliagePool.Find(FoliageComponent);
+	return FoliageComponent->GetInstanceCount() > (Pool ? Pool->Instances.Num() : 0);
+}
 
+UHierarchicalInstancedStaticMeshComponent* AWorldGenerator::CreateTileFoliageComponent(int32 FoliageTypeIndex)
+{
+	const UFoliageType_InstancedStaticMesh* FoliageType = FoliageTypes.IsValidIndex(FoliageTypeIndex) ? FoliageTypes[FoliageTypeIndex] : nullptr;
+	if (!FoliageType || !FoliageType->GetStaticMesh())
+	{
+		return nullptr;
 	}
-	//}
 
-	// Calculating subset mesh to prevent seams
+	// A tile's component is culled as a whole by its bounds, and its instances by the foliage type's distances
+	UHierarchicalInstancedStaticMeshComponent* FoliageComponent = NewObject<UHierarchicalInstancedStaticMeshComponent>(this);
+	FoliageComponent->SetStaticMesh(FoliageType->GetStaticMesh());
+	FoliageComponent->SetCullDistances(FoliageType->CullDistance.Min, FoliageType->CullDistance.Max);
+	FoliageComponent->SetCastShadow(FoliageType->CastShadow);
+
+	// The tree is built where the instances are placed, on the game thread inside the commit budget
+	FoliageComponent->bAutoRebuildTreeOnInstanceChanges = false;
+	FoliageComponent->SetupAttachment(GetRootComponent());
+	FoliageComponent->RegisterComponent();
+	return FoliageComponent;
+}
 
-	int VertexIndex = 0;
+void AWorldGenerator::PlaceFoliageInstances(UInstancedStaticMeshComponent* FoliageComponent, const TArray<FTransform>& Transforms, const FVector& HiddenLocation)
+{
+	FFoliageInstanceData& Pool = ReplaceableFoliagePool.FindOrAdd(FoliageComponent);
+	const int32 InstanceCount = FoliageComponent->GetInstanceCount();
 
-	//calculate normals
-	UKismetProceduralMeshLibrary::CalculateTangentsForMesh(Vertices, Triangles, UVs, Normals, Tangents);
+	// Existing instances first, hidden or not, in one run from index 0
+	const int32 NumReused = FMath::Min(InstanceCount, Transforms.Num());
+	if (NumReused > 0)
+	{
+		const TArray<FTransform> ReusedTransforms(Transforms.GetData(), NumReused);
+		FoliageComponent->BatchUpdateInstancesTransforms(0, ReusedTransforms, false, false, true);
+		FoliagePoolStats.Reused += NumReused;
+	}
 
-	// Subset vertices and UVs
-	for (int32 iVY = -1; iVY <= LODYVertexCount; iVY++)
+	if (Transforms.Num() > InstanceCount)
 	{
-		for (int32 iVX = -1; iVX <= LODXVertexCount; iVX++)
+		// Marks the render state dirty for the whole batch
+		const TArray<FTransform> NewTransforms(Transforms.GetData() + NumReused, Transforms.Num() - NumReused);
+		FoliageComponent->AddInstances(NewTransforms, false);
+		FoliagePoolStats.Added += NewTransforms.Num();
+	}
+	else
+	{
+		// Zero scale hides the spare instances and drops their collision, far cheaper than removing them
+		const int32 NumHidden = InstanceCount - Transforms.Num() - Pool.Instances.Num();
+		if (InstanceCount > Transforms.Num())
 		{
-			if (-1 < iVY && iVY < LODYVertexCount && -1 < iVX && iVX < LODXVertexCount)
-			{
-				SubVertices.Add(Vertices[VertexIndex]);
-				SubUVs.Add(UVs[VertexIndex]);
-				SubNormals.Add(Normals[VertexIndex]);
-				SubTangents.Add(Tangents[VertexIndex]);
-			}
-			VertexIndex++;
+			FoliageComponent->BatchUpdateInstancesTransform(Transforms.Num(), InstanceCount - Transforms.Num(), FTransform(FQuat::Identity, HiddenLocation, FVector::ZeroVector), false, false, true);
 		}
+		FoliagePoolStats.Released += FMath::Max(0, NumHidden);
+		FoliageComponent->MarkRenderStateDirty();
 	}
 
-	// Subset triangles
+	Pool.Instances.Reset();
+	for (int32 Instance = FoliageComponent->GetInstanceCount() - 1; Instance >= Transforms.Num(); Instance--)
+	{
+		Pool.Instances.Add(Instance);
+	}
+	Pool.HighWaterMark = FMath::Max(Pool.HighWaterMark, Transforms.Num());
+}
 
-	SubTriangles.Empty();
-	for (int32 iTY = 0; iTY <= LODYVertexCount - 2; iTY++)
+void AWorldGenerator::ShrinkFoliagePools()
+{
+	for (TPair<UInstancedStaticMeshComponent*, FFoliageInstanceData>& Pair : ReplaceableFoliagePool)
 	{
-		for (int32 iTX = 0; iTX <= LODXVertexCount - 2; iTX++)
+		UInstancedStaticMeshComponent* FoliageComponent = Pair.Key;
+		FFoliageInstanceData& Pool = Pair.Value;
+		if (!FoliageComponent)
 		{
-			SubTriangles.Add(iTX + iTY * LODXVertexCount);
-			SubTriangles.Add(iTX + iTY * LODXVertexCount + LODXVertexCount);
-			SubTriangles.Add(iTX + iTY * LODXVertexCount + 1);
-
-			SubTriangles.Add(iTX + iTY * LODXVertexCount + LODXVertexCount);
-			SubTriangles.Add(iTX + iTY * LODXVertexCount + LODXVertexCount + 1);
-			SubTriangles.Add(iTX + iTY * LODXVertexCount + 1);
+			continue;
 		}
-	}
 
-	TileReady = true;
+		const int32 InstanceCount = FoliageComponent->GetInstanceCount();
+		const int32 InUse = InstanceCount - Pool.Instances.Num();
+		const int32 Capacity = Pool.HighWaterMark + FMath::CeilToInt(Pool.HighWaterMark * FoliagePoolSlack);
 
+		// Only free slots at the top can go, removing them leaves every other index as it is
+		int32 NumRemoved = 0;
+		while (NumRemoved < Pool.Instances.Num() && InstanceCount - NumRemoved > Capacity && Pool.Instances[NumRemoved] == InstanceCount - 1 - NumRemoved)
+		{
+			NumRemoved++;
+		}
 
-}
+		if (NumRemoved > 0)
+		{
+			TArray<int32> Removed(Pool.Instances.GetData(), NumRemoved);
+			FoliageComponent->RemoveInstances(Removed);
+			Pool.Instances.RemoveAt(0, NumRemoved);
 
+			UHierarchicalInstancedStaticMeshComponent* HierarchicalComponent = Cast<UHierarchicalInstancedStaticMeshComponent>(FoliageComponent);
+			if (HierarchicalComponent && !HierarchicalComponent->bAutoRebuildTreeOnInstanceChanges)
+			{
+				HierarchicalComponent->BuildTreeIfOutdated(false, false);
+			}
+			FoliagePoolStats.Removed += NumRemoved;
+		}
 
-//********************//
-// Trees//
-//********************//
+		// The next interval measures its own peak
+		Pool.HighWaterMark = InUse;
+	}
+}
 
-void AWorldGenerator::RefreshFoliage()
+FFoliagePoolStats AWorldGenerator::GetFoliagePoolStats() const
 {
-	for (UInstancedStaticMeshComponent* FoliageComponent : FoliageComponents)
+	FFoliagePoolStats Stats = FoliagePoolStats;
+	auto Count = [&Stats](const UInstancedStaticMeshComponent* FoliageComponent, int32 InUse, int32 Spare)
 	{
-		if (FoliageComponent)
+		Stats.ActiveInstances += InUse;
+		Stats.FreeInstances += Spare;
+		Stats.VisibleInstances += FoliageComponent->IsVisible() ? InUse : 0;
+		Stats.CollidingInstances += FoliageComponent->IsCollisionEnabled() ? InUse : 0;
+	};
+
+	// Released slots have every instance in their pools, whatever they showed last
+	for (const FTerrainTileFoliage& Slot : TileFoliage)
+	{
+		for (const TArray<UHierarchicalInstancedStaticMeshComponent*>* Components : { &Slot.Components, &Slot.NearComponents })
 		{
-			// Loop over each instance in the component
-			const int32 InstanceCount = FoliageComponent->GetInstanceCount();
-			for (int32 InstanceIndex = 0; InstanceIndex < InstanceCount; ++InstanceIndex)
+			for (UHierarchicalInstancedStaticMeshComponent* FoliageComponent : *Components)
 			{
-				FTransform InstanceTransform;
-				FoliageComponent->GetInstanceTransform(InstanceIndex, InstanceTransform, false);
-
+				if (!FoliageComponent)
+				{
+					continue;
+				}
 
-				// Update the instance with the new transform
-				FoliageComponent->UpdateInstanceTransform(InstanceIndex, InstanceTransform, true, true, false);
+				const FFoliageInstanceData* Pool = ReplaceableFoliagePool.Find(FoliageComponent);
+				const int32 Spare = Pool ? Pool->Instances.Num() : 0;
+				Count(FoliageComponent, FoliageComponent->GetInstanceCount() - Spare, Spare);
+				Stats.HighWaterMark += Pool ? Pool->HighWaterMark : 0;
 			}
+		}
+	}
 
-			// Mark the component as dirty to ensure it updates
-			FoliageComponent->MarkRenderStateDirty();
+	for (const UInstancedStaticMeshComponent* FoliageComponent : FoliageComponents)
+	{
+		if (FoliageComponent)
+		{
+			Count(FoliageComponent, FoliageComponent->GetInstanceCount(), 0);
 		}
 	}
+
+	Stats.FreeTiles = FreeTileFoliage.Num();
+	Stats.ActiveTiles = TileFoliage.Num() - FreeTileFoliage.Num();
+	return Stats;
 }
 
 FVector AWorldGenerator::RandomiseOffset(float OffsetR, float OffsetVariation, FRandomStream& Stream)
@@ -587,8 +2194,12 @@ void AWorldGenerator::InitialiseFoliageTypes()
 
 	for (UFoliageType_InstancedStaticMesh* FoliageType : FoliageTypes)
 	{
-		// Only proceed if we have a valid foliage type
-		if (FoliageType && FoliageType->GetStaticMesh())
+		if (!FoliageType || !FoliageType->GetStaticMesh())
+		{
+			// Keeps components lined up with FoliageTypes, which placement results are indexed by
+			FoliageComponents.Add(nullptr);
+		}
+		else
 		{
 			// Create a new instanced static mesh component
 			UInstancedStaticMeshComponent* ISMComp = NewObject<UInstancedStaticMeshComponent>(this);
@@ -614,6 +2225,7 @@ void AWorldGenerator::FoliageRandomisation()
 
 void AWorldGenerator::AddFoliageInstances(FVector InLocation)
 {
+	BeginFoliageBatch();
 	for (int FoliageTypeIndex = 0; FoliageTypeIndex < FoliageTypes.Num(); FoliageTypeIndex++)
 	{
 		UFoliageType_InstancedStaticMesh* FoliageType = FoliageTypes[FoliageTypeIndex];
@@ -635,47 +2247,40 @@ void AWorldGenerator::AddFoliageInstances(FVector InLocation)
 		SpawnFoliageCluster(FoliageType, FoliageIsmComponent, InLocation);
 
 	}
-
+	EndFoliageBatch();
 }
 
 void AWorldGenerator::SpawnFoliageCluster(UFoliageType_InstancedStaticMesh* FoliageType, UInstancedStaticMeshComponent* FoliageIsmComponent, const FVector ClusterLocation) {
 	int MaxSteps = RandomStream.RandRange(0, FoliageType->NumSteps);
 	FVector ClusterBase = ClusterLocation;
 
+	BeginFoliageBatch();
 	for (int Step = 0; Step < MaxSteps; Step++) {
 		ClusterBase += RandomStream.GetUnitVector() * FoliageType->AverageSpreadDistance;
 		ProcessFoliageSeeds(FoliageType, FoliageIsmComponent, ClusterBase);
 	}
+	EndFoliageBatch();
 }
 
 void AWorldGenerator::ProcessFoliageSeeds(UFoliageType_InstancedStaticMesh* FoliageType, UInstancedStaticMeshComponent* FoliageIsmComponent, const FVector& BaseLocation) {
 	int MaxSeeds = RandomStream.RandRange(0, FoliageType->SeedsPerStep);
+	BeginFoliageBatch();
 	for (int SeedIndex = 0; SeedIndex < MaxSeeds; SeedIndex++) {
 		FVector InstanceLocation = BaseLocation + RandomStream.GetUnitVector() * FoliageType->SpreadVariance;
 		TrySpawnFoliageInstance(FoliageType, FoliageIsmComponent, InstanceLocation);
 	}
+	EndFoliageBatch();
 }
 
 void AWorldGenerator::TrySpawnFoliageInstance(UFoliageType_InstancedStaticMesh* FoliageType, UInstancedStaticMeshComponent* FoliageIsmComponent, const FVector& InstanceLocation) {
-	FHitResult HitResults;
-	FCollisionQueryParams CollisionParams;
-
-	bool bHit = GetWorld()->LineTraceSingleByChannel(
-		HitResults,
-		InstanceLocation + FVector(0, 0, 2000),
-		InstanceLocation + FVector(0, 0, -2000),
-		ECC_Visibility,
-		CollisionParams
-	);
-
-	if (bHit && IsSpawnLocationValid(HitResults, FoliageType)) {
-		FTransform InstanceTransform = CreateFoliageTransform(FoliageType, HitResults.Location);
-		FoliageIsmComponent->AddInstance(InstanceTransform);
-	}
+	// The surface under the seed is read from the height function with the rest of its batch
+	BeginFoliageBatch();
+	PendingFoliageSeeds.Add({ FoliageType, FoliageIsmComponent, FVector2D(InstanceLocation), false });
+	EndFoliageBatch();
 }
 
 bool AWorldGenerator::IsSpawnLocationValid(const FHitResult& HitResults, UFoliageType_InstancedStaticMesh* FoliageType) {
-	if (HitResults.Component != TerrainMesh) return false;
+	if (!IsTerrainComponent(HitResults.Component.Get())) return false;
 
 	float DotProduct = FVector::DotProduct(HitResults.ImpactNormal, FVector::UpVector);
 	float SlopeAngle = FMath::RadiansToDegrees(FMath::Acos(DotProduct));
@@ -693,22 +2298,17 @@ FTransform AWorldGenerator::CreateFoliageTransform(UFoliageType_InstancedStaticM
 void AWorldGenerator::TrySpawnFoliageAtLocation(UFoliageType_InstancedStaticMesh* FoliageType, const FVector& Location) {
 	// Randomise the offset for each instance within the provided range
 	FVector Offset = RandomiseOffset(InstanceOffset, InstanceOffsetVariation, RandomStream);
-	FVector Start = Location + Offset + FVector(0.f, 0.f, 20000.f);  // Start high above to ensure the line trace hits the landscape
-	FVector End = Start - FVector(0.f, 0.f, 40000.f);  // End far below the start to cover all possible terrain elevations
+	FVector2D FoliageLocation = FVector2D(Location + Offset);
 
-	// Line trace to find where the foliage should be placed
-	FHitResult HitResult;
-	if (GetWorld()->LineTraceSingleByChannel(HitResult, Start, End, ECC_Visibility)) {
-		if (HitResult.Component.Get() == TerrainMesh && CheckSlope(HitResult.ImpactNormal, FoliageType)) {
-			FVector LocationWithOffset = HitResult.Location + FVector(0, 0, RandomStream.FRandRange(FoliageType->ZOffset.Min, FoliageType->ZOffset.Max));
-			FTransform InstanceTransform = FTransform(FRotator::ZeroRotator, LocationWithOffset, FVector::One() * RandomStream.FRandRange(FoliageType->ProceduralScale.Min, FoliageType->ProceduralScale.Max));
-			UInstancedStaticMeshComponent* FoliageIsmComponent = FoliageComponents[FoliageTypes.IndexOfByKey(FoliageType)];  // Ensure you have a way to reference the correct foliage component
-			FoliageIsmComponent->AddInstance(InstanceTransform);
-		}
-	}
+	// Height and normal where the foliage should be placed, read with the rest of its batch
+	UInstancedStaticMeshComponent* FoliageIsmComponent = FoliageComponents[FoliageTypes.IndexOfByKey(FoliageType)];
+	BeginFoliageBatch();
+	PendingFoliageSeeds.Add({ FoliageType, FoliageIsmComponent, FoliageLocation, true });
+	EndFoliageBatch();
 }
 
 void AWorldGenerator::AddRelevantFoliageInstances(FVector Location) {
+	BeginFoliageBatch();
 	for (UFoliageType_InstancedStaticMesh* FoliageType : FoliageTypes) {
 		if (!FoliageType) continue;
 		if (Location.Z < FoliageType->Height.Min || Location.Z > FoliageType->Height.Max) continue;
@@ -716,6 +2316,53 @@ void AWorldGenerator::AddRelevantFoliageInstances(FVector Location) {
 			TrySpawnFoliageAtLocation(FoliageType, Location);
 		}
 	}
+	EndFoliageBatch();
+}
+
+void AWorldGenerator::BeginFoliageBatch() {
+	FoliageBatchDepth++;
+}
+
+void AWorldGenerator::EndFoliageBatch() {
+	if (FoliageBatchDepth == 0 || --FoliageBatchDepth > 0 || PendingFoliageSeeds.Num() == 0) {
+		return;
+	}
+
+	TArray<FPendingFoliageSeed> Seeds = MoveTemp(PendingFoliageSeeds);
+	PendingFoliageSeeds.Reset();
+
+	// One query for the whole batch
+	TArray<FVector2D> Locations;
+	Locations.Reserve(Seeds.Num());
+	for (const FPendingFoliageSeed& Seed : Seeds) {
+		Locations.Add(Seed.Location);
+	}
+	TArray<FTerrainSurfaceSample> Samples;
+	QueryTerrain(Locations, Samples);
+
+	TMap<UInstancedStaticMeshComponent*, TArray<FTransform>> Transforms;
+	for (int SeedIndex = 0; SeedIndex < Seeds.Num(); SeedIndex++) {
+		const FPendingFoliageSeed& Seed = Seeds[SeedIndex];
+		const FTerrainSurfaceSample& Sample = Samples[SeedIndex];
+		UFoliageType_InstancedStaticMesh* FoliageType = Seed.FoliageType;
+		if (!Seed.FoliageComponent) {
+			continue;
+		}
+
+		if (Seed.bAtLocation) {
+			if (CheckSlope(Sample.Normal, FoliageType)) {
+				FVector LocationWithOffset = FVector(Seed.Location, Sample.Height) + FVector(0, 0, RandomStream.FRandRange(FoliageType->ZOffset.Min, FoliageType->ZOffset.Max));
+				Transforms.FindOrAdd(Seed.FoliageComponent).Add(FTransform(FRotator::ZeroRotator, LocationWithOffset, FVector::One() * RandomStream.FRandRange(FoliageType->ProceduralScale.Min, FoliageType->ProceduralScale.Max)));
+			}
+		}
+		else if (Sample.SlopeDegrees >= FoliageType->GroundSlopeAngle.Min && Sample.SlopeDegrees <= FoliageType->GroundSlopeAngle.Max) {
+			Transforms.FindOrAdd(Seed.FoliageComponent).Add(CreateFoliageTransform(FoliageType, FVector(Seed.Location, Sample.Height)));
+		}
+	}
+
+	for (TPair<UInstancedStaticMeshComponent*, TArray<FTransform>>& Pair : Transforms) {
+		Pair.Key->AddInstances(Pair.Value, false);
+	}
 }
 
 
@@ -735,37 +2382,20 @@ void AWorldGenerator::SpawnPlayerCharacter()
 		return;
 	}
 
-	FVector Start, End;
 	bool bSuitableLocationFound = false;
 	FVector FallbackSpawnPoint = FVector(0, 0, 550); // Fallback spawn location
 	FVector SpawnPoint; // This will be determined dynamically or set to the fallback location
 
 	FVector AreaCenter = FVector(0, 0, 0);
-	float ScanRange = 80000;
-	int NumTries = 100;
-
 
+	seaMesh->SetCollisionResponseToChannel(ECC_Visibility, ECR_Ignore);
 
-	for (int i = 0; i < NumTries; i++)
+	// Suitable cell nearest the centre of the area, always the same one for the same terrain
+	TArray<FVector> SpawnLocations;
+	if (FindSuitableLocations(FVector2D(AreaCenter), 0, 1, 0, TArray<FVector>(), SpawnLocations) > 0)
 	{
-		FVector RandomPoint = AreaCenter + FMath::RandPointInBox(FBox(FVector(-ScanRange, -ScanRange, 0),
-			FVector(ScanRange, ScanRange, 0)));
-
-		Start = FVector(RandomPoint.X, RandomPoint.Y, 1500);
-		End = FVector(RandomPoint.X, RandomPoint.Y, 500);
-
-		FHitResult HitResult;
-		seaMesh->SetCollisionResponseToChannel(ECC_Visibility, ECR_Ignore);
-		FCollisionQueryParams TraceParams(FName(TEXT("PlayerSpawnTrace")), true);
-		TraceParams.AddIgnoredComponent(seaMesh);
-		bool bHit = GetWorld()->LineTraceSingleByChannel(HitResult, Start, End, ECC_Visibility, TraceParams);
-
-		if (bHit && IsLocationSuitable(HitResult))
-		{
-			SpawnPoint = HitResult.Location + FVector(0, 0, PlayerSpawnHeightOffset);
-			bSuitableLocationFound = true;
-			break;
-		}
+		SpawnPoint = SpawnLocations[0] + FVector(0, 0, PlayerSpawnHeightOffset);
+		bSuitableLocationFound = true;
 	}
 
 	if (!bSuitableLocationFound)
@@ -828,42 +2458,32 @@ void AWorldGenerator::SpawnNPC()
 	SpawnParams.SpawnCollisionHandlingOverride =
 		ESpawnActorCollisionHandlingMethod::AdjustIfPossibleButDontSpawnIfColliding;
 
-	// Perform the line trace to find the terrain mesh and suitable ground location
-	FVector TraceStart = SpawnLocation + FVector(0.0f, 0.0f, 600.0f);
-	FVector TraceEnd = SpawnLocation - FVector(0.0f, 0.0f, 600.0f);
-	FHitResult HitResult;
-	FCollisionQueryParams TraceParams;
-	TraceParams.AddIgnoredActor(PlayerCharacter);
+	// Find the ground within the range the spawn used to trace
+	const float GroundSearchRange = 600.0f;
+	const FTerrainSurfaceSample Ground = QueryTerrainAt(FVector2D(SpawnLocation));
 
-	if (GetWorld()->LineTraceSingleByChannel(HitResult, TraceStart, TraceEnd, ECC_Visibility, TraceParams))
+	if (FMath::Abs(Ground.Height - SpawnLocation.Z) <= GroundSearchRange)
 	{
-		if (HitResult.Component.IsValid() && HitResult.Component->IsA<UProceduralMeshComponent>())
-		{
-			// If we hit the ground, adjust the spawn location to be on the ground
-			const float FoxBaseOffset = 100.0f; // Adjust this value as needed
-			SpawnLocation.Z = HitResult.Location.Z + FoxBaseOffset; // Adjust spawn Z to be at the base of the fox mesh
+		// Adjust the spawn location to be on the ground
+		const float FoxBaseOffset = 100.0f; // Adjust this value as needed
+		SpawnLocation.Z = Ground.Height + FoxBaseOffset; // Adjust spawn Z to be at the base of the fox mesh
 
-			// Align the fox to the slope of the ground if necessary
-			FVector Normal = HitResult.ImpactNormal;
-			FRotator GroundRotation = FRotationMatrix::MakeFromZ(Normal).Rotator();
+		// Align the fox to the slope of the ground if necessary
+		FVector Normal = Ground.Normal;
+		FRotator GroundRotation = FRotationMatrix::MakeFromZ(Normal).Rotator();
 
-			//// Calculate the rotation to face the player
-			FVector DirectionToPlayer = (PlayerLocation - SpawnLocation).GetSafeNormal();
-			FRotator SpawnRotation = FRotationMatrix::MakeFromX(DirectionToPlayer).Rotator();
+		//// Calculate the rotation to face the player
+		FVector DirectionToPlayer = (PlayerLocation - SpawnLocation).GetSafeNormal();
+		FRotator SpawnRotation = FRotationMatrix::MakeFromX(DirectionToPlayer).Rotator();
 
-			//// Use the rotation facing the player
-			FRotator FinalRotation = FRotator(GroundRotation.Pitch, SpawnRotation.Yaw, GroundRotation.Roll);
+		//// Use the rotation facing the player
+		FRotator FinalRotation = FRotator(GroundRotation.Pitch, SpawnRotation.Yaw, GroundRotation.Roll);
 
-			// Spawn the BP_Fox
-			AActor* SpawnedFox = GetWorld()->SpawnActor<AActor>(FoxBlueprintClass, SpawnLocation, SpawnRotation, SpawnParams);
-			if (!SpawnedFox)
-			{
-				UE_LOG(LogTemp, Warning, TEXT("Failed to spawn BP_Fox."));
-			}
-		}
-		else
+		// Spawn the BP_Fox
+		AActor* SpawnedFox = GetWorld()->SpawnActor<AActor>(FoxBlueprintClass, SpawnLocation, SpawnRotation, SpawnParams);
+		if (!SpawnedFox)
 		{
-			UE_LOG(LogTemp, Warning, TEXT("Hit component is not the procedural mesh."));
+			UE_LOG(LogTemp, Warning, TEXT("Failed to spawn BP_Fox."));
 		}
 	}
 	else
@@ -875,34 +2495,20 @@ void AWorldGenerator::SpawnNPC()
 
 void AWorldGenerator::SpawnHealthItemAtGoalLocation(const FVector& GoalLocation)
 {
-	FVector Start = GoalLocation + FVector(0, 0, 500); // Start trace above the terrain
-	FVector End = GoalLocation - FVector(0, 0, 500); // End trace below the terrain
-
-	FHitResult HitResult;
-	FCollisionQueryParams TraceParams;
-	TraceParams.bReturnPhysicalMaterial = true; 
-	
+	float GroundSearchRange = 500; // Distance above and below the goal the ground may be
 
-	// Perform the trace
-	if (GetWorld()->LineTraceSingleByChannel(HitResult, Start, End, ECC_Visibility, TraceParams))
+	const FTerrainSurfaceSample Ground = QueryTerrainAt(FVector2D(GoalLocation));
+	if (FMath::Abs(Ground.Height - GoalLocation.Z) <= GroundSearchRange)
 	{
-		if (HitResult.Component.IsValid() && HitResult.Component->IsA<UProceduralMeshComponent>())
-		{
-
-
-			// Adjust the Z height of the health item to sit exactly on the terrain surface
-			FVector HealthItemLocation = HitResult.Location;
-			HealthItemLocation.Z += 100;
-
-			// Spawn the health item
-			UClass* HealthItemClass = StaticLoadClass(AActor::StaticClass(), nullptr, TEXT("/Game/ThirdPerson/Blueprints/BP_Health.BP_Health_C"));
-			if (HealthItemClass)
-			{
-				AActor* SpawnedHealthItem = GetWorld()->SpawnActor<AActor>(HealthItemClass, HealthItemLocation, FRotator::ZeroRotator);
-			
-
-			}
+		// Adjust the Z height of the health item to sit exactly on the terrain surface
+		FVector HealthItemLocation = FVector(GoalLocation.X, GoalLocation.Y, Ground.Height);
+		HealthItemLocation.Z += 100;
 
+		// Spawn the health item
+		UClass* HealthItemClass = StaticLoadClass(AActor::StaticClass(), nullptr, TEXT("/Game/ThirdPerson/Blueprints/BP_Health.BP_Health_C"));
+		if (HealthItemClass)
+		{
+			AActor* SpawnedHealthItem = GetWorld()->SpawnActor<AActor>(HealthItemClass, HealthItemLocation, FRotator::ZeroRotator);
 		}
 	}
 
@@ -937,186 +2543,311 @@ bool AWorldGenerator::IsPathValid(FVector StartLocation, FVector GoalLocation)
 
 }
 
-bool AWorldGenerator::IsLocationSuitable(const FHitResult& HitResult)
+int32 AWorldGenerator::ValidatePathsAsync(const TArray<FPathQueryCandidate>& Candidates, int MaxValid, FOnPathsValidated OnComplete)
 {
-	// Verify that the hit component is the terrain mesh
-	if (!HitResult.Component.IsValid() || HitResult.Component->GetClass() != UProceduralMeshComponent::StaticClass())
+	TArray<FVector> Goals;
+	for (const FPathQueryCandidate& Candidate : Candidates)
 	{
-		//UE_LOG(LogTemp, Warning, TEXT("Hit component is not the terrain mesh."));
-		return false;
+		Goals.Add(Candidate.Goal);
 	}
 
-	// Check if the physical material of the hit component is the expected type for terrain
-	if (HitResult.PhysMaterial.IsValid() && HitResult.PhysMaterial->SurfaceType != SupportedSurfaceType)
+	return (int32)ValidatePaths(Candidates, MaxValid, FOnPathQueryBatchComplete::CreateLambda([OnComplete, Goals](const TArray<int32>& ValidIndices)
+		{
+			TArray<FVector> ValidGoals;
+			for (const int32 Index : ValidIndices)
+			{
+				ValidGoals.Add(Goals[Index]);
+			}
+			OnComplete.ExecuteIfBound(ValidGoals, ValidIndices);
+		}
+	));
+}
+
+uint32 AWorldGenerator::ValidatePaths(TArray<FPathQueryCandidate> Candidates, int32 MaxValid, FOnPathQueryBatchComplete OnComplete)
+{
+	if (!PathQueries)
 	{
-		//UE_LOG(LogTemp, Warning, TEXT("Hit surface is not of the supported type."));
-		return false;
+		return 0;
 	}
+	return PathQueries->Submit(MoveTemp(Candidates), MaxValid, MoveTemp(OnComplete));
+}
 
-	// Check for height and slope constraints
-	float SlopeAngle = FMath::RadiansToDegrees(FMath::Acos(FVector::DotProduct(HitResult.ImpactNormal, FVector::UpVector)));
-	bool isSuitable = HitResult.Location.Z >= MinHeightAboveTerrain && SlopeAngle <= GroundSlopeAngleMax;
+void AWorldGenerator::CancelPathValidation(int32 BatchId)
+{
+	if (PathQueries)
+	{
+		PathQueries->Cancel((uint32)BatchId);
+	}
+}
 
-	//UE_LOG(LogTemp, Log, TEXT("Checking location suitability: Height=%f, SlopeAngle=%f, IsSuitable=%s"),
-		//HitResult.Location.Z, SlopeAngle, isSuitable ? TEXT("True") : TEXT("False"));
+FPathQueryStats AWorldGenerator::GetPathQueryStats() const
+{
+	return PathQueries ? PathQueries->GetStats() : FPathQueryStats();
+}
 
-	return isSuitable;
+bool AWorldGenerator::IsSurfaceSuitable(const FTerrainSurfaceSample& Sample) const
+{
+	// The whole terrain is one surface, so the type check is the same everywhere
+	const UPhysicalMaterial* PhysMaterial = GetTerrainPhysicalMaterial();
+	if (PhysMaterial && PhysMaterial->SurfaceType != SupportedSurfaceType)
+	{
+		return false;
+	}
+
+	return Sample.Height >= MinHeightAboveTerrain && Sample.SlopeDegrees <= GroundSlopeAngleMax;
 }
 
-//********************//
-// Goal setting //
-//********************//
+FTerrainSuitabilityParams AWorldGenerator::GetSuitabilityParams() const
+{
+	FTerrainSuitabilityParams Params;
+	Params.MinHeight = FMath::Max((float)MinHeightAboveTerrain, seaLevel);
+	Params.MaxSlopeDegrees = GroundSlopeAngleMax;
+	return Params;
+}
 
-void AWorldGenerator::SetGoalLocation()
+FTerrainSuitabilityIndexPtr AWorldGenerator::GetSuitabilityIndex(const FIntPoint& Tile, int32& BuildBudget)
 {
-	FVector PlayerLocation = GetPlayerLocation();
-	ATGGameMode* MyGameMode = Cast<ATGGameMode>(UGameplayStatics::GetGameMode(GetWorld()));
+	const FTerrainTileParams TileParams = GetTileParams();
+	const FTerrainSuitabilityParams Params = GetSuitabilityParams();
+	if (const FTerrainSuitabilityIndexRef* Existing = SuitabilityIndices.Find(Tile))
+	{
+		if ((*Existing)->ParamsHash == TileParams.GetHash() && (*Existing)->Params == Params)
+		{
+			return *Existing;
+		}
+	}
 
-	// Configuration for trace parameters and fallback logic
-	FCollisionQueryParams TraceParams(FName(TEXT("GoalLocationTrace")), true);
-	TraceParams.bReturnPhysicalMaterial = true;
-	TraceParams.AddIgnoredComponent(seaMesh);
+	if (BuildBudget <= 0)
+	{
+		return nullptr;
+	}
+	BuildBudget--;
 
-	
-	
-	bool bSuitableLocationFound = false;
-	int NumTries = 250; // Number of attempts to find a suitable location
-	float TargetDistance = 2000; // Distance for the goal location from the player
+	// Tiles without a record have nothing to drop their index with, they are built again next time
+	TSharedRef<FTerrainSuitabilityIndex, ESPMode::ThreadSafe> Index = MakeShared<FTerrainSuitabilityIndex, ESPMode::ThreadSafe>();
+	FTerrainSuitabilityIndex::Build(TileParams, Params, Tile, *Index);
+	if (TileRegistry.Find(Tile))
+	{
+		SuitabilityIndices.Add(Tile, Index);
+	}
+	return Index;
+}
+
+int AWorldGenerator::FindSuitableLocations(FVector2D Center, float Radius, int MaxResults, float MinSpacing, const TArray<FVector>& Exclude, TArray<FVector>& OutLocations)
+{
+	OutLocations.Reset();
+
+	// The whole terrain is one surface, nothing is suitable if it is the wrong one
+	const UPhysicalMaterial* PhysMaterial = GetTerrainPhysicalMaterial();
+	if (MaxResults <= 0 || (PhysMaterial && PhysMaterial->SurfaceType != SupportedSurfaceType))
+	{
+		return 0;
+	}
 
-	for (int i = 0; i < NumTries; i++)
+	struct FCandidate
+	{
+		FVector2D Location;
+		float Error;
+	};
+
+	const FVector2D TileSize = FVector2D(XVertexCount - 1, YVertexCount - 1) * CellSize;
+	TSet<FIntPoint> SearchedTiles;
+	TArray<FCandidate> Candidates;
+	TArray<FVector2D> Chosen;
+	int32 BuildBudget = MaxSuitabilityBuildsPerSearch;
+
+	// Distance from a tile to the circle, zero when the circle passes through it
+	auto GetRingDistance = [&](const FIntPoint& Tile)
 	{
-		// Random direction and goal location setup
-		FVector GoalDirection = FMath::VRand();
-		GoalDirection.Z = 0;
-		GoalDirection.Normalize();
+		const FBox2D Bounds(FVector2D(Tile) * TileSize, FVector2D(Tile + FIntPoint(1, 1)) * TileSize);
+		const float Nearest = FMath::Sqrt((float)Bounds.ComputeSquaredDistanceToPoint(Center));
+		const FVector2D FarCorner(Center.X < Bounds.GetCenter().X ? Bounds.Max.X : Bounds.Min.X, Center.Y < Bounds.GetCenter().Y ? Bounds.Max.Y : Bounds.Min.Y);
+		const float Furthest = (float)FVector2D::Distance(FarCorner, Center);
+		return Radius < Nearest ? Nearest - Radius : FMath::Max(0.f, Radius - Furthest);
+	};
+
+	// Tiles the circle passes through first, then a tile further from it each round until enough are found
+	for (int32 Extra = 0; Extra <= FMath::Max(0, SuitabilitySearchTiles) && Chosen.Num() < MaxResults; Extra++)
+	{
+		const float Band = Extra * FMath::Max(TileSize.X, TileSize.Y);
+		const float Reach = Radius + Band;
+		const FIntPoint MinTile(FMath::FloorToInt((Center.X - Reach) / TileSize.X), FMath::FloorToInt((Center.Y - Reach) / TileSize.Y));
+		const FIntPoint MaxTile(FMath::FloorToInt((Center.X + Reach) / TileSize.X), FMath::FloorToInt((Center.Y + Reach) / TileSize.Y));
+
+		TArray<TPair<float, FIntPoint>> RoundTiles;
+		for (int32 TileY = MinTile.Y; TileY <= MaxTile.Y; TileY++)
+		{
+			for (int32 TileX = MinTile.X; TileX <= MaxTile.X; TileX++)
+			{
+				const FIntPoint Tile(TileX, TileY);
+				const float RingDistance = GetRingDistance(Tile);
+				if (RingDistance <= Band && !SearchedTiles.Contains(Tile))
+				{
+					RoundTiles.Add({ RingDistance, Tile });
+				}
+			}
+		}
+
+		// The build budget goes to the tiles nearest the circle, ties broken by position so it never depends on the search
+		RoundTiles.Sort([](const TPair<float, FIntPoint>& A, const TPair<float, FIntPoint>& B)
+			{
+				if (A.Key != B.Key)
+				{
+					return A.Key < B.Key;
+				}
+				return A.Value.Y != B.Value.Y ? A.Value.Y < B.Value.Y : A.Value.X < B.Value.X;
+			}
+		);
+
+		for (const TPair<float, FIntPoint>& RoundTile : RoundTiles)
+		{
+			SearchedTiles.Add(RoundTile.Value);
+			const FTerrainSuitabilityIndexPtr Index = GetSuitabilityIndex(RoundTile.Value, BuildBudget);
+			if (!Index)
+			{
+				continue;
+			}
+
+			Index->ForEachNearRadius(Center, Radius, [&Candidates](const FVector2D& Location, float Error)
+				{
+					Candidates.Add({ Location, Error });
+				}
+			);
+		}
 
-		FVector GoalLocation = PlayerLocation + (GoalDirection * TargetDistance);
-		FVector Start = GoalLocation + FVector(0, 0, 500);
-		FVector End = GoalLocation - FVector(0, 0, 500);
-		FHitResult HitResult;
+		// Best first, ties broken by position so the order never depends on the search
+		Candidates.Sort([](const FCandidate& A, const FCandidate& B)
+			{
+				if (A.Error != B.Error)
+				{
+					return A.Error < B.Error;
+				}
+				return A.Location.X != B.Location.X ? A.Location.X < B.Location.X : A.Location.Y < B.Location.Y;
+			}
+		);
 
-		if (GetWorld()->LineTraceSingleByChannel(HitResult, Start, End, ECC_Visibility, TraceParams))
+		Chosen.Reset();
+		for (const FCandidate& Candidate : Candidates)
 		{
-			if (HitResult.Component.IsValid() && HitResult.Component->IsA<UProceduralMeshComponent>())
+			const float MinSpacingSquared = MinSpacing * MinSpacing;
+			const bool bTooClose = Chosen.ContainsByPredicate([&](const FVector2D& Other) { return FVector2D::DistSquared(Other, Candidate.Location) < MinSpacingSquared; })
+				|| Exclude.ContainsByPredicate([&](const FVector& Other) { return FVector2D::DistSquared(FVector2D(Other), Candidate.Location) < MinSpacingSquared; });
+			if (!bTooClose)
 			{
-				FVector AdjustedGoalLocation = HitResult.Location + FVector(0, 0, 100);
-				if (IsPathValid(PlayerLocation, AdjustedGoalLocation))
+				Chosen.Add(Candidate.Location);
+				if (Chosen.Num() >= MaxResults)
 				{
-					SpawnHealthItemAtGoalLocation(AdjustedGoalLocation);
-					MyGameMode->GoalLocations.Add(AdjustedGoalLocation); 
-					bSuitableLocationFound = true;
 					break;
 				}
 			}
 		}
 	}
 
-	if (!bSuitableLocationFound)
+	TArray<FTerrainSurfaceSample> Samples;
+	QueryTerrain(Chosen, Samples);
+	for (int32 Index = 0; Index < Chosen.Num(); Index++)
 	{
-		//UE_LOG(LogTemp, Warning, TEXT("No suitable goal location found after multiple attempts."));
-		
+		OutLocations.Add(FVector(Chosen[Index], Samples[Index].Height));
 	}
+	return OutLocations.Num();
 }
 
-void AWorldGenerator::SetGoalLocation2()
+bool AWorldGenerator::IsLocationSuitable(const FHitResult& HitResult)
 {
-	FVector PlayerLocation = GetPlayerLocation();
-	ATGGameMode* MyGameMode = Cast<ATGGameMode>(UGameplayStatics::GetGameMode(GetWorld()));
+	// Verify that the hit component is the terrain mesh
+	if (!IsTerrainComponent(HitResult.Component.Get()))
+	{
+		//UE_LOG(LogTemp, Warning, TEXT("Hit component is not the terrain mesh."));
+		return false;
+	}
 
-	// Configuration for trace parameters and fallback logic
-	FCollisionQueryParams TraceParams(FName(TEXT("GoalLocationTrace")), true);
-	TraceParams.bReturnPhysicalMaterial = true;
-	TraceParams.AddIgnoredComponent(seaMesh);
+	// Check if the physical material of the hit component is the expected type for terrain
+	if (HitResult.PhysMaterial.IsValid() && HitResult.PhysMaterial->SurfaceType != SupportedSurfaceType)
+	{
+		//UE_LOG(LogTemp, Warning, TEXT("Hit surface is not of the supported type."));
+		return false;
+	}
 
+	// Check for height and slope constraints
+	float SlopeAngle = FMath::RadiansToDegrees(FMath::Acos(FVector::DotProduct(HitResult.ImpactNormal, FVector::UpVector)));
+	bool isSuitable = HitResult.Location.Z >= MinHeightAboveTerrain && SlopeAngle <= GroundSlopeAngleMax;
 
-	FVector GoalLocation2;
-	bool bSuitableLocationFound = false;
-	int NumTries = 250; // Number of attempts to find a suitable location
-	float TargetDistance = 2000; // Distance for the goal location from the player
+	//UE_LOG(LogTemp, Log, TEXT("Checking location suitability: Height=%f, SlopeAngle=%f, IsSuitable=%s"),
+		//HitResult.Location.Z, SlopeAngle, isSuitable ? TEXT("True") : TEXT("False"));
 
-	for (int i = 0; i < NumTries; i++)
-	{
-		// Random direction and goal location setup
-		FVector GoalDirection2 = FMath::VRand();
-		GoalDirection2.Z = 0;
-		GoalDirection2.Normalize();
+	return isSuitable;
+}
 
-		GoalLocation2 = PlayerLocation + (GoalDirection2 * TargetDistance);
-		FVector Start = GoalLocation2 + FVector(0, 0, 500);
-		FVector End = GoalLocation2 - FVector(0, 0, 500);
-		FHitResult HitResult;
+//********************//
+// Goal setting //
+//********************//
 
-		if (GetWorld()->LineTraceSingleByChannel(HitResult, Start, End, ECC_Visibility, TraceParams))
-		{
-			if (HitResult.Component.IsValid() && HitResult.Component->IsA<UProceduralMeshComponent>())
-			{
-				FVector AdjustedGoalLocation = HitResult.Location + FVector(0, 0, 100);
-					if (IsPathValid(PlayerLocation, AdjustedGoalLocation))
-					{
-						SpawnHealthItemAtGoalLocation(AdjustedGoalLocation);
-						MyGameMode->GoalLocations.Add(AdjustedGoalLocation);
-						bSuitableLocationFound = true;
-						break;
-					}
-			}
-		}
-	}
+void AWorldGenerator::SetGoalLocation()
+{
+	RequestGoalLocation(2000);
+}
 
-	if (!bSuitableLocationFound)
-	{
-		//_LOG(LogTemp, Warning, TEXT("No suitable goal location 2 found after multiple attempts."));
-	
-	}
+void AWorldGenerator::SetGoalLocation2()
+{
+	RequestGoalLocation(2000);
 }
 
 void AWorldGenerator::SetGoalLocation3()
+{
+	RequestGoalLocation(2500);
+}
+
+void AWorldGenerator::RequestGoalLocation(float TargetDistance)
 {
 	FVector PlayerLocation = GetPlayerLocation();
 	ATGGameMode* MyGameMode = Cast<ATGGameMode>(UGameplayStatics::GetGameMode(GetWorld()));
 
-	// Configuration for trace parameters and fallback logic
-	FCollisionQueryParams TraceParams(FName(TEXT("GoalLocationTrace")), true);
-	TraceParams.bReturnPhysicalMaterial = true;
-	TraceParams.AddIgnoredComponent(seaMesh);
-
-	FVector GoalLocation3;
-	bool bSuitableLocationFound = false;
-	int NumTries = 250; // Number of attempts to find a suitable location
-	float TargetDistance = 2500; // Distance for the goal location from the player
+	// Clear of goals already placed and of those still being validated
+	TArray<FVector> Exclude = PendingGoalLocations;
+	if (MyGameMode)
+	{
+		Exclude.Append(MyGameMode->GoalLocations);
+	}
 
-	for (int i = 0; i < NumTries; i++)
+	TArray<FVector> GoalLocations;
+	if (FindSuitableLocations(FVector2D(PlayerLocation), TargetDistance, GoalCandidates, MinGoalSpacing, Exclude, GoalLocations) == 0)
 	{
-		// Random direction and goal location setup
-		FVector GoalDirection3 = FMath::VRand();
-		GoalDirection3.Z = 0;
-		GoalDirection3.Normalize();
+		//UE_LOG(LogTemp, Warning, TEXT("No suitable goal location found."));
+		return;
+	}
 
-		GoalLocation3 = PlayerLocation + (GoalDirection3 * TargetDistance);
-		FVector Start = GoalLocation3 + FVector(0, 0, 500);
-		FVector End = GoalLocation3 - FVector(0, 0, 500);
-		FHitResult HitResult;
+	TArray<FPathQueryCandidate> Candidates;
+	for (FVector& GoalLocation : GoalLocations)
+	{
+		GoalLocation.Z += 100;
+		FPathQueryCandidate& Candidate = Candidates.AddDefaulted_GetRef();
+		Candidate.Start = PlayerLocation;
+		Candidate.Goal = GoalLocation;
+	}
+	PendingGoalLocations.Append(GoalLocations);
 
-		if (GetWorld()->LineTraceSingleByChannel(HitResult, Start, End, ECC_Visibility, TraceParams))
+	// Paths are checked over the next frames, the best candidate with one becomes the goal
+	ValidatePaths(MoveTemp(Candidates), 1, FOnPathQueryBatchComplete::CreateWeakLambda(this, [this, GoalLocations](const TArray<int32>& ValidIndices)
 		{
-			if (HitResult.Component.IsValid() && HitResult.Component->IsA<UProceduralMeshComponent>())
+			for (const FVector& GoalLocation : GoalLocations)
 			{
-				FVector AdjustedGoalLocation = HitResult.Location + FVector(0, 0, 100);
-				if (IsPathValid(PlayerLocation, AdjustedGoalLocation))
-				{
-					SpawnHealthItemAtGoalLocation(AdjustedGoalLocation);
-					MyGameMode->GoalLocations.Add(AdjustedGoalLocation);
-					bSuitableLocationFound = true;
-					break;
-				}
+				PendingGoalLocations.RemoveSingle(GoalLocation);
 			}
-		}
-	}
 
-	if (!bSuitableLocationFound)
-	{
-	//UE_LOG(LogTemp, Warning, TEXT("No suitable goal location 3 found after multiple attempts."));
-		
-	}
+			if (ValidIndices.Num() == 0)
+			{
+				//UE_LOG(LogTemp, Warning, TEXT("No goal location with a path found."));
+				return;
+			}
+
+			const FVector& GoalLocation = GoalLocations[ValidIndices[0]];
+			SpawnHealthItemAtGoalLocation(GoalLocation);
+			if (ATGGameMode* GameMode = Cast<ATGGameMode>(UGameplayStatics::GetGameMode(GetWorld())))
+			{
+				GameMode->GoalLocations.Add(GoalLocation);
+			}
+		}
+	));
 }
 
 void AWorldGenerator::SetGoalLocationsComplete()
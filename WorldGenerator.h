@@ -6,6 +6,7 @@
 #include "GameFramework/Actor.h"
 #include "ProceduralMeshComponent.h"
 #include "FoliageType_InstancedStaticMesh.h"
+#include "Components/HierarchicalInstancedStaticMeshComponent.h"
 #include "NavMesh/NavMeshBoundsVolume.h"
 #include "NavigationSystem.h"
 #include "KismetProceduralMeshLibrary.h"
@@ -14,6 +15,16 @@
 #include "Engine/World.h"
 #include "DrawDebugHelpers.h" 
 #include "GameFramework/PlayerStart.h"
+#include "Async/AsyncWork.h"
+#include "TerrainTile.h"
+#include "TerrainTileCache.h"
+#include "TerrainTileStore.h"
+#include "TerrainTileRegistry.h"
+#include "TerrainHeightfieldComponent.h"
+#include "PathQueryService.h"
+#include "TerrainQuery.h"
+#include "TerrainSuitability.h"
+#include "TerrainFoliage.h"
 #include "WorldGenerator.generated.h"
 
 USTRUCT(BlueprintType)
@@ -21,14 +32,187 @@ struct  FFoliageInstanceData
 {
 	GENERATED_BODY()
 
+	// Hidden instances waiting to be reused, highest index first. Always the top of the component, past the instances in use.
 	UPROPERTY(BlueprintReadWrite, Category = "Trees")
 	TArray<int> Instances;
+
+	// Most instances in use at once since the pool last shrank
+	int32 HighWaterMark = 0;
+};
+
+// Foliage of one terrain tile, two components per foliage type, null where a type has no mesh or no instances yet
+USTRUCT()
+struct FTerrainTileFoliage
+{
+	GENERATED_BODY()
+
+	// Instances shown in the near and middle rings
+	UPROPERTY()
+	TArray<UHierarchicalInstancedStaticMeshComponent*> Components;
+
+	// Instances shown in the near ring only
+	UPROPERTY()
+	TArray<UHierarchicalInstancedStaticMeshComponent*> NearComponents;
+
+	// Ring each foliage type is shown at
+	TArray<ETerrainFoliageTier> Tiers;
+};
+
+// Rings around players a foliage type is drawn in. Past MiddleRadius it is culled.
+USTRUCT(BlueprintType)
+struct FFoliageTierSettings
+{
+	GENERATED_BODY()
+
+	// Every instance, with collision
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Trees")
+	float NearRadius = 15000.f;
+
+	// A fixed MiddleDensity share of the instances, without collision
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Trees")
+	float MiddleRadius = 60000.f;
+
+	// Read when a tile's foliage is placed, changes reach tiles placed afterwards
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Trees", meta = (ClampMin = "0", ClampMax = "1"))
+	float MiddleDensity = .3f;
+};
+
+USTRUCT(BlueprintType)
+struct FFoliagePoolStats
+{
+	GENERATED_BODY()
+
+	// Instances placed on drawn tiles, in whichever ring, plus those Blueprints added
+	UPROPERTY(BlueprintReadOnly, Category = "Trees")
+	int32 ActiveInstances = 0;
+
+	// Active instances in visible components, and in components with collision
+	UPROPERTY(BlueprintReadOnly, Category = "Trees")
+	int32 VisibleInstances = 0;
+
+	UPROPERTY(BlueprintReadOnly, Category = "Trees")
+	int32 CollidingInstances = 0;
+
+	// Hidden instances waiting to be reused, including every instance of the tile foliage waiting for a tile
+	UPROPERTY(BlueprintReadOnly, Category = "Trees")
+	int32 FreeInstances = 0;
+
+	// Tiles showing foliage, and pooled sets of tile foliage components waiting for one
+	UPROPERTY(BlueprintReadOnly, Category = "Trees")
+	int32 ActiveTiles = 0;
+
+	UPROPERTY(BlueprintReadOnly, Category = "Trees")
+	int32 FreeTiles = 0;
+
+	// Sum of every pool's high-water mark since it last shrank
+	UPROPERTY(BlueprintReadOnly, Category = "Trees")
+	int32 HighWaterMark = 0;
+
+	// Instances given a new transform instead of added
+	UPROPERTY(BlueprintReadOnly, Category = "Trees")
+	int64 Reused = 0;
+
+	UPROPERTY(BlueprintReadOnly, Category = "Trees")
+	int64 Added = 0;
+
+	// Instances hidden, with the tile they belonged to or as spares past a tile's instances
+	UPROPERTY(BlueprintReadOnly, Category = "Trees")
+	int64 Released = 0;
+
+	// Hidden instances removed by the shrink timer
+	UPROPERTY(BlueprintReadOnly, Category = "Trees")
+	int64 Removed = 0;
+};
+
+USTRUCT(BlueprintType)
+struct FTerrainCommitStats
+{
+	GENERATED_BODY()
+
+	// Finished tiles waiting to be committed, including the one in progress
+	UPROPERTY(BlueprintReadOnly, Category = "Land")
+	int32 QueueDepth = 0;
+
+	// Game thread time spent committing in the last frame
+	UPROPERTY(BlueprintReadOnly, Category = "Land")
+	float LastFrameMs = 0.f;
+
+	// Moving average of the time spent committing in frames that had work
+	UPROPERTY(BlueprintReadOnly, Category = "Land")
+	float AverageFrameMs = 0.f;
+
+	UPROPERTY(BlueprintReadOnly, Category = "Land")
+	float MaxFrameMs = 0.f;
+
+	// Frames where a single step ran past the budget
+	UPROPERTY(BlueprintReadOnly, Category = "Land")
+	int64 FramesOverBudget = 0;
+
+	UPROPERTY(BlueprintReadOnly, Category = "Land")
+	int64 TilesCommitted = 0;
 };
 
+USTRUCT(BlueprintType)
+struct FTerrainPrefetchStats
+{
+	GENERATED_BODY()
+
+	// Tiles generated ahead of the player
+	UPROPERTY(BlueprintReadOnly, Category = "Land")
+	int64 Issued = 0;
+
+	// Prefetched tiles later requested by the normal tile queue
+	UPROPERTY(BlueprintReadOnly, Category = "Land")
+	int64 Hits = 0;
+
+	// Prefetched tiles the player moved away from without requesting
+	UPROPERTY(BlueprintReadOnly, Category = "Land")
+	int64 Wasted = 0;
+
+	// Prefetched tiles not requested or given up on yet
+	UPROPERTY(BlueprintReadOnly, Category = "Land")
+	int64 Pending = 0;
 
+	// Hits / (Hits + Wasted)
+	UPROPERTY(BlueprintReadOnly, Category = "Land")
+	float HitRate = 0.f;
+};
 
 
 
+
+// Goals of the candidates with a full path, and their indices in the batch, in the order they were found
+DECLARE_DYNAMIC_DELEGATE_TwoParams(FOnPathsValidated, const TArray<FVector>&, ValidGoals, const TArray<int32>&, ValidIndices);
+
+USTRUCT(BlueprintType)
+struct FTerrainCollisionBenchmark
+{
+	GENERATED_BODY()
+
+	UPROPERTY(BlueprintReadOnly, Category = "Land")
+	int32 NumTiles = 0;
+
+	// Average time to cook one tile's triangle mesh, as its mesh section does
+	UPROPERTY(BlueprintReadOnly, Category = "Land")
+	float TrimeshCookMs = 0.f;
+
+	// Average time to build one tile's heightfield
+	UPROPERTY(BlueprintReadOnly, Category = "Land")
+	float HeightfieldBuildMs = 0.f;
+
+	// Average serialized size of one tile's collision
+	UPROPERTY(BlueprintReadOnly, Category = "Land")
+	int64 TrimeshBytes = 0;
+
+	UPROPERTY(BlueprintReadOnly, Category = "Land")
+	int64 HeightfieldBytes = 0;
+
+	// Largest height difference between the heightfield and the tile's triangles, over a point inside each triangle of every quad
+	UPROPERTY(BlueprintReadOnly, Category = "Land")
+	float MaxHeightError = 0.f;
+};
+
+
 UCLASS()
 class TG_API AWorldGenerator : public AActor
 {
@@ -42,7 +226,7 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "World")
 	bool LoadingFromSave = false;
 
-	ANavMeshBoundsVolume* NavMeshBoundsVolume;
+	ANavMeshBoundsVolume* NavMeshBoundsVolume = nullptr;
 
 	UPROPERTY( BlueprintReadWrite, Category = "World")
 	TSubclassOf<ACharacter> PlayerCharacterClass;
@@ -56,6 +240,30 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadonly, Category = "World")
 	int MinHeightAboveTerrain = 250.0f;
 
+	// Async path searches running at once for goal placement and ValidatePathsAsync
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "World")
+	int MaxPathSearchesInFlight = 8;
+
+	// Seconds a path validation result is reused for the same pair of navmesh polygons
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "World")
+	float PathCacheLifetime = 30.f;
+
+	// Rings of tiles past the ones the search circle crosses that FindSuitableLocations looks through before giving up
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "World")
+	int SuitabilitySearchTiles = 2;
+
+	// Tile indices FindSuitableLocations builds on the spot per call. Generated tiles bring their own, tiles past the cap are left out of that search.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "World")
+	int MaxSuitabilityBuildsPerSearch = 9;
+
+	// Closest two goals may be to each other
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "World")
+	float MinGoalSpacing = 1000.f;
+
+	// Suitable locations handed to path validation for each goal, best first
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "World")
+	int GoalCandidates = 8;
+
 	//**** Sea Variables ****//	
 
 	UPROPERTY(BlueprintReadonly, Category = "Sea")
@@ -94,12 +302,30 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Land")
 	UMaterialInterface* TerrainMaterial = nullptr;
 
+	// Set while MaxConcurrentTiles tiles are generating
 	UPROPERTY(BlueprintReadWrite, Category = "Land")
 	bool GeneratorBusy = false;
 
+	// Number of tiles that may generate on worker threads at the same time
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Land")
+	int MaxConcurrentTiles = 4;
+
+	// Set while generated tiles are waiting for DrawTile. Stays false when AutoCommitTiles is on.
 	UPROPERTY(BlueprintReadOnly, Category = "Land")
 	bool TileReady = false;
 
+	// Commit finished tiles from Tick in budgeted slices, including their foliage, instead of waiting for DrawTile
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Land")
+	bool AutoCommitTiles = true;
+
+	// Game thread time per frame for committing tiles. One step always runs, even if it takes longer.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Land")
+	float CommitBudgetMs = 4.f;
+
+	// Commit the finished tile nearest the player first, rather than the oldest
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Land")
+	bool CommitNearestFirst = true;
+
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Land")
 	float MountainHeight = 4000.f;
 
@@ -145,15 +371,117 @@ public:
 	UPROPERTY(BlueprintReadWrite, Category = "Land")
 	int MeshSectionIndex = 0;
 
+	// Mirror of the tile registry: tile -> (-1 queued, TileGenerating, or mesh section; LOD).
+	// Prefer QueueTile, direct writes are picked up but cost a full resync.
 	UPROPERTY(BlueprintReadWrite, Category = "Land")
 	TMap<FIntPoint, FIntPoint> QueuedTiles;
 
+	// Mirror of the tile registry: tile -> (section still showing its previous LOD; that LOD)
 	UPROPERTY(BlueprintReadWrite, Category = "Land")
 	TMap<FIntPoint, FIntPoint> RemoveLODQueue;
 
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Land")
 	float TileReplaceableDistance;
 
+	// Drawn tiles are only replaced once this much further than TileReplaceableDistance, so tiles on the edge do not thrash
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Land")
+	float TileUnloadHysteresis;
+
+	// Extra weight on the distance of queued tiles behind the player. 1 makes a tile straight behind count as twice as far.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Land")
+	float TileViewPriorityBias = 1.f;
+
+	// Generate tiles on the player's predicted path into the tile cache while generator slots are idle
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Land")
+	bool EnablePrefetch = true;
+
+	// Seconds of movement to look ahead, past the tiles already in range
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Land")
+	float PrefetchLookaheadSeconds = 4.f;
+
+	// How far the predicted path bends from the velocity towards the camera direction, 0 to 1
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Land")
+	float PrefetchViewWeight = .25f;
+
+	// Slowest speed that triggers prefetching
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Land")
+	float PrefetchMinSpeed = 300.f;
+
+	// Most prefetch jobs running at once
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Land")
+	int MaxPrefetchTiles = 2;
+
+	// LOD prefetched tiles are generated at, 0 for the LOD tiles are first requested at as they come into range
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Land")
+	int PrefetchLODLevel = 0;
+
+	// Memory for compressed tiles kept after they are unloaded, so revisits skip generation
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Land")
+	int TileCacheBudgetMB = 64;
+
+	// Read tiles from the on-disk tile store and write newly generated ones to it
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Land")
+	bool UseTileStore = true;
+
+	// Generated tiles held in memory before they are written to the tile store in one batch
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Land")
+	int TileStoreWriteBatch = 16;
+
+	// Full collision only near players and NPCs, coarse collision further out and none beyond. Off gives every tile full collision.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Land")
+	bool UseCollisionTiers = true;
+
+	// Tiles closer than this to a pawn collide with a copy of their drawn mesh
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Land")
+	float FullCollisionRadius = 20000.f;
+
+	// Tiles closer than this to a pawn collide with a low resolution copy, and give navigation
+	// a heightfield at that resolution. Keep it past the corners of the navigation regions.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Land")
+	float CoarseCollisionRadius = 80000.f;
+
+	// LOD the coarse copies are built at, tiles drawn coarser than this use their own LOD
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Land")
+	int CoarseCollisionLOD = 4;
+
+	// Seconds between checks of which tiles crossed a collision radius
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Land")
+	float CollisionUpdateInterval = .5f;
+
+	// Collide with heightfields built from the height samples instead of cooked triangle meshes, for both collision tiers.
+	// Applied as tiles change tier, so set it before play.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Land")
+	bool UseHeightfieldCollision = false;
+
+	// Terrain tiles added to navigation per frame, each dirties only the nav tiles under it
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Land")
+	int MaxNavTileUpdatesPerFrame = 2;
+
+	// Nav tiles the navmesh may build at once on worker threads, set on the navmesh at BeginPlay
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Land")
+	int MaxNavTileJobs = 4;
+
+	// Build navigation only around players and NPCs, in squares of whole terrain tiles that move when a pawn changes tile.
+	// Needs Generate Navigation Only Around Navigation Invokers in the project's navigation settings.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Land")
+	bool UseNavRegions = true;
+
+	// Terrain tiles on each side of a pawn's tile that get navigation
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Land")
+	int NavRegionRadiusTiles = 1;
+
+	// Terrain tiles on each side that keep their built navigation after the pawn leaves, so going back does not rebuild it
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Land")
+	int NavRegionKeepTiles = 2;
+
+	// Most regions at once, the player's first and then those of the nearest NPCs. Bounds the memory navigation can use.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Land")
+	int MaxNavRegions = 6;
+
+	// Half size of the navigation bounds volume, set once at BeginPlay to cover the terrain around the generator
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Land")
+	float NavBoundsExtent = 4000000.f;
+
 	
 
 	//**** Trees Variables ****//	
@@ -164,6 +492,10 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Trees")
 	bool RandomiseFoliage = true;
 
+	// Poisson-disk foliage, the same for a tile at every LOD and in every session with the same InitialSeed. Off places clusters around each vertex.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Trees")
+	bool UsePoissonFoliage = true;
+
 	UPROPERTY( BlueprintReadWrite, Category = "Trees")
 	int InitialSeed = 0;
 
@@ -202,6 +534,29 @@ public:
 
 	UPROPERTY(BlueprintReadWrite, Category = "Trees")
 	TMap<UInstancedStaticMeshComponent*, FFoliageInstanceData> ReplaceableFoliagePool;
+
+	// Seconds between shrinks of the foliage pools, 0 never shrinks them
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Trees")
+	float FoliagePoolShrinkInterval = 30.f;
+
+	// Hidden instances a pool keeps when it shrinks, as a fraction of its high-water mark
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Trees")
+	float FoliagePoolSlack = .25f;
+
+	// Thins, strips collision from and culls tile foliage by distance to the nearest player. Off shows every instance with collision.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Trees")
+	bool UseFoliageTiers = true;
+
+	// Rings for foliage types missing from FoliageTiers
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Trees")
+	FFoliageTierSettings DefaultFoliageTiers;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Trees")
+	TMap<UFoliageType_InstancedStaticMesh*, FFoliageTierSettings> FoliageTiers;
+
+	// Seconds between checks of which tiles crossed a foliage ring
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Trees")
+	float FoliageTierUpdateInterval = .5f;
 	//--------------
 
 	const float FlatRadius = 3000.0f;
@@ -211,6 +566,10 @@ public:
 	
 
 
+	// QueuedTiles value for a tile whose generation job has not finished yet
+	static constexpr int TileGenerating = -2;
+
+	// Tile being drawn by DrawTile
 	int SectionIndexX = 0;
 	int SectionIndexY = 0;
 	int CellLODLevel = 1;
@@ -218,20 +577,205 @@ public:
 	private:
 		bool bPlayerSpawned = false;
 
+		// Generation jobs that have not reported back yet
+		int TilesInFlight = 0;
+
+		// Finished tiles waiting for DrawTile, oldest first
+		TArray<FTerrainTileDataRef> CompletedTiles;
+
+		// Tile currently being committed by DrawTile
+		FTerrainTileDataPtr CommittingTile;
+
+		enum class ECommitStep : uint8
+		{
+			Upload,
+			Foliage,
+			Done
+		};
+
+		// Tile being committed from Tick, one step at a time
+		struct FTileCommit
+		{
+			FTerrainTileDataPtr Tile;
+			ECommitStep Step = ECommitStep::Upload;
+			int32 SectionIndex = INDEX_NONE;
+			// Next foliage type the Foliage step places
+			int32 FoliageTypeIndex = 0;
+		};
+		FTileCommit ActiveCommit;
+
+		// Pooled per-tile foliage, indexed by FTerrainTileRecord::FoliageIndex
+		UPROPERTY()
+		TArray<FTerrainTileFoliage> TileFoliage;
+		TArray<int32> FreeTileFoliage;
+
+		// Gives the tile's foliage components exactly these instances, taking pooled components if it has none
+		void SetTileFoliage(FTerrainTileRecord& Record, const FTerrainFoliageInstances& Foliage);
+
+		// SetTileFoliage in parts: Begin takes the tile's slot, or releases it if there is nothing to place, then each type is placed on its own
+		bool BeginTileFoliage(FTerrainTileRecord& Record, const FTerrainFoliageInstances& Foliage);
+		void SetTileFoliageType(FTerrainTileRecord& Record, const FTerrainFoliageInstances& Foliage, int32 FoliageTypeIndex);
+
+		// Hides the tile's foliage components as a whole and returns them to the pool, no instance is touched
+		void ReleaseTileFoliage(FTerrainTileRecord& Record);
+
+		UHierarchicalInstancedStaticMeshComponent* CreateTileFoliageComponent(int32 FoliageTypeIndex);
+
+		// A seed of the Blueprint foliage calls, waiting for its batch to be sampled
+		struct FPendingFoliageSeed
+		{
+			UFoliageType_InstancedStaticMesh* FoliageType = nullptr;
+			UInstancedStaticMeshComponent* FoliageComponent = nullptr;
+			FVector2D Location = FVector2D::ZeroVector;
+			// Placed by TrySpawnFoliageAtLocation rather than TrySpawnFoliageInstance
+			bool bAtLocation = false;
+		};
+		TArray<FPendingFoliageSeed> PendingFoliageSeeds;
+		int32 FoliageBatchDepth = 0;
+
+		// Moves tile foliage between rings as players move, only touching tiles that cross one
+		void UpdateFoliageTiers();
+		const FFoliageTierSettings& GetFoliageTierSettings(int32 FoliageTypeIndex) const;
+		ETerrainFoliageTier GetDesiredFoliageTier(const FTerrainTileRecord& Record, int32 FoliageTypeIndex, ETerrainFoliageTier CurrentTier) const;
+		void UpdateFoliageViewers();
+		// Visibility and collision of one foliage type's components, nothing is placed again
+		void SetFoliageTier(FTerrainTileFoliage& Slot, int32 FoliageTypeIndex, ETerrainFoliageTier Tier);
+		bool HasFoliageInstances(UInstancedStaticMeshComponent* FoliageComponent) const;
+		double LastFoliageTierUpdateTime = -1.0;
+		TArray<FVector2D> FoliageViewers;
+
+		// Rewrites the component's instances to Transforms in one batch, reusing its instances first. Instances left over are hidden at HiddenLocation.
+		void PlaceFoliageInstances(UInstancedStaticMeshComponent* FoliageComponent, const TArray<FTransform>& Transforms, const FVector& HiddenLocation);
+
+		// Removes hidden instances above each pool's high-water mark plus slack, from the top of the component
+		void ShrinkFoliagePools();
+
+		FFoliagePoolStats FoliagePoolStats;
+		double LastFoliagePoolShrinkTime = 0.0;
+
+		FTerrainCommitStats CommitStats;
+
+		// State of every queued, generating and drawn tile, with load and unload priorities
+		FTerrainTileRegistry TileRegistry;
+
+		// Cleared mesh sections, reused before MeshSectionIndex grows
+		TArray<int32> FreeMeshSections;
+
+		// Pooled hidden per-tile collision meshes, indexed by FTerrainTileRecord::CollisionMeshIndex. Each tile has its own component,
+		// a procedural mesh re-cooks every section it holds when one changes.
+		UPROPERTY()
+		TArray<UProceduralMeshComponent*> CollisionMeshes;
+		TArray<int32> FreeCollisionMeshes;
+
+		// XY of every player and NPC pawn, collision tiers are measured from these
+		TArray<FVector2D> CollisionAnchors;
+		double LastCollisionUpdateTime = -1.0;
+
+		// Pooled per-tile heightfields, indexed by FTerrainTileRecord::HeightfieldIndex. Navigation for full collision tiles, and collision when UseHeightfieldCollision is on.
+		UPROPERTY()
+		TArray<UTerrainHeightfieldComponent*> HeightfieldComponents;
+		TArray<int32> FreeHeightfields;
+
+		// Heightfields with full collision waiting to be added to navigation
+		TSet<int32> PendingNavTiles;
+
+		// Navigation invoker at the centre of each terrain tile a region is built around
+		UPROPERTY()
+		TMap<FIntPoint, AActor*> NavRegionAnchors;
+
+		// Batched async path validation, created at BeginPlay
+		TSharedPtr<FPathQueryService> PathQueries;
+
+		// Finds a goal TargetDistance from the player with a full path to it, then places a health item there
+		void RequestGoalLocation(float TargetDistance);
+
+		// Candidates of goals still waiting on path validation, kept clear of by later goals
+		TArray<FVector> PendingGoalLocations;
+
+		// Spawn and goal cells of every tile with a record, dropped with the record
+		TMap<FIntPoint, FTerrainSuitabilityIndexRef> SuitabilityIndices;
+
+		FTerrainSuitabilityParams GetSuitabilityParams() const;
+
+		// The tile's index, built on the spot if the tile has none yet or its limits changed and BuildBudget allows.
+		// Only kept while the tile has a record. Null once the budget is spent.
+		FTerrainSuitabilityIndexPtr GetSuitabilityIndex(const FIntPoint& Tile, int32& BuildBudget);
+
+		// Recently generated tiles, keyed by tile, LOD and layout
+		FTerrainTileCache TileCache;
+
+		// Tiles kept on disk between sessions, null when UseTileStore is off
+		TUniquePtr<FTerrainTileStore> TileStore;
 
-		TArray<int32> Triangles;
-		TArray<FVector> SubVertices;
-		TArray<FVector2D> SubUVs;
-		TArray<int32> SubTriangles;
-		TArray<FVector> SubNormals;
-		TArray<FProcMeshTangent> SubTangents;
 		TArray<AActor*> SpawnedHealthItems;
 
+		// Prefetch jobs in flight, true once the normal tile queue asked for the tile
+		TMap<FTerrainTileCacheKey, bool> PrefetchJobs;
+
+		// Prefetched tiles waiting in the cache to be requested
+		TSet<FTerrainTileCacheKey> PrefetchedTiles;
+
+		FTerrainPrefetchStats PrefetchStats;
+		double LastPrefetchTime = 0.0;
+
+		// LOD the last tile to come into range was first requested at, what a prefetched tile will be asked for. 0 until one is.
+		int32 EntryLODLevel = 0;
+
+		// Registry updates, each mirrored into QueuedTiles and RemoveLODQueue
+		void SetTileRecord(const FIntPoint& Tile, const FTerrainTileRecord& Record);
+		void RemoveTileRecord(const FIntPoint& Tile);
+		void MarkTileGenerating(const FIntPoint& Tile, int32 LODLevel);
+
+		// Rebuilds the registry if Blueprints changed QueuedTiles or RemoveLODQueue directly
+		void SyncTileRegistry();
+		bool AreTileMirrorsCurrent() const;
+		static FIntPoint GetQueuedTilesValue(const FTerrainTileRecord& Record);
+
+		// Passes the player's location and view direction to the registry
+		void UpdateTileViewer();
+
+		void AddCompletedTile(const FTerrainTileDataRef& Tile);
+
+		// Runs commit steps until the frame's budget is spent
+		void CommitTiles();
+		void RunCommitStep();
+
+		// Starts prefetch jobs along the player's predicted path and settles earlier ones
+		void UpdatePrefetch();
+		void StartTileJob(const FTerrainTileParams& Params, const FTerrainTileDataRef& Tile);
+
+		// Copy of the foliage settings for placement jobs
+		FTerrainFoliageParams GetFoliageParams() const;
+
+		// Moves drawn tiles between collision tiers as pawns move
+		void UpdateCollisionTiers();
+		void UpdateCollisionAnchors();
+		ETerrainCollisionTier GetDesiredCollisionTier(const FIntPoint& Tile, ETerrainCollisionTier CurrentTier) const;
+		// bSectionChanged rebuilds collision taken from the drawn section, after the section was rewritten
+		void SetTileCollisionTier(const FIntPoint& Tile, ETerrainCollisionTier Tier, bool bSectionChanged = false);
+		void BuildTileCollisionMesh(const FIntPoint& Tile, ETerrainCollisionTier Tier, FTerrainTileRecord& Record);
+		void ReleaseCollisionMesh(FTerrainTileRecord& Record);
+		void BuildTileHeightfield(const FIntPoint& Tile, ETerrainCollisionTier Tier, int32 LODLevel, FTerrainTileRecord& Record);
+		void ReleaseHeightfield(FTerrainTileRecord& Record);
+
+		// Adds up to MaxNavTileUpdatesPerFrame pending tiles to navigation
+		void UpdateNavTiles();
+
+		// Moves navigation regions to the tiles pawns are on, only acting when the set of tiles changes
+		void UpdateNavRegions();
+		AActor* SpawnNavRegionAnchor();
+		void SetupNavBounds();
+
+		// Built on demand by GetTerrainQuery, dropped whenever a tile record changes
+		FTerrainQueryPtr TerrainQuery;
+
 
 protected:
 	// Called when the game starts or when spawned
 	virtual void BeginPlay() override;
 
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
 
 
 public:
@@ -270,12 +814,23 @@ public:
 	UFUNCTION(BlueprintCallable, Category = "Land")
 	FVector2D GetTileLocation(FIntPoint TileCoordinate);
 
+	// Queues a tile for generation at LODLevel. A tile already drawn at another LOD keeps its section until the new one is drawn.
+	UFUNCTION(BlueprintCallable, Category = "Land")
+	void QueueTile(FIntPoint Tile, int LODLevel);
+
 	UFUNCTION(BlueprintCallable, Category = "Land")
 	FIntPoint GetClosestQueuedTile();
 
+	// Index into QueuedTiles of the tile DrawTile would replace next, -1 if none. Linear, kept for Blueprints.
 	UFUNCTION(BlueprintCallable, Category = "Land")
 	int GetFurthestUpdateableTile();
 
+	// Tile DrawTile would replace next. False if every drawn tile is still in range.
+	bool GetFurthestReplaceableTile(FIntPoint& OutTile);
+
+	// As above, limited to tiles drawn at LODLevel
+	bool GetFurthestReplaceableTile(int32 LODLevel, FIntPoint& OutTile);
+
 	//********************//
 	// Land//
 	//********************//
@@ -293,6 +848,49 @@ public:
 	UFUNCTION(BlueprintCallable, Category = "Land")
 	void GenerateTerrainAsync(const int InSectionIndexX, const int InSectionIndexY, const int LODLevel);
 
+	// Called on the game thread when a generation job has filled its tile
+	void OnTileGenerated(const FTerrainTileDataRef& Tile, const FCompressedTerrainTileRef& CompressedTile);
+
+	// Called on the game thread when a foliage job has placed foliage on a cached or stored tile
+	void OnFoliageGenerated(const FTerrainTileDataRef& Tile);
+
+	UFUNCTION(BlueprintCallable, Category = "Land")
+	FTerrainTileCacheStats GetTileCacheStats() const;
+
+	UFUNCTION(BlueprintCallable, Category = "Land")
+	FTerrainPrefetchStats GetPrefetchStats() const;
+
+	UFUNCTION(BlueprintCallable, Category = "Land")
+	FTerrainCommitStats GetCommitStats() const;
+
+	// Builds collision for NumTiles tiles both ways, cooked triangle mesh and heightfield, and compares cost, size and surface
+	UFUNCTION(BlueprintCallable, Category = "Land")
+	FTerrainCollisionBenchmark BenchmarkTileCollision(int NumTiles = 16, int LODLevel = 1);
+
+	// True for the drawn terrain and every component holding terrain collision
+	UFUNCTION(BlueprintCallable, Category = "Land")
+	bool IsTerrainComponent(const UPrimitiveComponent* Component) const;
+
+	// Snapshot of everything tile generation reads from this actor
+	FTerrainTileParams GetTileParams() const;
+
+	// Terrain surface at the LOD each tile is drawn at, from the height function. Safe to keep and use from any thread.
+	FTerrainQueryRef GetTerrainQuery();
+
+	// Height, normal and slope at each location, without touching the physics scene
+	UFUNCTION(BlueprintCallable, Category = "Land")
+	void QueryTerrain(const TArray<FVector2D>& Locations, TArray<FTerrainSurfaceSample>& OutSamples);
+
+	UFUNCTION(BlueprintCallable, Category = "Land")
+	FTerrainSurfaceSample QueryTerrainAt(FVector2D Location);
+
+	// What a trace against the terrain reports as its physical material
+	UFUNCTION(BlueprintCallable, Category = "Land")
+	UPhysicalMaterial* GetTerrainPhysicalMaterial() const;
+
+	// Builds the mesh buffers for OutTile.Tile at OutTile.LODLevel. Safe to call from any thread.
+	static void GenerateTerrainTile(const FTerrainTileParams& Params, FTerrainTileData& OutTile);
+
 	UFUNCTION(BlueprintCallable, Category = "Land")
 	float GetHeight(const FVector2D Location);
 
@@ -302,6 +900,9 @@ public:
 	UFUNCTION(BlueprintCallable, Category = "Land")
 	float PerlinNoiseExtended(const FVector2D Location, const float Scale, const float Amplitude, const FVector2D offset);
 
+	// Snapshot of the current layout for the batched height kernel
+	FTerrainNoiseParams GetNoiseParams() const;
+
 	//********************//
 	//**** Tree ****//
 	//********************//
@@ -309,6 +910,7 @@ public:
 	UFUNCTION(BlueprintImplementableEvent, Category = "Trees")
 	bool RemoveFoliageTile(const int TileIndex);
 
+	// Releases the foliage of the tile drawn in a mesh section
 	UFUNCTION(BlueprintCallable, Category = "Trees")
 	void RemoveFoliageTileCpp(const int TileIndex);
 
@@ -336,9 +938,13 @@ public:
 	UFUNCTION(BlueprintCallable, Category = "Trees")
 	void InitialiseFoliageTypes();
 
+	// Render update for instances Blueprints added to FoliageComponents. Tile foliage is updated in batches as tiles are committed.
 	UFUNCTION(BlueprintCallable, Category = "Trees")
 	void RefreshFoliage();
 
+	UFUNCTION(BlueprintCallable, Category = "Trees")
+	FFoliagePoolStats GetFoliagePoolStats() const;
+
 	UFUNCTION(BlueprintCallable, Category = "Trees")
 	void FoliageRandomisation();
 
@@ -356,6 +962,14 @@ public:
 	
 	UFUNCTION(BlueprintCallable, Category = "Trees")
 	void TrySpawnFoliageAtLocation(UFoliageType_InstancedStaticMesh* FoliageType, const FVector& Location);
+
+	// Foliage calls between these are sampled from the terrain query in one batch and added in one call per component.
+	// Bracket a tile's worth of AddFoliageInstances and AddRelevantFoliageInstances with them. Calls outside a batch are a batch of their own.
+	UFUNCTION(BlueprintCallable, Category = "Trees")
+	void BeginFoliageBatch();
+
+	UFUNCTION(BlueprintCallable, Category = "Trees")
+	void EndFoliageBatch();
 	
 	
 	//********************//
@@ -372,12 +986,42 @@ public:
 	UFUNCTION(BlueprintCallable, Category = "World")
 	void SpawnHealthItemAtGoalLocation(const FVector& GoalLocation);
 
+	// Blocks on a path search, prefer ValidatePathsAsync
 	UFUNCTION(BlueprintCallable, Category = "World")
 	bool IsPathValid(FVector StartLocation, FVector GoalLocation);
 
+	/**
+	 * Tests candidates for a full path over the next frames, stopping once MaxValid are found (every candidate
+	 * if MaxValid <= 0). OnComplete is never called from inside this function. Returns an id for CancelPathValidation.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "World")
+	int32 ValidatePathsAsync(const TArray<FPathQueryCandidate>& Candidates, int MaxValid, FOnPathsValidated OnComplete);
+
+	uint32 ValidatePaths(TArray<FPathQueryCandidate> Candidates, int32 MaxValid, FOnPathQueryBatchComplete OnComplete);
+
+	// Drops a validation without calling its delegate
+	UFUNCTION(BlueprintCallable, Category = "World")
+	void CancelPathValidation(int32 BatchId);
+
+	UFUNCTION(BlueprintCallable, Category = "World")
+	FPathQueryStats GetPathQueryStats() const;
+
 	UFUNCTION(BlueprintCallable, Category = "World")
 	bool IsLocationSuitable(const FHitResult& HitResult);
 
+	// IsLocationSuitable for a terrain query result
+	UFUNCTION(BlueprintCallable, Category = "World")
+	bool IsSurfaceSuitable(const FTerrainSurfaceSample& Sample) const;
+
+	/**
+	 * Up to MaxResults suitable locations, on the terrain surface, closest to being Radius from Center, best first.
+	 * Locations keep MinSpacing from each other and from Exclude. Looks up the per-tile suitability indices, tiles
+	 * nearest the circle first, so the same terrain gives the same result as long as the tiles the circle crosses
+	 * fit in MaxSuitabilityBuildsPerSearch. Returns the number found.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "World")
+	int FindSuitableLocations(FVector2D Center, float Radius, int MaxResults, float MinSpacing, const TArray<FVector>& Exclude, TArray<FVector>& OutLocations);
+
 
 	//********************//
 	// Goal setting //
@@ -419,12 +1063,35 @@ public:
 class FAsyncWorldGenerator : public FNonAbandonableTask
 {
 public:
-	FAsyncWorldGenerator(AWorldGenerator* InWorldGenerator) : WorldGenerator(InWorldGenerator) {}
+	FAsyncWorldGenerator(AWorldGenerator* InWorldGenerator, const FTerrainTileParams& InParams, const FTerrainSuitabilityParams& InSuitabilityParams, const FTerrainFoliageParams& InFoliageParams, const FTerrainTileDataRef& InTile)
+		: WorldGenerator(InWorldGenerator), Params(InParams), SuitabilityParams(InSuitabilityParams), FoliageParams(InFoliageParams), Tile(InTile) {}
 	FORCEINLINE TStatId GetStatId() const
 	{
 		RETURN_QUICK_DECLARE_CYCLE_STAT(FAsyncWorldGenerator, STATGROUP_ThreadPoolAsyncTasks);
 	}
 	void DoWork();
 private:
-	AWorldGenerator* WorldGenerator;
+	TWeakObjectPtr<AWorldGenerator> WorldGenerator;
+	const FTerrainTileParams Params;
+	const FTerrainSuitabilityParams SuitabilityParams;
+	const FTerrainFoliageParams FoliageParams;
+	FTerrainTileDataRef Tile;
+};
+
+// Places foliage on a tile that was read back from the cache or the tile store, which keep no foliage
+class FAsyncFoliageGenerator : public FNonAbandonableTask
+{
+public:
+	FAsyncFoliageGenerator(AWorldGenerator* InWorldGenerator, const FTerrainTileParams& InParams, const FTerrainFoliageParams& InFoliageParams, const FTerrainTileDataRef& InTile)
+		: WorldGenerator(InWorldGenerator), Params(InParams), FoliageParams(InFoliageParams), Tile(InTile) {}
+	FORCEINLINE TStatId GetStatId() const
+	{
+		RETURN_QUICK_DECLARE_CYCLE_STAT(FAsyncFoliageGenerator, STATGROUP_ThreadPoolAsyncTasks);
+	}
+	void DoWork();
+private:
+	TWeakObjectPtr<AWorldGenerator> WorldGenerator;
+	const FTerrainTileParams Params;
+	const FTerrainFoliageParams FoliageParams;
+	FTerrainTileDataRef Tile;
 };
\ No newline at end of file